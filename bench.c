@@ -0,0 +1,346 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Host micro-benchmarks. See bench.h.
+ */
+
+#include "bench.h"
+#include "shell.h"
+#include "pipe.h"
+#include "isa.h"
+#include "loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/***************************************************************/
+/* Memory accessors.                                           */
+/***************************************************************/
+
+/* the scratch region: host pages mapped in at an address programs don't
+ * use, for the duration of the run */
+#define MEMBENCH_BASE 0xA0000000
+#define MEMBENCH_SIZE (4 << 20)
+
+static void membench_report(const char *name, double start, int n)
+{
+    printf("  %-12s %6.2f ns/access\n", name, (bench_now() - start) * 1e9 / n);
+}
+
+void bench_memory(int n)
+{
+    uint32_t sum = 0, x = 12345, i;
+    double start;
+
+    if (n <= 0)
+        return;
+
+    for (i = 0; i < MEMBENCH_SIZE; i += PAGE_SIZE) {
+        if (mem_page(MEMBENCH_BASE + i, FALSE)) {
+            printf("The program uses the scratch region at 0x%08x\n\n", MEMBENCH_BASE);
+            return;
+        }
+    }
+    uint32_t *scratch = mmap(NULL, MEMBENCH_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (scratch == MAP_FAILED) {
+        printf("Error: out of memory\n\n");
+        return;
+    }
+    for (i = 0; i < MEMBENCH_SIZE / 4; i++) {
+        x = x * 1103515245 + 12345;
+        scratch[i] = x;
+    }
+    mem_map_pages(MEMBENCH_BASE, (uint8_t *)scratch, MEMBENCH_SIZE / PAGE_SIZE);
+
+    printf("\nMemory accessors, %d accesses each:\n", n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        sum += mem_read_32(MEMBENCH_BASE + ((i * 4) & (MEMBENCH_SIZE - 1)));
+    membench_report("read32 seq", start, n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++) {
+        x = x * 1103515245 + 12345;
+        sum += mem_read_32(MEMBENCH_BASE + (x & (MEMBENCH_SIZE - 4)));
+    }
+    membench_report("read32 rand", start, n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        sum += mem_read_16(MEMBENCH_BASE + ((i * 2) & (MEMBENCH_SIZE - 1)));
+    membench_report("read16", start, n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        sum += mem_read_8(MEMBENCH_BASE + (i & (MEMBENCH_SIZE - 1)));
+    membench_report("read8", start, n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        mem_write_32(MEMBENCH_BASE + ((i * 4) & (MEMBENCH_SIZE - 1)), i);
+    membench_report("write32", start, n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        mem_write_16(MEMBENCH_BASE + ((i * 2) & (MEMBENCH_SIZE - 1)), i);
+    membench_report("write16", start, n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        mem_write_8(MEMBENCH_BASE + (i & (MEMBENCH_SIZE - 1)), i);
+    membench_report("write8", start, n);
+
+    printf("  (checksum 0x%08x)\n\n", sum);
+
+    mem_unmap_pages(MEMBENCH_BASE, MEMBENCH_SIZE / PAGE_SIZE);
+    munmap(scratch, MEMBENCH_SIZE);
+}
+
+/***************************************************************/
+/* Program loaders.                                            */
+/***************************************************************/
+
+/* the original loader: one fscanf and one mem_write_32 per word */
+static int load_program_fscanf(const char *program, uint32_t base)
+{
+    FILE *prog = fopen(program, "r");
+    int ii = 0, word;
+
+    if (prog == NULL)
+        return -1;
+    while (fscanf(prog, "%x\n", &word) != EOF) {
+        mem_write_32(base + ii, word);
+        ii += 4;
+    }
+    fclose(prog);
+    return ii / 4;
+}
+
+/* every loader writes the program's own words back over it */
+void bench_load(const char *program, uint32_t base, int n)
+{
+    double start;
+    int i, words = 0;
+
+    if (!program) {
+        printf("No .x program loaded\n\n");
+        return;
+    }
+    if (n <= 0)
+        return;
+
+    printf("\nLoading %s, %d times each:\n", program, n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        words = load_program_fscanf(program, base);
+    printf("  %-12s %9.3f ms/load\n", "fscanf", (bench_now() - start) * 1e3 / n);
+
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        text_load(program, base, FALSE);
+    printf("  %-12s %9.3f ms/load\n", "parse", (bench_now() - start) * 1e3 / n);
+
+    /* the first load fills the cache if the image isn't there yet */
+    text_load(program, base, TRUE);
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        text_load(program, base, TRUE);
+    printf("  %-12s %9.3f ms/load\n", "image cache", (bench_now() - start) * 1e3 / n);
+
+    printf("  (%d words)\n\n", words);
+}
+
+/***************************************************************/
+/* In-flight ops.                                              */
+/***************************************************************/
+
+/* the previous layout: int fields in declaration order, one malloc each */
+typedef struct Pipe_Op_Wide {
+    uint32_t pc, instruction;
+    int opcode, subop;
+    uint32_t imm16, se_imm16;
+    int shamt;
+    int reg_src1, reg_src2;
+    uint32_t reg_src1_value, reg_src2_value;
+    int is_mem;
+    uint32_t mem_addr;
+    int mem_write;
+    uint32_t mem_value;
+    int reg_dst;
+    uint32_t reg_dst_value;
+    int reg_dst_value_ready;
+    uint32_t hi_value, lo_value;
+    int is_branch;
+    uint32_t branch_dest;
+    int branch_cond, branch_taken, is_link, link_reg;
+    _Bool BTB_miss;
+    uint32_t BTB_index;
+    _Bool predict_taken;
+    uint8_t pattern_index;
+} Pipe_Op_Wide;
+
+#define OPBENCH_VISITS (1 << 24)
+
+/* one pass: wake up the ops waiting on a register, as a scheduler would,
+ * and look at what a bypass or recovery check looks at */
+#define OPBENCH_SCAN(ops, n, sum) \
+    for (int k = 0; k < (n); k++) { \
+        int r = k & 31; \
+        if ((ops)[k]->reg_src1 == r || (ops)[k]->reg_src2 == r) \
+            (ops)[k]->reg_dst_value_ready = 1; \
+        if ((ops)[k]->is_mem && !(ops)[k]->mem_write) \
+            (sum) += (ops)[k]->mem_addr; \
+        if ((ops)[k]->is_branch && (ops)[k]->branch_taken != (ops)[k]->predict_taken) \
+            (sum) += (ops)[k]->branch_dest; \
+        (sum) += (ops)[k]->reg_dst_value; \
+    }
+
+/* the packed Pipe_Op against the previous all-int layout */
+void bench_ops(int n)
+{
+    Pipe_Op **ops;
+    Pipe_Op_Wide **wide;
+    uint32_t sum = 0, x = 12345;
+    int i, pass, passes;
+    double start;
+
+    if (n <= 0)
+        return;
+    passes = OPBENCH_VISITS / n > 0 ? OPBENCH_VISITS / n : 1;
+
+    ops = malloc(n * sizeof(*ops));
+    wide = malloc(n * sizeof(*wide));
+    if (!ops || !wide) {
+        printf("Error: out of memory\n\n");
+        free(ops);
+        free(wide);
+        return;
+    }
+
+    /* ops allocated one by one as fetch does, visited in a shuffled order
+     * as ops from different stages and queues would be */
+    for (i = 0; i < n; i++) {
+        ops[i] = pipe_op_alloc();
+        wide[i] = malloc(sizeof(Pipe_Op_Wide));
+        memset(wide[i], 0, sizeof(Pipe_Op_Wide));
+        x = x * 1103515245 + 12345;
+        ops[i]->reg_src1 = wide[i]->reg_src1 = (x >> 8) & 31;
+        ops[i]->is_mem = wide[i]->is_mem = (x >> 16) & 1;
+        ops[i]->is_branch = wide[i]->is_branch = (x >> 17) & 1;
+        ops[i]->mem_addr = wide[i]->mem_addr = x;
+    }
+    for (i = n - 1; i > 0; i--) {
+        x = x * 1103515245 + 12345;
+        int j = (x >> 4) % (i + 1);
+        Pipe_Op *t = ops[i]; ops[i] = ops[j]; ops[j] = t;
+        Pipe_Op_Wide *w = wide[i]; wide[i] = wide[j]; wide[j] = w;
+    }
+
+    printf("\nScanning %d in-flight ops, %d passes:\n", n, passes);
+
+    start = bench_now();
+    for (pass = 0; pass < passes; pass++)
+        OPBENCH_SCAN(ops, n, sum);
+    printf("  %-12s %6.2f ns/op  (%zu bytes, %zu-byte aligned)\n", "packed",
+           (bench_now() - start) * 1e9 / ((double)passes * n),
+           sizeof(Pipe_Op), _Alignof(Pipe_Op));
+
+    start = bench_now();
+    for (pass = 0; pass < passes; pass++)
+        OPBENCH_SCAN(wide, n, sum);
+    printf("  %-12s %6.2f ns/op  (%zu bytes, malloc-aligned)\n", "wide",
+           (bench_now() - start) * 1e9 / ((double)passes * n),
+           sizeof(Pipe_Op_Wide));
+
+    printf("  (checksum 0x%08x)\n\n", sum);
+
+    for (i = 0; i < n; i++) {
+        free(ops[i]);
+        free(wide[i]);
+    }
+    free(ops);
+    free(wide);
+}
+
+/***************************************************************/
+/* Decode and execute.                                         */
+/***************************************************************/
+
+/* each op set up as fetch does, with arbitrary source values; nothing is
+ * written back */
+void bench_isa(uint32_t base, int words, int n)
+{
+    Pipe_Op *op;
+    uint32_t *text;
+    uint32_t sum = 0, x = 12345;
+    int i, pass, count[INSN_COUNT] = { 0 }, valid = 0;
+    double start, elapsed;
+    char line[64];
+
+    if (words <= 0) {
+        printf("No .x program loaded\n\n");
+        return;
+    }
+    if (n <= 0)
+        return;
+
+    text = malloc(words * sizeof(*text));
+    op = pipe_op_alloc();
+    if (!text || !op) {
+        printf("Error: out of memory\n\n");
+        free(text);
+        free(op);
+        return;
+    }
+    for (i = 0; i < words; i++) {
+        text[i] = mem_read_32(base + 4 * i);
+        count[isa_lookup(text[i])]++;
+    }
+    for (i = 1; i < INSN_COUNT; i++)
+        valid += count[i];
+
+    printf("\nDecoding and executing %d words (%d valid), %d passes:\n", words, valid, n);
+
+    start = bench_now();
+    for (pass = 0; pass < n; pass++) {
+        for (i = 0; i < words; i++) {
+            memset(op, 0, sizeof(Pipe_Op));
+            op->reg_src1 = op->reg_src2 = op->reg_dst = -1;
+            op->pc = base + 4 * i;
+            op->instruction = text[i];
+            isa_decode(op);
+            x = x * 1103515245 + 12345;
+            op->reg_src1_value = x;
+            op->reg_src2_value = (x >> 16) | 1;
+            pipe_execute_op(op);
+            sum += op->reg_dst_value + op->mem_addr + op->branch_taken + op->lo_value;
+        }
+    }
+    elapsed = bench_now() - start;
+    printf("  %-12s %6.2f ns/inst  %7.1f Minst/s\n", "table",
+           elapsed * 1e9 / ((double)n * words), (double)n * words / elapsed / 1e6);
+
+    start = bench_now();
+    for (pass = 0; pass < n; pass++)
+        for (i = 0; i < words; i++)
+            sum += isa_disasm(base + 4 * i, text[i], line, sizeof(line));
+    printf("  %-12s %6.2f ns/inst\n", "disasm",
+           (bench_now() - start) * 1e9 / ((double)n * words));
+
+    printf("  (checksum 0x%08x)\n\n", sum);
+
+    free(text);
+    free(op);
+}
@@ -0,0 +1,32 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Host micro-benchmarks of the simulator's own hot paths, one shell
+ * command each ("membench n", "loadbench n", "opbench n", "isabench n").
+ * They time the memory accessors, the program loaders, scans over
+ * in-flight ops and table decode/execute, and leave the simulated machine
+ * as they found it: membench works on a scratch region of host memory
+ * that is mapped in for the run and unmapped afterwards, and loadbench
+ * reloads the program with its own contents.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+
+/* shell "membench n": n accesses per memory accessor */
+void bench_memory(int n);
+
+/* shell "loadbench n": n loads of the .x file 'program' (NULL if none was
+ * loaded) at 'base' per loader */
+void bench_load(const char *program, uint32_t base, int n);
+
+/* shell "opbench n": scans over n in-flight pipeline ops */
+void bench_ops(int n);
+
+/* shell "isabench n": n decode/execute passes over the 'words' words of
+ * the program at 'base' */
+void bench_isa(uint32_t base, int words, int n);
+
+#endif
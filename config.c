@@ -0,0 +1,218 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Runtime configuration table.
+ */
+
+#include "config.h"
+#include "shell.h"
+#include "pipe.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* global configuration, with the defaults used at startup */
+Sim_Config config = {
+    .core = CORE_INORDER,
+
+    .rob_size = 64,
+    .iq_size = 32,
+    .lsq_size = 32,
+    .issue_width = 4,
+    .commit_width = 4,
+    .alu_units = 2,
+
+    .alu_latency = 1,
+    .load_latency = 2,
+
+    .muldiv = MULDIV_RESTART,
+    .mul_latency = 4,
+    .mul_units = 1,
+    .mul_interval = 1,
+    .div_latency = 32,
+    .div_units = 1,
+    .div_interval = 32,
+    .div_early = 0,
+
+    .fetch_stages = 1,
+    .decode_stages = 1,
+    .execute_stages = 1,
+    .mem_stages = 1,
+    .branch_stage = BRANCH_EXECUTE,
+
+    .bypass_ex = 1,
+    .bypass_mem = 1,
+    .bypass_wb = 1,
+
+    .ftq = 0,
+    .ibuf = 4,
+
+    .store_buffer = 0,
+
+    .sample_unit = 1000,
+    .sample_warmup = 2000,
+    .sample_period = 100000,
+    .sample_error = 3,
+    .sample_confidence = 1,
+
+    .simpoint_interval = 100000,
+    .simpoint_max_k = 10,
+
+    .parallel_interval = 1000000,
+    .parallel_warmup = 20000,
+    .parallel_threads = 0,
+
+    .ff_warmup = 1000000,
+    .ff_probe = 10000,
+
+    .roi_continue = 0,
+
+    .trace_format = 0,
+
+    .mrc_max_sets = 4096,
+    .mrc_max_ways = 16,
+
+    .cores = 1,
+    .quantum = 1000,
+
+    .huge_pages = 0,
+    .mem_report = 0,
+};
+
+/* one entry per tunable parameter. 'names' optionally lists symbolic values
+ * (index = numeric value) for enumerated parameters. */
+typedef struct {
+    const char *name;
+    int *value;
+    int min, max;
+    const char *const *names;
+    const char *help;
+} Config_Param;
+
+static const char *const core_names[] = { "inorder", "ooo", NULL };
+static const char *const branch_stage_names[] = { "decode", "execute", NULL };
+static const char *const muldiv_names[] = { "restart", "units", NULL };
+static const char *const confidence_names[] = { "90", "95", "99", "99.7", NULL };
+static const char *const trace_format_names[] = { "native", "champsim", NULL };
+
+static const Config_Param params[] = {
+    { "core",         &config.core,         0, 1,   core_names, "core model (inorder, ooo)" },
+    { "rob_size",     &config.rob_size,     1, 256, NULL, "OoO reorder buffer entries" },
+    { "iq_size",      &config.iq_size,      1, 64,  NULL, "OoO issue queue entries" },
+    { "lsq_size",     &config.lsq_size,     1, 64,  NULL, "OoO load/store queue entries" },
+    { "issue_width",  &config.issue_width,  1, 8,   NULL, "OoO ops issued per cycle" },
+    { "commit_width", &config.commit_width, 1, 8,   NULL, "OoO ops retired per cycle" },
+    { "alu_units",    &config.alu_units,    1, 8,   NULL, "OoO ALU/branch units" },
+    { "alu_latency",  &config.alu_latency,  1, 64,  NULL, "OoO ALU latency (cycles)" },
+    { "muldiv",       &config.muldiv,       0, 1,   muldiv_names, "in-order multiply/divide timing (restart, units)" },
+    { "mul_latency",  &config.mul_latency,  1, 64,  NULL, "multiply latency (cycles)" },
+    { "mul_units",    &config.mul_units,    1, 8,   NULL, "multiply units" },
+    { "mul_interval", &config.mul_interval, 1, 64,  NULL, "cycles between multiplies on one unit" },
+    { "div_latency",  &config.div_latency,  1, 128, NULL, "divide latency (cycles, full-size quotient)" },
+    { "div_units",    &config.div_units,    1, 8,   NULL, "divide units" },
+    { "div_interval", &config.div_interval, 1, 128, NULL, "cycles between divides on one unit" },
+    { "div_early",    &config.div_early,    0, 1,   NULL, "divides end early for short quotients" },
+    { "load_latency", &config.load_latency, 1, 64,  NULL, "OoO load-hit latency (cycles)" },
+    { "fetch_stages", &config.fetch_stages, 1, 8,   NULL, "fetch sub-stages (set before a run)" },
+    { "decode_stages", &config.decode_stages, 1, 8, NULL, "decode sub-stages (set before a run)" },
+    { "execute_stages", &config.execute_stages, 1, 8, NULL, "execute sub-stages (set before a run)" },
+    { "mem_stages",   &config.mem_stages,   1, 8,   NULL, "memory sub-stages (set before a run)" },
+    { "branch_stage", &config.branch_stage, 0, 1,   branch_stage_names, "where in-order branches resolve (decode, execute)" },
+    { "bypass_ex",    &config.bypass_ex,    0, 1,   NULL, "forward from later execute sub-stages to execute" },
+    { "bypass_mem",   &config.bypass_mem,   0, 1,   NULL, "forward from the memory stage to execute" },
+    { "bypass_wb",    &config.bypass_wb,    0, 1,   NULL, "forward from the writeback stage to execute" },
+    { "ftq",          &config.ftq,          0, 32,  NULL, "in-order fetch target queue entries (0 = coupled fetch; set before a run)" },
+    { "ibuf",         &config.ibuf,         1, 16,  NULL, "in-order instruction buffer entries (with ftq)" },
+    { "store_buffer", &config.store_buffer, 0, 64,  NULL, "in-order store buffer entries (0 = none)" },
+    { "sample_unit",  &config.sample_unit,  10, 10000000, NULL, "sampling: measured instructions per sample" },
+    { "sample_warmup", &config.sample_warmup, 0, 10000000, NULL, "sampling: detailed warm-up instructions per sample" },
+    { "sample_period", &config.sample_period, 10, 2000000000, NULL, "sampling: instructions between samples (first round)" },
+    { "sample_error", &config.sample_error, 1, 100, NULL, "sampling: target CPI error (percent)" },
+    { "sample_confidence", &config.sample_confidence, 0, 3, confidence_names, "sampling: confidence level (percent)" },
+    { "simpoint_interval", &config.simpoint_interval, 100, 2000000000, NULL, "simpoint: instructions per interval" },
+    { "simpoint_max_k", &config.simpoint_max_k, 1, 64, NULL, "simpoint: most phases (clusters) tried" },
+    { "parallel_interval", &config.parallel_interval, 1000, 2000000000, NULL, "parallel: instructions per interval" },
+    { "parallel_warmup", &config.parallel_warmup, 0, 100000000, NULL, "parallel: detailed warm-up before each interval" },
+    { "parallel_threads", &config.parallel_threads, 0, 256, NULL, "parallel: host threads (0 = one per host CPU)" },
+    { "ff_warmup",    &config.ff_warmup,    0, 2000000000, NULL, "fast-forward: last instructions warming caches and predictor" },
+    { "ff_probe",     &config.ff_probe,     0, 10000000, NULL, "fast-forward: instructions timed for the cold-start report (0 = none)" },
+    { "roi_continue", &config.roi_continue, 0, 1,   NULL, "after a region of interest, go on to the next one" },
+    { "trace_format", &config.trace_format, 0, 1,   trace_format_names, "trace file format (native, champsim)" },
+    { "mrc_max_sets", &config.mrc_max_sets, 1, 65536, NULL, "miss-ratio curves: most sets (rounded down to a power of two)" },
+    { "mrc_max_ways", &config.mrc_max_ways, 1, 64,  NULL, "miss-ratio curves: most ways" },
+    { "cores",        &config.cores,        1, 16,  NULL, "simulated cores (fixed at first run)" },
+    { "quantum",      &config.quantum,      1, 10000000, NULL, "multicore sync quantum (cycles)" },
+    { "huge_pages",   &config.huge_pages,   0, 1,   NULL, "map new memory with huge pages" },
+    { "mem_report",   &config.mem_report,   0, 1,   NULL, "print page usage at exit" },
+};
+
+#define CONFIG_NPARAMS (sizeof(params)/sizeof(params[0]))
+
+/* parameters that shape the pipeline's storage: changing them with ops in
+ * flight would lose the ops held in the removed slots, so they are fixed
+ * from the first cycle until a reset */
+static int config_shapes_pipeline(const int *value)
+{
+    return value == &config.fetch_stages || value == &config.decode_stages ||
+           value == &config.execute_stages || value == &config.mem_stages ||
+           value == &config.ftq;
+}
+
+int config_set(const char *name, const char *value)
+{
+    for (int i = 0; i < CONFIG_NPARAMS; i++) {
+        const Config_Param *p = &params[i];
+        if (strcmp(p->name, name) != 0)
+            continue;
+
+        long v = -1;
+        if (p->names) {
+            for (int k = 0; p->names[k]; k++)
+                if (strcmp(p->names[k], value) == 0)
+                    v = k;
+        }
+        if (v == -1) {
+            char *end;
+            v = strtol(value, &end, 0);
+            if (*value == '\0' || *end != '\0') {
+                printf("Invalid value '%s' for %s\n", value, name);
+                return -1;
+            }
+        }
+        if (v < p->min || v > p->max) {
+            printf("Value for %s must be in [%d, %d]\n", name, p->min, p->max);
+            return -1;
+        }
+        if (stat_cycles && v != *p->value && config_shapes_pipeline(p->value)) {
+            printf("%s can only be changed before a run (reset first)\n", name);
+            return -1;
+        }
+        if (p->value == &config.core && v != *p->value) {
+            /* only this thread's core could be drained */
+            if (stat_cycles && config.cores > 1) {
+                printf("%s can only be changed before a multicore run (reset first)\n", name);
+                return -1;
+            }
+            pipe_switch_core((int)v);
+            return 0;
+        }
+
+        *p->value = (int)v;
+        return 0;
+    }
+
+    printf("Unknown parameter '%s'\n", name);
+    return -1;
+}
+
+void config_dump()
+{
+    for (int i = 0; i < CONFIG_NPARAMS; i++) {
+        const Config_Param *p = &params[i];
+        if (p->names)
+            printf("%-14s %-10s %s\n", p->name, p->names[*p->value], p->help);
+        else
+            printf("%-14s %-10d %s\n", p->name, *p->value, p->help);
+    }
+    printf("\n");
+}
@@ -0,0 +1,138 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Runtime configuration: tunable model parameters that can be changed from
+ * the shell ("set <name> <value>") before a run.
+ */
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+/* core models selectable with "set core <name>" */
+#define CORE_INORDER 0
+#define CORE_OOO     1
+
+/* where the in-order core resolves branches ("set branch_stage <name>") */
+#define BRANCH_DECODE  0
+#define BRANCH_EXECUTE 1
+
+/* in-order multiply/divide timing ("set muldiv <name>"): every multiply or
+ * divide restarts the HI/LO latency (the reference timing), or they go to
+ * a set of pipelined units and complete in order */
+#define MULDIV_RESTART 0
+#define MULDIV_UNITS   1
+
+typedef struct Sim_Config {
+    /* which core model pipe_cycle() simulates */
+    int core;
+
+    /* out-of-order core sizing */
+    int rob_size;     /* reorder buffer entries */
+    int iq_size;      /* issue queue entries */
+    int lsq_size;     /* load/store queue entries */
+    int issue_width;  /* ops issued per cycle */
+    int commit_width; /* ops retired per cycle */
+    int alu_units;    /* ALU/branch units */
+
+    /* out-of-order functional-unit latencies (cycles) */
+    int alu_latency;
+    int load_latency; /* address generation + data cache hit */
+
+    /* multiply/divide units (both cores; the in-order core only with
+     * muldiv = MULDIV_UNITS) */
+    int muldiv;       /* MULDIV_RESTART or MULDIV_UNITS (in-order core) */
+    int mul_latency;  /* cycles until HI/LO hold the product */
+    int mul_units;
+    int mul_interval; /* cycles before a unit takes the next multiply */
+    int div_latency;  /* ... the quotient, for 32 quotient bits */
+    int div_units;
+    int div_interval;
+    int div_early;    /* divide latency scales with the quotient's size */
+
+    /* pipeline shape: sub-stages per stage, and where branches resolve */
+    int fetch_stages;
+    int decode_stages;
+    int execute_stages;
+    int mem_stages;
+    int branch_stage; /* BRANCH_DECODE or BRANCH_EXECUTE (in-order core) */
+
+    /* in-order forwarding network: paths into the execute stage */
+    int bypass_ex;    /* from the op in a later execute sub-stage */
+    int bypass_mem;   /* from the op in the memory stage */
+    int bypass_wb;    /* from the op in the writeback stage */
+
+    /* in-order decoupled front end: fetch target queue entries (0: fetch
+     * predicts and reads the instruction cache in lockstep) and instruction
+     * buffer entries between fetch and decode */
+    int ftq;
+    int ibuf;
+
+    /* in-order store buffer entries (0: stores write memory in the memory
+     * stage) */
+    int store_buffer;
+
+    /* statistical sampling ("sample"): every sample_period instructions,
+     * sample_warmup instructions of detailed warm-up and a measured unit of
+     * sample_unit instructions; the rest runs functionally, keeping the
+     * caches and branch predictor warm. Samples are added until the
+     * confidence interval of the CPI is within sample_error percent. */
+    int sample_unit;
+    int sample_warmup;
+    int sample_period;
+    int sample_error;
+    int sample_confidence; /* index into 90, 95, 99, 99.7 percent */
+
+    /* SimPoint ("simpoint"): basic-block vectors of simpoint_interval
+     * instructions are clustered into at most simpoint_max_k phases, and
+     * one interval per phase is simulated in detail (after sample_warmup
+     * instructions of warm-up) */
+    int simpoint_interval;
+    int simpoint_max_k;
+
+    /* time-parallel simulation ("parallel"): a functional pass checkpoints
+     * the program every parallel_interval instructions; the intervals are
+     * then simulated in detail on parallel_threads host threads (0: one per
+     * host CPU), each starting parallel_warmup instructions early */
+    int parallel_interval;
+    int parallel_warmup;
+    int parallel_threads;
+
+    /* fast-forward ("fastforward n"): only the last ff_warmup of the
+     * skipped instructions update the caches and predictor; then the
+     * cold-start error left is measured over ff_probe instructions (0: not
+     * measured) */
+    int ff_warmup;
+    int ff_probe;
+
+    /* regions of interest ("roi"): after a region's statistics are printed,
+     * stop (0) or fast-forward on to the next region (1) */
+    int roi_continue;
+
+    /* execution traces ("trace file"): TRACE_NATIVE or TRACE_CHAMPSIM
+     * (trace.h) */
+    int trace_format;
+
+    /* miss-ratio curves ("mrc"): set counts 1, 2, 4 .. mrc_max_sets and
+     * 1 .. mrc_max_ways ways */
+    int mrc_max_sets;
+    int mrc_max_ways;
+
+    /* multicore */
+    int cores;        /* number of simulated cores */
+    int quantum;      /* cycles each core runs between synchronizations */
+
+    /* memory */
+    int huge_pages;   /* back simulated pages with huge host pages */
+    int mem_report;   /* print page usage at exit */
+} Sim_Config;
+
+/* global variable -- current configuration */
+extern Sim_Config config;
+
+/* set parameter 'name' from the string 'value'; returns 0 on success */
+int config_set(const char *name, const char *value);
+
+/* print every parameter and its current value */
+void config_dump();
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Event queue (hashed timing wheel). See event.h.
+ */
+
+#include "event.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Event {
+    uint64_t cycle;
+    Event_Handler handler;
+    uint32_t arg;
+    struct Event *next;
+} Event;
+
+#define EVENT_SLOT(c) ((c) & (EVENT_WHEEL_SIZE - 1))
+
+/* per-core wheel: a FIFO list per slot, plus a bitmap of non-empty slots */
+static _Thread_local Event *wheel_head[EVENT_WHEEL_SIZE], *wheel_tail[EVENT_WHEEL_SIZE];
+static _Thread_local uint64_t wheel_busy[EVENT_WHEEL_SIZE / 64];
+static _Thread_local int pending;
+
+/* events are recycled through a free list, allocated in blocks */
+#define EVENT_BLOCK 256
+static _Thread_local Event *free_events;
+
+static Event *event_alloc()
+{
+    if (!free_events) {
+        Event *block = malloc(EVENT_BLOCK * sizeof(Event));
+        if (!block) {
+            printf("Error: out of memory for events\n");
+            exit(-1);
+        }
+        for (int i = 0; i < EVENT_BLOCK; i++) {
+            block[i].next = free_events;
+            free_events = &block[i];
+        }
+    }
+    Event *e = free_events;
+    free_events = e->next;
+    return e;
+}
+
+static void event_free(Event *e)
+{
+    e->next = free_events;
+    free_events = e;
+}
+
+void event_init()
+{
+    for (int s = 0; pending > 0 && s < EVENT_WHEEL_SIZE; s++) {
+        while (wheel_head[s]) {
+            Event *e = wheel_head[s];
+            wheel_head[s] = e->next;
+            event_free(e);
+            pending--;
+        }
+        wheel_tail[s] = NULL;
+    }
+    memset(wheel_busy, 0, sizeof(wheel_busy));
+    pending = 0;
+}
+
+void event_schedule(uint64_t cycle, Event_Handler handler, uint32_t arg)
+{
+    Event *e = event_alloc();
+    e->cycle = cycle;
+    e->handler = handler;
+    e->arg = arg;
+    e->next = NULL;
+
+    int s = EVENT_SLOT(cycle);
+    if (wheel_tail[s])
+        wheel_tail[s]->next = e;
+    else
+        wheel_head[s] = e;
+    wheel_tail[s] = e;
+    wheel_busy[s / 64] |= 1ull << (s % 64);
+    pending++;
+}
+
+int event_run(uint64_t cycle)
+{
+    int s = EVENT_SLOT(cycle), fired = 0;
+
+    /* handlers may schedule more events for this cycle: repeat until the
+     * slot holds none that are due */
+    while (wheel_busy[s / 64] & (1ull << (s % 64))) {
+        Event *due = NULL, **due_tail = &due;
+        Event **link = &wheel_head[s];
+        Event *last = NULL;
+
+        /* unlink the due events, keeping the order of both lists */
+        while (*link) {
+            Event *e = *link;
+            if (e->cycle == cycle) {
+                *link = e->next;
+                e->next = NULL;
+                *due_tail = e;
+                due_tail = &e->next;
+            }
+            else {
+                last = e;
+                link = &e->next;
+            }
+        }
+        wheel_tail[s] = last;
+        if (!wheel_head[s])
+            wheel_busy[s / 64] &= ~(1ull << (s % 64));
+
+        if (!due)
+            break;
+        while (due) {
+            Event *e = due;
+            due = e->next;
+            pending--;
+            e->handler(e->arg);
+            event_free(e);
+            fired++;
+        }
+    }
+    return fired;
+}
+
+uint64_t event_next(uint64_t cycle)
+{
+    uint64_t best = EVENT_NONE;
+
+    if (pending == 0)
+        return best;
+
+    /* visit the non-empty slots in wheel order starting after 'cycle'; an
+     * event found in this turn of the wheel is the earliest */
+    for (int d = 1; d <= EVENT_WHEEL_SIZE; ) {
+        int s = EVENT_SLOT(cycle + d);
+        uint64_t bits = wheel_busy[s / 64] >> (s % 64);
+        if (!bits) {
+            d += 64 - s % 64;
+            continue;
+        }
+        d += __builtin_ctzll(bits);
+        if (d > EVENT_WHEEL_SIZE)
+            break;
+
+        for (Event *e = wheel_head[EVENT_SLOT(cycle + d)]; e; e = e->next) {
+            if (e->cycle == cycle + d)
+                return e->cycle;
+            if (e->cycle > cycle && e->cycle < best)
+                best = e->cycle;
+        }
+        d++;
+    }
+    return best;
+}
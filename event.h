@@ -0,0 +1,44 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Event queue for long-latency activity (cache fills, multiply/divide
+ * completion, branch recovery). Instead of counting a stall down every
+ * cycle, a component schedules an event for the cycle in which the activity
+ * completes; the pipeline fires the events due at the end of each cycle, and
+ * cycles in which nothing can happen before the next event need not be
+ * simulated at all.
+ *
+ * The queue is a hashed timing wheel: an event for cycle c is kept in slot
+ * c mod EVENT_WHEEL_SIZE, in scheduling order, so scheduling and firing are
+ * O(1); delays longer than the wheel just stay in their slot for another
+ * turn. Events due in the same cycle fire in the order they were scheduled.
+ * There is one queue per simulated core (thread-local).
+ *
+ * Events can't be cancelled; handlers carry a generation number in 'arg'
+ * and ignore events that a newer request or a flush has made stale.
+ */
+
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include <stdint.h>
+
+#define EVENT_WHEEL_SIZE 1024 /* power of two */
+#define EVENT_NONE       UINT64_MAX
+
+typedef void (*Event_Handler)(uint32_t arg);
+
+/* drop every pending event */
+void event_init();
+
+/* call 'handler(arg)' at the end of cycle 'cycle' (which must not have
+ * ended yet) */
+void event_schedule(uint64_t cycle, Event_Handler handler, uint32_t arg);
+
+/* fire the events due at the end of 'cycle'; returns how many fired */
+int event_run(uint64_t cycle);
+
+/* the earliest cycle after 'cycle' with a pending event, or EVENT_NONE */
+uint64_t event_next(uint64_t cycle);
+
+#endif
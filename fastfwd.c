@@ -0,0 +1,227 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Fast-forward with functional warming. See fastfwd.h.
+ */
+
+#include "fastfwd.h"
+#include "pipe.h"
+#include "shell.h"
+#include "config.h"
+#include "multicore.h"
+#include "mips.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/* architectural state, put back after each pass or probe */
+typedef struct Ff_Arch {
+    uint32_t regs[32], hi, lo, pc;
+    int run_bit;
+    uint32_t cycles, retired, fetched, squashed;
+} Ff_Arch;
+
+static void ff_save(Ff_Arch *a)
+{
+    memcpy(a->regs, pipe.REGS, sizeof(a->regs));
+    a->hi = pipe.HI;
+    a->lo = pipe.LO;
+    a->pc = pipe.PC;
+    a->run_bit = RUN_BIT;
+    a->cycles = stat_cycles;
+    a->retired = stat_inst_retire;
+    a->fetched = stat_inst_fetch;
+    a->squashed = stat_squash;
+}
+
+static void ff_restore(const Ff_Arch *a)
+{
+    memcpy(pipe.REGS, a->regs, sizeof(pipe.REGS));
+    pipe.HI = a->hi;
+    pipe.LO = a->lo;
+    pipe.PC = a->pc;
+    RUN_BIT = a->run_bit;
+    stat_cycles = a->cycles;
+    stat_inst_retire = a->retired;
+    stat_inst_fetch = a->fetched;
+    stat_squash = a->squashed;
+}
+
+/* execute n instructions, the last 'warm' of them warming; returns how many
+ * ran before the program ended */
+static uint32_t ff_steps(uint32_t n, uint32_t warm)
+{
+    uint32_t i;
+
+    for (i = 0; i < n && RUN_BIT; i++)
+        pipe_step(n - i <= warm);
+    return i;
+}
+
+/* cycles the timing model takes for the next n instructions, starting from
+ * the warmed state 'from' (NULL: cold), with stores going to 'log'. The
+ * architectural state is put back; the microarchitectural one is left to
+ * the caller. */
+static uint32_t ff_probe(uint32_t n, const Pipe_Warm *from, Store_Log *log)
+{
+    Ff_Arch a;
+    int traced = trace_on;
+
+    ff_save(&a);
+    if (from)
+        pipe_warm_restore(from);
+    else
+        pipe_reset();
+    ff_restore(&a);
+
+    /* the probe is undone: it is not traced either */
+    trace_on = 0;
+    core_store_log = log;
+    while (RUN_BIT && stat_inst_retire - a.retired < n)
+        cycle(INT_MAX);
+    core_store_log = NULL;
+    trace_on = traced;
+
+    uint32_t cycles = stat_cycles - a.cycles;
+    ff_restore(&a);
+    return cycles;
+}
+
+static void ff_report_line(const char *name, uint32_t cycles, uint32_t full)
+{
+    printf("  %-30s %10u cycles", name, cycles);
+    if (full)
+        printf("  %+.2f%%", 100.0 * ((double)cycles - full) / full);
+    printf("\n");
+}
+
+void fastforward(uint32_t n)
+{
+    uint32_t probe = config.ff_probe, warm = config.ff_warmup;
+    uint32_t full = 0, done;
+    Store_Log log;
+    Ff_Arch start;
+
+    if (config.cores > 1) {
+        printf("Fast-forward simulates a single core\n\n");
+        return;
+    }
+    if (RUN_BIT == FALSE) {
+        printf("Can't simulate, Simulator is halted\n\n");
+        return;
+    }
+
+    /* finish the instructions in flight first */
+    while (RUN_BIT && !pipe_drain())
+        cycle(INT_MAX);
+    pipe_resume();
+    if (probe)
+        store_log_init(&log, 1024);
+
+    /* reference: every skipped instruction warms, memory untouched */
+    if (probe && warm < n) {
+        Pipe_Warm *before = pipe_warm_save();
+        int traced = trace_on;
+        ff_save(&start);
+        trace_on = 0;
+        core_store_log = &log;
+        ff_steps(n, n);
+        core_store_log = NULL;
+        trace_on = traced;
+        Pipe_Warm *warmed = pipe_warm_save();
+        full = ff_probe(probe, warmed, &log);
+        free(warmed);
+        pipe_warm_restore(before);
+        free(before);
+        ff_restore(&start);
+        store_log_clear(&log);
+    }
+
+    printf("Fast-forwarding %u instructions (the last %u warming)...\n\n",
+           n, warm < n ? warm : n);
+    done = ff_steps(n, warm);
+    if (!RUN_BIT) {
+        printf("Simulator halted after %u instructions\n\n", done);
+        if (probe)
+            free(log.table);
+        return;
+    }
+
+    if (probe) {
+        Pipe_Warm *warmed = pipe_warm_save();
+        Ff_Arch at;
+        ff_save(&at);
+        uint32_t as_warmed = ff_probe(probe, warmed, &log);
+        store_log_clear(&log);
+        uint32_t cold = ff_probe(probe, NULL, &log);
+        pipe_warm_restore(warmed);
+        ff_restore(&at);
+        free(warmed);
+        free(log.table);
+        if (warm >= n)
+            full = as_warmed;
+
+        printf("Cold-start error at the switch point, over the next %u instructions:\n", probe);
+        ff_report_line("warmed over all instructions", full, 0);
+        ff_report_line("warmed over the last ff_warmup", as_warmed, full);
+        ff_report_line("not warmed", cold, full);
+        printf("\n");
+    }
+}
+
+void roi_go()
+{
+    int warm = config.ff_warmup > 0;
+
+    if (config.cores > 1) {
+        printf("Regions of interest are simulated on a single core\n\n");
+        return;
+    }
+    if (RUN_BIT == FALSE) {
+        printf("Can't simulate, Simulator is halted\n\n");
+        return;
+    }
+
+    while (RUN_BIT && !pipe_drain())
+        cycle(INT_MAX);
+    pipe_resume();
+
+    for (int region = 1; ; region++) {
+        uint64_t skipped = 0;
+
+        pipe.roi_marker = 0;
+        while (RUN_BIT && pipe.roi_marker != SYSCALL_ROI_BEGIN) {
+            pipe_step(warm);
+            skipped++;
+        }
+        if (!RUN_BIT) {
+            printf("Simulator halted: no region of interest in the last %llu instructions\n\n",
+                   (unsigned long long)skipped);
+            return;
+        }
+
+        printf("Region of interest %d, after %llu instructions fast-forwarded...\n\n",
+               region, (unsigned long long)skipped);
+        stat_cycles = stat_inst_retire = stat_inst_fetch = stat_squash = 0;
+        memset(&pipe_stats, 0, sizeof(pipe_stats));
+        pipe_resume();
+        pipe.roi_marker = 0;
+        while (RUN_BIT && pipe.roi_marker != SYSCALL_ROI_END)
+            cycle(INT_MAX);
+
+        if (!RUN_BIT)
+            printf("Simulator halted in region of interest %d\n", region);
+        else
+            printf("End of region of interest %d\n", region);
+        stats_dump();
+        printf("\n");
+        if (!RUN_BIT || !config.roi_continue)
+            return;
+
+        while (RUN_BIT && !pipe_drain())
+            cycle(INT_MAX);
+        pipe_resume();
+    }
+}
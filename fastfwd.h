@@ -0,0 +1,37 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Fast-forward: execute instructions functionally (pipe_step), without
+ * timing, to reach a region of interest quickly. Skipping the timing model
+ * also skips its caches and branch predictor, which would then start the
+ * region cold; so the last ff_warmup instructions before the switch point
+ * update them (cache tags and replacement state, pattern table, GHR and
+ * BTB) as the timing model would, at a fraction of its cost.
+ *
+ * How much cold-start error is left is measured at the switch point: the
+ * next ff_probe instructions are timed three times - with the state as
+ * warmed, with everything cold, and with a state warmed over the whole
+ * fast-forward (from a second functional pass whose stores go to a store
+ * log). None of this changes the machine: the probes' stores go to a store
+ * log as well, and the state is put back after each.
+ *
+ * Regions of interest: a program marks the region to measure with the
+ * syscalls SYSCALL_ROI_BEGIN and SYSCALL_ROI_END (mips.h; otherwise no-ops).
+ * "roi" fast-forwards to the next begin marker (warming all the way, unless
+ * ff_warmup is 0), clears the statistics and simulates in detail up to the
+ * end marker, where it prints them. It then stops there, or with
+ * roi_continue drains the pipeline and fast-forwards to the next region.
+ */
+
+#ifndef _FASTFWD_H_
+#define _FASTFWD_H_
+
+#include <stdint.h>
+
+/* shell "fastforward n": skip n instructions */
+void fastforward(uint32_t n);
+
+/* shell "roi": simulate the next region(s) of interest */
+void roi_go();
+
+#endif
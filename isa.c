@@ -0,0 +1,353 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Instruction set tables, decode, execute and disassembly. See isa.h.
+ */
+
+#include "isa.h"
+#include "pipe.h"
+#include <stdio.h>
+
+/* execute functions: compute an op's results from its source values, as
+ * pipe_execute_op (below) describes */
+
+static inline void exec_none(Pipe_Op *op)
+{
+    (void)op;
+}
+
+static inline void exec_special(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+}
+
+static inline void exec_sll(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src2_value << op->shamt;
+}
+
+static inline void exec_srl(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src2_value >> op->shamt;
+}
+
+static inline void exec_sra(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = (int32_t)op->reg_src2_value >> op->shamt;
+}
+
+static inline void exec_sllv(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src2_value << op->reg_src1_value;
+}
+
+static inline void exec_srlv(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src2_value >> op->reg_src1_value;
+}
+
+static inline void exec_srav(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = (int32_t)op->reg_src2_value >> op->reg_src1_value;
+}
+
+static inline void exec_jr(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->pc + 4;
+    op->branch_dest = op->reg_src1_value;
+    op->branch_taken = 1;
+}
+
+static inline void exec_mfhi(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->hi_value;
+}
+
+static inline void exec_mthi(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->hi_value = op->reg_src1_value;
+}
+
+static inline void exec_mflo(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->lo_value;
+}
+
+static inline void exec_mtlo(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->lo_value = op->reg_src1_value;
+}
+
+static inline void exec_mult(Pipe_Op *op)
+{
+    int64_t val = (int64_t)((int32_t)op->reg_src1_value) * (int64_t)((int32_t)op->reg_src2_value);
+    uint64_t uval = (uint64_t)val;
+    op->reg_dst_value_ready = 1;
+    op->hi_value = (uval >> 32) & 0xFFFFFFFF;
+    op->lo_value = (uval >>  0) & 0xFFFFFFFF;
+}
+
+static inline void exec_multu(Pipe_Op *op)
+{
+    uint64_t val = (uint64_t)op->reg_src1_value * (uint64_t)op->reg_src2_value;
+    op->reg_dst_value_ready = 1;
+    op->hi_value = (val >> 32) & 0xFFFFFFFF;
+    op->lo_value = (val >>  0) & 0xFFFFFFFF;
+}
+
+static inline void exec_div(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    if (op->reg_src2_value != 0) {
+        int32_t val1 = (int32_t)op->reg_src1_value;
+        int32_t val2 = (int32_t)op->reg_src2_value;
+        op->lo_value = val1 / val2;
+        op->hi_value = val1 % val2;
+    } else {
+        /* really this would be a div-by-0 exception */
+        op->hi_value = op->lo_value = 0;
+    }
+}
+
+static inline void exec_divu(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    if (op->reg_src2_value != 0) {
+        op->hi_value = op->reg_src1_value % op->reg_src2_value;
+        op->lo_value = op->reg_src1_value / op->reg_src2_value;
+    } else {
+        /* really this would be a div-by-0 exception */
+        op->hi_value = op->lo_value = 0;
+    }
+}
+
+static inline void exec_addu(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value + op->reg_src2_value;
+}
+
+static inline void exec_subu(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value - op->reg_src2_value;
+}
+
+static inline void exec_and(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value & op->reg_src2_value;
+}
+
+static inline void exec_or(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value | op->reg_src2_value;
+}
+
+static inline void exec_xor(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value ^ op->reg_src2_value;
+}
+
+static inline void exec_nor(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = ~(op->reg_src1_value | op->reg_src2_value);
+}
+
+static inline void exec_slt(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = (int32_t)op->reg_src1_value < (int32_t)op->reg_src2_value ? 1 : 0;
+}
+
+static inline void exec_sltu(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value < op->reg_src2_value ? 1 : 0;
+}
+
+static inline void exec_bltz(Pipe_Op *op)
+{
+    if ((int32_t)op->reg_src1_value < 0) op->branch_taken = 1;
+}
+
+static inline void exec_bgez(Pipe_Op *op)
+{
+    if ((int32_t)op->reg_src1_value >= 0) op->branch_taken = 1;
+}
+
+static inline void exec_beq(Pipe_Op *op)
+{
+    if (op->reg_src1_value == op->reg_src2_value) op->branch_taken = 1;
+}
+
+static inline void exec_bne(Pipe_Op *op)
+{
+    if (op->reg_src1_value != op->reg_src2_value) op->branch_taken = 1;
+}
+
+static inline void exec_blez(Pipe_Op *op)
+{
+    if ((int32_t)op->reg_src1_value <= 0) op->branch_taken = 1;
+}
+
+static inline void exec_bgtz(Pipe_Op *op)
+{
+    if ((int32_t)op->reg_src1_value > 0) op->branch_taken = 1;
+}
+
+static inline void exec_addiu(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value + op->se_imm16;
+}
+
+static inline void exec_slti(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = (int32_t)op->reg_src1_value < (int32_t)op->se_imm16 ? 1 : 0;
+}
+
+static inline void exec_sltiu(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value < op->se_imm16 ? 1 : 0;
+}
+
+static inline void exec_andi(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value & op->imm16;
+}
+
+static inline void exec_ori(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value | op->imm16;
+}
+
+static inline void exec_xori(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = op->reg_src1_value ^ op->imm16;
+}
+
+static inline void exec_lui(Pipe_Op *op)
+{
+    op->reg_dst_value_ready = 1;
+    op->reg_dst_value = (uint32_t)op->imm16 << 16;
+}
+
+static inline void exec_load(Pipe_Op *op)
+{
+    op->mem_addr = op->reg_src1_value + op->se_imm16;
+}
+
+static inline void exec_store(Pipe_Op *op)
+{
+    op->mem_addr = op->reg_src1_value + op->se_imm16;
+    op->mem_value = op->reg_src2_value;
+}
+
+#define ISA_DECODE(name, opcode, sub, ...) [ISA_INDEX(opcode, sub)] = INSN_##name,
+const uint8_t isa_decode_table[ISA_DECODE_SIZE] = { ISA_TABLE(ISA_DECODE) };
+#undef ISA_DECODE
+
+#define ISA_OPERAND(r) { ISA_REG_SHIFT(r), ISA_REG_MASK(r), ISA_REG_FIXED(r) }
+#define ISA_INFO(name, opcode, sub, src1, src2, dst, flags, format, execute) \
+    [INSN_##name] = { #name, ISA_OPERAND(src1), ISA_OPERAND(src2), ISA_OPERAND(dst), flags, format },
+const Isa_Info isa_info[INSN_COUNT] = {
+    /* encodings outside the table decode to an op that does nothing */
+    [INSN_INVALID] = { "invalid", ISA_OPERAND(REG_NONE), ISA_OPERAND(REG_NONE), ISA_OPERAND(REG_NONE),
+                       0, FMT_NONE },
+    ISA_TABLE(ISA_INFO)
+};
+#undef ISA_INFO
+
+/* compute the results of an op from its source values: destination value,
+ * branch outcome, memory address/store data, and HI/LO. HI/LO are read from
+ * and written to op->hi_value/op->lo_value so that each core model can decide
+ * where they live. Timing is left entirely to the caller. */
+void pipe_execute_op(Pipe_Op *op)
+{
+#define ISA_EXECUTE(name, opcode, sub, src1, src2, dst, flags, format, execute) \
+    case INSN_##name: exec_##execute(op); break;
+    switch (op->insn) {
+        ISA_TABLE(ISA_EXECUTE)
+        default: break;
+    }
+#undef ISA_EXECUTE
+}
+
+int isa_disasm(uint32_t pc, uint32_t instruction, char *buf, int size)
+{
+    int insn = isa_lookup(instruction);
+    const Isa_Info *info = &isa_info[insn];
+    uint32_t rs = (instruction >> 21) & 0x1F;
+    uint32_t rt = (instruction >> 16) & 0x1F;
+    uint32_t rd = (instruction >> 11) & 0x1F;
+    uint32_t shamt = (instruction >> 6) & 0x1F;
+    uint32_t imm16 = instruction & 0xFFFF;
+    int32_t simm = (int16_t)imm16;
+    uint32_t pcrel = pc + 4 + ((uint32_t)simm << 2);
+    uint32_t target = (pc & 0xF0000000) | ((instruction & ((1UL << 26) - 1)) << 2);
+    char name[8];
+
+    if (insn == INSN_INVALID)
+        return snprintf(buf, size, ".word   0x%08x", instruction);
+
+    /* lower-case mnemonic, padded */
+    int n = 0;
+    for (; info->name[n] && n < (int)sizeof(name) - 1; n++)
+        name[n] = info->name[n] - 'A' + 'a';
+    name[n] = '\0';
+
+    switch (info->format) {
+        case FMT_RD_RS_RT:
+            return snprintf(buf, size, "%-7s $%u, $%u, $%u", name, rd, rs, rt);
+        case FMT_RD_RT_SA:
+            if (instruction == 0)
+                return snprintf(buf, size, "nop");
+            return snprintf(buf, size, "%-7s $%u, $%u, %u", name, rd, rt, shamt);
+        case FMT_RD_RT_RS:
+            return snprintf(buf, size, "%-7s $%u, $%u, $%u", name, rd, rt, rs);
+        case FMT_RS:
+            return snprintf(buf, size, "%-7s $%u", name, rs);
+        case FMT_RD_RS:
+            return snprintf(buf, size, "%-7s $%u, $%u", name, rd, rs);
+        case FMT_RD:
+            return snprintf(buf, size, "%-7s $%u", name, rd);
+        case FMT_RS_RT:
+            return snprintf(buf, size, "%-7s $%u, $%u", name, rs, rt);
+        case FMT_RS_OFF:
+            return snprintf(buf, size, "%-7s $%u, 0x%08x", name, rs, pcrel);
+        case FMT_RS_RT_OFF:
+            return snprintf(buf, size, "%-7s $%u, $%u, 0x%08x", name, rs, rt, pcrel);
+        case FMT_TARGET:
+            return snprintf(buf, size, "%-7s 0x%08x", name, target);
+        case FMT_RT_RS_IMM:
+            return snprintf(buf, size, "%-7s $%u, $%u, %d", name, rt, rs, simm);
+        case FMT_RT_RS_UIMM:
+            return snprintf(buf, size, "%-7s $%u, $%u, 0x%x", name, rt, rs, imm16);
+        case FMT_RT_UIMM:
+            return snprintf(buf, size, "%-7s $%u, 0x%x", name, rt, imm16);
+        case FMT_RT_MEM:
+            return snprintf(buf, size, "%-7s $%u, %d($%u)", name, rt, simm, rs);
+        default:
+            return snprintf(buf, size, "%s", name);
+    }
+}
@@ -0,0 +1,223 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Instruction set description. ISA_TABLE lists every instruction once: its
+ * encoding, the instruction fields that name its source and destination
+ * registers, its control-flow and memory flags, its assembler syntax and
+ * the function that computes its results. Everything else is generated from
+ * it: a direct-indexed decode table from encoding to instruction, the
+ * per-instruction info table that decode fills ops from, the execute
+ * dispatch (a dense switch on the instruction number, which compiles to a
+ * jump table with the execute functions inlined) and the disassembler.
+ * Adding an instruction takes one line here and its execute function in
+ * isa.c.
+ */
+
+#ifndef _ISA_H_
+#define _ISA_H_
+
+#include "mips.h"
+#include "pipe.h"
+#include <stdint.h>
+
+/* register operands: the instruction field that names the register */
+#define REG_NONE 0
+#define REG_RS   1
+#define REG_RT   2
+#define REG_RD   3
+#define REG_RA   4 /* $31 (the link register) */
+#define REG_V0   5 /* $2 (syscall number) */
+#define REG_V1   6 /* $3 */
+
+/* control-flow and memory flags */
+#define ISA_BRANCH 0x01 /* changes control flow (is_branch) */
+#define ISA_COND   0x02 /* conditional branch */
+#define ISA_PCREL  0x04 /* target pc + 4 + (offset << 2), known in decode */
+#define ISA_JUMP   0x08 /* target in the 256 MB region of pc, always taken */
+#define ISA_LINK   0x10 /* destination gets pc + 4 in decode */
+#define ISA_LOAD   0x20
+#define ISA_STORE  0x40
+
+/* assembler syntax, for the disassembler */
+#define FMT_NONE       0  /* syscall */
+#define FMT_RD_RS_RT   1
+#define FMT_RD_RT_SA   2  /* shift by shamt */
+#define FMT_RD_RT_RS   3  /* shift by register */
+#define FMT_RS         4  /* jr, mthi, mtlo */
+#define FMT_RD_RS      5  /* jalr */
+#define FMT_RD         6  /* mfhi, mflo */
+#define FMT_RS_RT      7  /* mult, div */
+#define FMT_RS_OFF     8  /* branch on one register */
+#define FMT_RS_RT_OFF  9  /* branch on two registers */
+#define FMT_TARGET     10 /* j, jal */
+#define FMT_RT_RS_IMM  11 /* sign-extended immediate */
+#define FMT_RT_RS_UIMM 12 /* zero-extended immediate */
+#define FMT_RT_UIMM    13 /* lui */
+#define FMT_RT_MEM     14 /* rt, offset(rs) */
+
+/* X(name, opcode, sub, src1, src2, dst, flags, format, execute):
+ * 'sub' is the function field of SPECIAL instructions and the rt field of
+ * REGIMM (OP_BRSPEC) ones, 0 otherwise; 'execute' names exec_<execute> in
+ * isa.c, and is dispatched by pipe_execute_op. The register operands are those the pipeline has always tracked
+ * (all three fields for SPECIAL, rs and rt for every branch). */
+#define ISA_TABLE(X) \
+    X(SLL,     OP_SPECIAL, SUBOP_SLL,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RT_SA, sll) \
+    X(SRL,     OP_SPECIAL, SUBOP_SRL,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RT_SA, srl) \
+    X(SRA,     OP_SPECIAL, SUBOP_SRA,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RT_SA, sra) \
+    X(SLLV,    OP_SPECIAL, SUBOP_SLLV,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RT_RS, sllv) \
+    X(SRLV,    OP_SPECIAL, SUBOP_SRLV,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RT_RS, srlv) \
+    X(SRAV,    OP_SPECIAL, SUBOP_SRAV,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RT_RS, srav) \
+    X(JR,      OP_SPECIAL, SUBOP_JR,      REG_RS,   REG_RT,   REG_RD,   ISA_BRANCH, FMT_RS, jr) \
+    X(JALR,    OP_SPECIAL, SUBOP_JALR,    REG_RS,   REG_RT,   REG_RD,   ISA_BRANCH, FMT_RD_RS, jr) \
+    X(SYSCALL, OP_SPECIAL, SUBOP_SYSCALL, REG_V0,   REG_V1,   REG_RD,   0, FMT_NONE, special) \
+    X(MFHI,    OP_SPECIAL, SUBOP_MFHI,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RD, mfhi) \
+    X(MTHI,    OP_SPECIAL, SUBOP_MTHI,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RS, mthi) \
+    X(MFLO,    OP_SPECIAL, SUBOP_MFLO,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RD, mflo) \
+    X(MTLO,    OP_SPECIAL, SUBOP_MTLO,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RS, mtlo) \
+    X(MULT,    OP_SPECIAL, SUBOP_MULT,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RS_RT, mult) \
+    X(MULTU,   OP_SPECIAL, SUBOP_MULTU,   REG_RS,   REG_RT,   REG_RD,   0, FMT_RS_RT, multu) \
+    X(DIV,     OP_SPECIAL, SUBOP_DIV,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RS_RT, div) \
+    X(DIVU,    OP_SPECIAL, SUBOP_DIVU,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RS_RT, divu) \
+    X(ADD,     OP_SPECIAL, SUBOP_ADD,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, addu) \
+    X(ADDU,    OP_SPECIAL, SUBOP_ADDU,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, addu) \
+    X(SUB,     OP_SPECIAL, SUBOP_SUB,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, subu) \
+    X(SUBU,    OP_SPECIAL, SUBOP_SUBU,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, subu) \
+    X(AND,     OP_SPECIAL, SUBOP_AND,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, and) \
+    X(OR,      OP_SPECIAL, SUBOP_OR,      REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, or) \
+    X(XOR,     OP_SPECIAL, SUBOP_XOR,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, xor) \
+    X(NOR,     OP_SPECIAL, SUBOP_NOR,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, nor) \
+    X(SLT,     OP_SPECIAL, SUBOP_SLT,     REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, slt) \
+    X(SLTU,    OP_SPECIAL, SUBOP_SLTU,    REG_RS,   REG_RT,   REG_RD,   0, FMT_RD_RS_RT, sltu) \
+    X(BLTZ,    OP_BRSPEC,  BROP_BLTZ,     REG_RS,   REG_RT,   REG_NONE, ISA_BRANCH | ISA_COND | ISA_PCREL, FMT_RS_OFF, bltz) \
+    X(BGEZ,    OP_BRSPEC,  BROP_BGEZ,     REG_RS,   REG_RT,   REG_NONE, ISA_BRANCH | ISA_COND | ISA_PCREL, FMT_RS_OFF, bgez) \
+    X(BLTZAL,  OP_BRSPEC,  BROP_BLTZAL,   REG_RS,   REG_RT,   REG_RA,   ISA_BRANCH | ISA_COND | ISA_PCREL | ISA_LINK, FMT_RS_OFF, bltz) \
+    X(BGEZAL,  OP_BRSPEC,  BROP_BGEZAL,   REG_RS,   REG_RT,   REG_RA,   ISA_BRANCH | ISA_COND | ISA_PCREL | ISA_LINK, FMT_RS_OFF, bgez) \
+    X(J,       OP_J,       0,             REG_NONE, REG_NONE, REG_NONE, ISA_BRANCH | ISA_JUMP, FMT_TARGET, none) \
+    X(JAL,     OP_JAL,     0,             REG_NONE, REG_NONE, REG_RA,   ISA_BRANCH | ISA_JUMP | ISA_LINK, FMT_TARGET, none) \
+    X(BEQ,     OP_BEQ,     0,             REG_RS,   REG_RT,   REG_NONE, ISA_BRANCH | ISA_COND | ISA_PCREL, FMT_RS_RT_OFF, beq) \
+    X(BNE,     OP_BNE,     0,             REG_RS,   REG_RT,   REG_NONE, ISA_BRANCH | ISA_COND | ISA_PCREL, FMT_RS_RT_OFF, bne) \
+    X(BLEZ,    OP_BLEZ,    0,             REG_RS,   REG_RT,   REG_NONE, ISA_BRANCH | ISA_COND | ISA_PCREL, FMT_RS_OFF, blez) \
+    X(BGTZ,    OP_BGTZ,    0,             REG_RS,   REG_RT,   REG_NONE, ISA_BRANCH | ISA_COND | ISA_PCREL, FMT_RS_OFF, bgtz) \
+    X(ADDI,    OP_ADDI,    0,             REG_RS,   REG_NONE, REG_RT,   0, FMT_RT_RS_IMM, addiu) \
+    X(ADDIU,   OP_ADDIU,   0,             REG_RS,   REG_NONE, REG_RT,   0, FMT_RT_RS_IMM, addiu) \
+    X(SLTI,    OP_SLTI,    0,             REG_RS,   REG_NONE, REG_RT,   0, FMT_RT_RS_IMM, slti) \
+    X(SLTIU,   OP_SLTIU,   0,             REG_RS,   REG_NONE, REG_RT,   0, FMT_RT_RS_IMM, sltiu) \
+    X(ANDI,    OP_ANDI,    0,             REG_RS,   REG_NONE, REG_RT,   0, FMT_RT_RS_UIMM, andi) \
+    X(ORI,     OP_ORI,     0,             REG_RS,   REG_NONE, REG_RT,   0, FMT_RT_RS_UIMM, ori) \
+    X(XORI,    OP_XORI,    0,             REG_RS,   REG_NONE, REG_RT,   0, FMT_RT_RS_UIMM, xori) \
+    X(LUI,     OP_LUI,     0,             REG_RS,   REG_NONE, REG_RT,   0, FMT_RT_UIMM, lui) \
+    X(LB,      OP_LB,      0,             REG_RS,   REG_NONE, REG_RT,   ISA_LOAD, FMT_RT_MEM, load) \
+    X(LH,      OP_LH,      0,             REG_RS,   REG_NONE, REG_RT,   ISA_LOAD, FMT_RT_MEM, load) \
+    X(LW,      OP_LW,      0,             REG_RS,   REG_NONE, REG_RT,   ISA_LOAD, FMT_RT_MEM, load) \
+    X(LBU,     OP_LBU,     0,             REG_RS,   REG_NONE, REG_RT,   ISA_LOAD, FMT_RT_MEM, load) \
+    X(LHU,     OP_LHU,     0,             REG_RS,   REG_NONE, REG_RT,   ISA_LOAD, FMT_RT_MEM, load) \
+    X(SB,      OP_SB,      0,             REG_RS,   REG_RT,   REG_NONE, ISA_STORE, FMT_RT_MEM, store) \
+    X(SH,      OP_SH,      0,             REG_RS,   REG_RT,   REG_NONE, ISA_STORE, FMT_RT_MEM, store) \
+    X(SW,      OP_SW,      0,             REG_RS,   REG_RT,   REG_NONE, ISA_STORE, FMT_RT_MEM, store)
+
+/* instruction numbers: INSN_INVALID for encodings not in the table */
+#define ISA_ENUM(name, ...) INSN_##name,
+enum { INSN_INVALID, ISA_TABLE(ISA_ENUM) INSN_COUNT };
+#undef ISA_ENUM
+
+/* a register operand as decode computes it:
+ * ((instruction >> shift) & mask) | fixed, so that no operand kind needs a
+ * branch (-1 for none is mask 0, fixed -1) */
+#define ISA_REG_SHIFT(r) ((r) == REG_RS ? 21 : (r) == REG_RT ? 16 : (r) == REG_RD ? 11 : 0)
+#define ISA_REG_MASK(r)  ((r) == REG_RS || (r) == REG_RT || (r) == REG_RD ? 0x1F : 0)
+#define ISA_REG_FIXED(r) ((r) == REG_RA ? 31 : (r) == REG_V0 ? 2 : (r) == REG_V1 ? 3 : \
+                          (r) == REG_NONE ? -1 : 0)
+
+typedef struct Isa_Operand {
+    uint8_t shift, mask;
+    int8_t fixed;
+} Isa_Operand;
+
+typedef struct Isa_Info {
+    const char *name;     /* mnemonic */
+    Isa_Operand src1, src2, dst;
+    uint8_t flags;        /* ISA_* */
+    uint8_t format;       /* FMT_* */
+} Isa_Info;
+
+extern const Isa_Info isa_info[INSN_COUNT];
+
+/* decode table: primary opcodes, then SPECIAL by function field, then
+ * REGIMM by rt field */
+#define ISA_INDEX(opcode, sub) \
+    ((opcode) == OP_SPECIAL ? 64 + (sub) : (opcode) == OP_BRSPEC ? 128 + (sub) : (opcode))
+#define ISA_DECODE_SIZE (128 + 32)
+
+extern const uint8_t isa_decode_table[ISA_DECODE_SIZE];
+
+/* the sub-opcode field: function for SPECIAL, rt for REGIMM, else 0 */
+static inline uint32_t isa_subop(uint32_t instruction)
+{
+    uint32_t opcode = instruction >> 26;
+    uint32_t sub = opcode == OP_BRSPEC ? (instruction >> 16) & 0x1F : instruction & 0x3F;
+    return opcode <= OP_BRSPEC ? sub : 0;
+}
+
+/* the instruction (INSN_*) a word encodes; selects rather than branches
+ * on the opcode, which is as good as random in a stream of instructions */
+static inline int isa_lookup(uint32_t instruction)
+{
+    uint32_t opcode = instruction >> 26;
+    return isa_decode_table[opcode <= OP_BRSPEC ? 64 + (opcode << 6) + isa_subop(instruction) : opcode];
+}
+
+static inline int8_t isa_operand(const Isa_Operand *r, uint32_t instruction)
+{
+    return ((instruction >> r->shift) & r->mask) | r->fixed;
+}
+
+/* fill in an op's decoded fields (instruction number, operands, immediates,
+ * branch and memory information) from op->instruction and op->pc */
+static inline void isa_decode(Pipe_Op *op)
+{
+    uint32_t instruction = op->instruction;
+    uint32_t opcode = instruction >> 26;
+    uint32_t imm16 = instruction & 0xFFFF;
+    uint32_t se_imm16 = (uint32_t)(int16_t)imm16;
+    int insn = isa_lookup(instruction);
+    const Isa_Info *info = &isa_info[insn];
+    uint8_t flags = info->flags;
+
+    op->insn = insn;
+    op->opcode = opcode;
+    op->subop = isa_subop(instruction);
+    op->shamt = (instruction >> 6) & 0x1F;
+    op->imm16 = imm16;
+    op->se_imm16 = se_imm16;
+
+    op->reg_src1 = isa_operand(&info->src1, instruction);
+    op->reg_src2 = isa_operand(&info->src2, instruction);
+    op->reg_dst = isa_operand(&info->dst, instruction);
+
+    /* fields an op doesn't have are left as allocated (zero) */
+    if (flags & (ISA_LOAD | ISA_STORE)) {
+        op->is_mem = 1;
+        op->mem_write = (flags & ISA_STORE) != 0;
+    }
+    if (flags & ISA_BRANCH) {
+        op->is_branch = 1;
+        op->branch_cond = (flags & ISA_COND) != 0;
+    }
+    if (flags & ISA_PCREL)
+        op->branch_dest = op->pc + 4 + (se_imm16 << 2);
+    if (flags & ISA_JUMP) {
+        op->branch_taken = 1;
+        op->branch_dest = (op->pc & 0xF0000000) | ((instruction & 0x03FFFFFF) << 2);
+    }
+    if (flags & ISA_LINK) {
+        /* the link value is known now */
+        op->reg_dst_value = op->pc + 4;
+        op->reg_dst_value_ready = 1;
+    }
+}
+
+/* write the assembler form of 'instruction' at 'pc' into buf; returns the
+ * length, as snprintf */
+int isa_disasm(uint32_t pc, uint32_t instruction, char *buf, int size);
+
+#endif
@@ -0,0 +1,593 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Program loaders: ELF executables, program images and cached .x files.
+ * See loader.h.
+ */
+
+#include "loader.h"
+#include "shell.h"
+#include "pipe.h"
+#include <elf.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* symbols of all loaded executables, sorted by address */
+static Elf_Symbol *symbols;
+static int nsymbols;
+
+/* Executables loaded so far, and their mappings (kept: symbol names point
+ * into them). Loading one again (after a reset) replaces its old mapping,
+ * and the symbol table is rebuilt from all of them rather than added to. */
+#define MAX_LOADED_ELFS 16
+
+static struct {
+    char path[PATH_MAX];
+    uint8_t *image;
+    size_t size;
+} loaded_elfs[MAX_LOADED_ELFS];
+static int nloaded_elfs;
+
+static void elf_error(const char *filename, const char *what)
+{
+    printf("Error: %s: %s\n", filename, what);
+    exit(-1);
+}
+
+/* map a whole file privately (writes stay in this process); NULL if it
+ * can't be opened or is empty. Uses stdio rather than open/close because
+ * unistd.h's pipe() clashes with the pipeline state. */
+static uint8_t *map_file(const char *filename, size_t *size)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return NULL;
+
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fileno(file), &st) == 0 && st.st_size > 0)
+        p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+    fclose(file);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    *size = st.st_size;
+    return p;
+}
+
+/* copy 'size' bytes to simulated memory at 'addr', a page at a time */
+static void load_copy(uint32_t addr, const uint8_t *src, uint32_t size)
+{
+    while (size > 0) {
+        uint32_t offset = addr & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - offset;
+        if (chunk > size)
+            chunk = size;
+        memcpy(mem_page(addr, TRUE) + offset, src, chunk);
+        addr += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+}
+
+/* zero 'size' bytes at 'addr'; pages that don't exist yet already read as
+ * zero, so a large bss costs nothing */
+static void load_zero(uint32_t addr, uint32_t size)
+{
+    while (size > 0) {
+        uint32_t offset = addr & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - offset;
+        if (chunk > size)
+            chunk = size;
+        uint8_t *page = mem_page(addr, FALSE);
+        if (page)
+            memset(page + offset, 0, chunk);
+        addr += chunk;
+        size -= chunk;
+    }
+}
+
+static int symbol_compare(const void *a, const void *b)
+{
+    const Elf_Symbol *x = a, *y = b;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    /* sized symbols first, so they win over labels at the same address */
+    return (y->size != 0) - (x->size != 0);
+}
+
+static void elf_read_symbols(const char *filename, const uint8_t *image, size_t size,
+                             const Elf32_Ehdr *eh)
+{
+    if (eh->e_shoff == 0 || eh->e_shnum == 0)
+        return;
+    if (eh->e_shentsize != sizeof(Elf32_Shdr) ||
+        eh->e_shoff + (size_t) eh->e_shnum * sizeof(Elf32_Shdr) > size)
+        elf_error(filename, "bad section header table");
+
+    const Elf32_Shdr *sh = (const Elf32_Shdr *) (image + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB)
+            continue;
+        if (sh[i].sh_link >= eh->e_shnum ||
+            sh[i].sh_offset + (size_t) sh[i].sh_size > size ||
+            sh[sh[i].sh_link].sh_offset + (size_t) sh[sh[i].sh_link].sh_size > size)
+            elf_error(filename, "bad symbol table");
+
+        const Elf32_Sym *sym = (const Elf32_Sym *) (image + sh[i].sh_offset);
+        int count = sh[i].sh_size / sizeof(Elf32_Sym);
+        const char *strtab = (const char *) image + sh[sh[i].sh_link].sh_offset;
+        uint32_t strtab_size = sh[sh[i].sh_link].sh_size;
+
+        symbols = realloc(symbols, (nsymbols + count) * sizeof(Elf_Symbol));
+        for (int k = 0; k < count; k++) {
+            int type = ELF32_ST_TYPE(sym[k].st_info);
+            if (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE)
+                continue;
+            if (sym[k].st_shndx == SHN_UNDEF || sym[k].st_name == 0 ||
+                sym[k].st_name >= strtab_size)
+                continue;
+
+            Elf_Symbol *s = &symbols[nsymbols++];
+            s->addr = sym[k].st_value;
+            s->size = sym[k].st_size;
+            s->name = strtab + sym[k].st_name;
+            s->is_func = type == STT_FUNC;
+        }
+    }
+
+    qsort(symbols, nsymbols, sizeof(Elf_Symbol), symbol_compare);
+}
+
+int elf_load(const char *filename)
+{
+    size_t size;
+    uint8_t *image = map_file(filename, &size);
+    if (image == NULL)
+        return -1;
+
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr *) image;
+    if (size < sizeof(Elf32_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0) {
+        munmap(image, size);
+        return -1;
+    }
+
+    if (eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB)
+        elf_error(filename, "not a 32-bit little-endian ELF file");
+    if (eh->e_machine != EM_MIPS)
+        elf_error(filename, "not a MIPS executable");
+    if (eh->e_type != ET_EXEC)
+        elf_error(filename, "not a static executable");
+    if (eh->e_phentsize != sizeof(Elf32_Phdr) ||
+        eh->e_phoff + (size_t) eh->e_phnum * sizeof(Elf32_Phdr) > size)
+        elf_error(filename, "bad program header table");
+
+    const Elf32_Phdr *ph = (const Elf32_Phdr *) (image + eh->e_phoff);
+    int nsegments = 0;
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_INTERP || ph[i].p_type == PT_DYNAMIC)
+            elf_error(filename, "dynamically linked executables are not supported");
+        if (ph[i].p_type != PT_LOAD)
+            continue;
+        if (ph[i].p_offset + (size_t) ph[i].p_filesz > size || ph[i].p_filesz > ph[i].p_memsz)
+            elf_error(filename, "bad loadable segment");
+
+        load_copy(ph[i].p_vaddr, image + ph[i].p_offset, ph[i].p_filesz);
+        load_zero(ph[i].p_vaddr + ph[i].p_filesz, ph[i].p_memsz - ph[i].p_filesz);
+        nsegments++;
+    }
+
+    /* the mapping is kept, in place of this file's earlier one */
+    int e = 0;
+    while (e < nloaded_elfs && strcmp(loaded_elfs[e].path, filename) != 0)
+        e++;
+    if (e == nloaded_elfs) {
+        if (nloaded_elfs == MAX_LOADED_ELFS || strlen(filename) >= PATH_MAX)
+            elf_error(filename, "too many executables");
+        strcpy(loaded_elfs[nloaded_elfs++].path, filename);
+    }
+    else
+        munmap(loaded_elfs[e].image, loaded_elfs[e].size);
+    loaded_elfs[e].image = image;
+    loaded_elfs[e].size = size;
+
+    nsymbols = 0;
+    for (int i = 0; i < nloaded_elfs; i++)
+        elf_read_symbols(loaded_elfs[i].path, loaded_elfs[i].image, loaded_elfs[i].size,
+                         (const Elf32_Ehdr *) loaded_elfs[i].image);
+
+    pipe.PC = eh->e_entry;
+    pipe.REGS[29] = ELF_STACK_TOP;
+    const Elf_Symbol *gp = elf_symbol_find("_gp");
+    if (gp)
+        pipe.REGS[28] = gp->addr;
+
+    printf("Loaded ELF executable: %d segments, entry 0x%08x, %d symbols.\n\n",
+           nsegments, eh->e_entry, nsymbols);
+    return 0;
+}
+
+const Elf_Symbol *elf_symbol_at(uint32_t addr)
+{
+    /* last symbol at or below addr */
+    int lo = 0, hi = nsymbols - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (symbols[mid].addr <= addr) {
+            found = mid;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+
+    /* prefer a sized symbol that contains addr */
+    for (int i = found; i >= 0 && found - i < 16; i--) {
+        if (symbols[i].size && addr - symbols[i].addr < symbols[i].size)
+            return &symbols[i];
+    }
+    if (found >= 0 && symbols[found].size == 0)
+        return &symbols[found];
+    return NULL;
+}
+
+const Elf_Symbol *elf_symbol_find(const char *name)
+{
+    for (int i = 0; i < nsymbols; i++)
+        if (strcmp(symbols[i].name, name) == 0)
+            return &symbols[i];
+    return NULL;
+}
+
+/***************************************************************/
+/* Program images.                                             */
+/***************************************************************/
+
+#define PAGE_ROUND(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+/* Images mapped so far. Loading one again (after a reset) reuses its
+ * mapping: MADV_DONTNEED drops the private copies of the pages the program
+ * wrote, which then read as the file again, so nothing is remapped or
+ * leaked. */
+#define MAX_MAPPED_IMAGES 16
+
+static struct {
+    char path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    uint8_t *image;
+} mapped_images[MAX_MAPPED_IMAGES];
+static int nmapped_images;
+
+/* map_file() for images, reusing (and restoring) an earlier mapping of the
+ * same unchanged file */
+static uint8_t *map_image(const char *path, size_t *size)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return NULL;
+
+    for (int i = 0; i < nmapped_images; i++) {
+        if (strcmp(mapped_images[i].path, path) != 0)
+            continue;
+        if (mapped_images[i].dev == st.st_dev && mapped_images[i].ino == st.st_ino &&
+            mapped_images[i].size == st.st_size && mapped_images[i].mtime == st.st_mtime) {
+            madvise(mapped_images[i].image, st.st_size, MADV_DONTNEED);
+            *size = st.st_size;
+            return mapped_images[i].image;
+        }
+        /* the file changed: forget the old mapping (its pages may still
+         * be in use) */
+        mapped_images[i] = mapped_images[--nmapped_images];
+        break;
+    }
+
+    uint8_t *image = map_file(path, size);
+    if (image && nmapped_images < MAX_MAPPED_IMAGES && strlen(path) < PATH_MAX) {
+        strcpy(mapped_images[nmapped_images].path, path);
+        mapped_images[nmapped_images].dev = st.st_dev;
+        mapped_images[nmapped_images].ino = st.st_ino;
+        mapped_images[nmapped_images].size = st.st_size;
+        mapped_images[nmapped_images].mtime = st.st_mtime;
+        mapped_images[nmapped_images].image = image;
+        nmapped_images++;
+    }
+    return image;
+}
+
+/* unmap an image that turned out not to be usable */
+static void unmap_image(uint8_t *image, size_t size)
+{
+    for (int i = 0; i < nmapped_images; i++) {
+        if (mapped_images[i].image == image) {
+            mapped_images[i] = mapped_images[--nmapped_images];
+            break;
+        }
+    }
+    munmap(image, size);
+}
+
+static int image_valid(const uint8_t *image, size_t size)
+{
+    const Image_Header *h = (const Image_Header *) image;
+    if (size < sizeof(Image_Header) || memcmp(h->magic, IMAGE_MAGIC, 8) != 0)
+        return 0;
+    if (sizeof(Image_Header) + (size_t) h->nsegments * sizeof(Image_Segment) > size)
+        return 0;
+
+    const Image_Segment *seg = (const Image_Segment *) (h + 1);
+    for (uint32_t i = 0; i < h->nsegments; i++) {
+        if ((seg[i].vaddr | seg[i].offset) & (PAGE_SIZE - 1))
+            return 0;
+        if (seg[i].filesz > seg[i].memsz ||
+            seg[i].offset + (size_t) PAGE_ROUND(seg[i].filesz) > size)
+            return 0;
+    }
+    return 1;
+}
+
+/* map the segments of a validated image; the padding of the last page of
+ * each segment is zero, and the rest of memsz reads as zero */
+static void image_install(uint8_t *image)
+{
+    const Image_Header *h = (const Image_Header *) image;
+    const Image_Segment *seg = (const Image_Segment *) (h + 1);
+
+    for (uint32_t i = 0; i < h->nsegments; i++) {
+        uint32_t mapped = PAGE_ROUND(seg[i].filesz);
+        mem_map_pages(seg[i].vaddr, image + seg[i].offset, mapped / PAGE_SIZE);
+        if (seg[i].memsz > mapped)
+            load_zero(seg[i].vaddr + mapped, seg[i].memsz - mapped);
+    }
+}
+
+int image_load(const char *filename)
+{
+    size_t size;
+    uint8_t *image = map_image(filename, &size);
+    if (image == NULL)
+        return -1;
+
+    if (size < sizeof(Image_Header) || memcmp(image, IMAGE_MAGIC, 8) != 0) {
+        unmap_image(image, size);
+        return -1;
+    }
+    if (!image_valid(image, size)) {
+        printf("Error: %s: corrupt program image\n", filename);
+        exit(-1);
+    }
+
+    /* the mapping is kept: its pages are now simulated memory */
+    image_install(image);
+
+    const Image_Header *h = (const Image_Header *) image;
+    pipe.PC = h->entry;
+    printf("Loaded program image: %u segments, entry 0x%08x.\n\n", h->nsegments, h->entry);
+    return 0;
+}
+
+/* write a one-segment image atomically (via a temporary file and rename),
+ * so that concurrent runs never see a partial image */
+static void image_write(const char *path, uint64_t source_hash, uint64_t source_size,
+                        uint32_t base, const uint8_t *data, uint32_t nbytes)
+{
+    static const uint8_t zero[PAGE_SIZE];
+    char tmp[PATH_MAX];
+
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+        return;
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return;
+    FILE *file = fdopen(fd, "wb");
+    if (file == NULL) {
+        remove(tmp);
+        return;
+    }
+
+    Image_Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IMAGE_MAGIC, 8);
+    h.entry = base;
+    h.nsegments = 1;
+    h.source_hash = source_hash;
+    h.source_size = source_size;
+    Image_Segment seg = { base, PAGE_SIZE, nbytes, nbytes };
+
+    fwrite(&h, sizeof(h), 1, file);
+    fwrite(&seg, sizeof(seg), 1, file);
+    fwrite(zero, PAGE_SIZE - sizeof(h) - sizeof(seg), 1, file);
+    fwrite(data, nbytes, 1, file);
+    fwrite(zero, PAGE_ROUND(nbytes) - nbytes, 1, file);
+
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed || rename(tmp, path) != 0)
+        remove(tmp);
+}
+
+/* image cache directory, created if needed; NULL if caching is disabled
+ * or the directory can't be created */
+static const char *cache_dir()
+{
+    static char dir[PATH_MAX];
+    const char *env = getenv("MIPS_SIM_CACHE");
+
+    if (env) {
+        if (*env == '\0')
+            return NULL;
+        snprintf(dir, sizeof(dir), "%s", env);
+    }
+    else if ((env = getenv("XDG_CACHE_HOME")) && *env)
+        snprintf(dir, sizeof(dir), "%s/mips-sim", env);
+    else if ((env = getenv("HOME")) && *env) {
+        snprintf(dir, sizeof(dir), "%s/.cache", env);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof(dir), "%s/.cache/mips-sim", env);
+    }
+    else
+        return NULL;
+
+    mkdir(dir, 0755);
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+    return dir;
+}
+
+/* 64-bit FNV-1a over 8-byte words, then the tail bytes */
+static uint64_t content_hash(const uint8_t *p, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++)
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    return h ^ size;
+}
+
+/* value of each hex digit character, HEX_SPACE for whitespace, HEX_BAD
+ * for anything else */
+#define HEX_SPACE 16
+#define HEX_BAD   17
+
+static uint8_t hex_class[256];
+
+static void hex_class_init()
+{
+    for (int c = 0; c < 256; c++)
+        hex_class[c] = isxdigit(c) ? (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10) :
+                       isspace(c) ? HEX_SPACE : HEX_BAD;
+}
+
+/* parse the hex words of a .x file into little-endian bytes at 'out';
+ * returns the number of words */
+static uint32_t parse_hex_words(const char *filename, const uint8_t *p, size_t size, uint8_t *out)
+{
+    const uint8_t *start = p, *end = p + size;
+    uint32_t n = 0;
+
+    if (hex_class[' '] != HEX_SPACE)
+        hex_class_init();
+
+    for (;;) {
+        while (p < end && hex_class[*p] == HEX_SPACE)
+            p++;
+        if (p == end)
+            break;
+        if (end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x' && hex_class[p[2]] < 16)
+            p += 2;
+
+        uint32_t word = 0;
+        const uint8_t *digits = p;
+        while (p < end && hex_class[*p] < 16)
+            word = (word << 4) | hex_class[*p++];
+        if (p == digits) {
+            printf("Error: %s: bad hex word at offset %ld\n", filename, (long) (p - start));
+            exit(-1);
+        }
+
+        out[4 * n + 0] = word;
+        out[4 * n + 1] = word >> 8;
+        out[4 * n + 2] = word >> 16;
+        out[4 * n + 3] = word >> 24;
+        n++;
+    }
+    return n;
+}
+
+/* hash of the last .x file loaded, so that reloading it unchanged (after a
+ * reset) needs neither reading nor hashing it */
+static struct {
+    char path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    uint64_t hash;
+} last_text;
+
+int text_load(const char *filename, uint32_t base, int use_cache)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return -1;
+
+    size_t size = st.st_size;
+    uint8_t *text = NULL;
+    uint64_t hash;
+
+    if (strcmp(last_text.path, filename) == 0 && last_text.dev == st.st_dev &&
+        last_text.ino == st.st_ino && last_text.size == st.st_size &&
+        last_text.mtime == st.st_mtime)
+        hash = last_text.hash;
+    else {
+        text = map_file(filename, &size);
+        if (text == NULL) {
+            /* an empty file is a program of no words */
+            FILE *file = fopen(filename, "r");
+            if (file == NULL)
+                return -1;
+            fclose(file);
+            return 0;
+        }
+        hash = content_hash(text, size);
+        if (strlen(filename) < PATH_MAX) {
+            strcpy(last_text.path, filename);
+            last_text.dev = st.st_dev;
+            last_text.ino = st.st_ino;
+            last_text.size = st.st_size;
+            last_text.mtime = st.st_mtime;
+            last_text.hash = hash;
+        }
+    }
+
+    const char *dir = use_cache ? cache_dir() : NULL;
+    char path[PATH_MAX];
+
+    if (dir && snprintf(path, sizeof(path), "%s/%016llx.img", dir,
+                        (unsigned long long) hash) < sizeof(path)) {
+        size_t image_size;
+        uint8_t *image = map_image(path, &image_size);
+        if (image) {
+            const Image_Header *h = (const Image_Header *) image;
+            const Image_Segment *seg = (const Image_Segment *) (h + 1);
+            if (image_valid(image, image_size) && h->source_hash == hash &&
+                h->source_size == size && h->nsegments == 1 && seg->vaddr == base) {
+                image_install(image);
+                if (text)
+                    munmap(text, size);
+                return seg->filesz / 4;
+            }
+            unmap_image(image, image_size);
+        }
+    }
+    else
+        dir = NULL;
+
+    if (text == NULL && (text = map_file(filename, &size)) == NULL)
+        return -1;
+
+    /* every word takes at least two characters, except perhaps the last */
+    uint8_t *words = malloc(2 * size + 4);
+    uint32_t n = parse_hex_words(filename, text, size, words);
+    load_copy(base, words, 4 * n);
+    if (dir)
+        image_write(path, hash, size, base, words, 4 * n);
+
+    free(words);
+    munmap(text, size);
+    return n;
+}
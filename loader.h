@@ -0,0 +1,73 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Program loader for static MIPS32 little-endian ELF executables. The file
+ * is mmapped, its PT_LOAD segments are copied into simulated memory (the
+ * part of a segment beyond its file size, i.e. bss, reads as zero), the PC
+ * is set to the entry point and $sp to the top of the stack region. The
+ * symbol table is kept so that other parts of the simulator can name
+ * addresses.
+ *
+ * Also: a binary program image format whose page-aligned segments are
+ * mapped straight into simulated memory, and an on-disk cache of images
+ * converted from .x hex files, keyed by a hash of the file contents.
+ */
+
+#ifndef _LOADER_H_
+#define _LOADER_H_
+
+#include <stdint.h>
+
+/* initial stack pointer: top of the stack region, leaving a zeroed
+ * argc/argv/envp frame for the program's startup code */
+#define ELF_STACK_TOP 0x7ffffff0
+
+typedef struct Elf_Symbol {
+    uint32_t addr, size;
+    const char *name; /* points into the mapped file */
+    int is_func;
+} Elf_Symbol;
+
+/* load an ELF executable; returns 0 on success, -1 if the file can't be
+ * opened or is not an ELF file. Exits on an unsupported or corrupt ELF. */
+int elf_load(const char *filename);
+
+/* symbol containing 'addr', or the closest unsized symbol (an assembler
+ * label) below it; NULL if there is none */
+const Elf_Symbol *elf_symbol_at(uint32_t addr);
+
+/* symbol by name, NULL if there is none */
+const Elf_Symbol *elf_symbol_find(const char *name);
+
+/* Binary program image: header, segment table, then the segment contents,
+ * each starting on a page boundary of the file and padded to whole pages.
+ * Fields are in host byte order; segment bytes are simulated memory. */
+#define IMAGE_MAGIC "MIPSIMG1"
+
+typedef struct Image_Header {
+    char magic[8];
+    uint32_t entry;       /* initial PC */
+    uint32_t nsegments;
+    uint64_t source_hash; /* hash and size of the .x file it was made from */
+    uint64_t source_size;
+} Image_Header;
+
+typedef struct Image_Segment {
+    uint32_t vaddr;       /* page-aligned */
+    uint32_t offset;      /* page-aligned file offset */
+    uint32_t filesz, memsz;
+} Image_Segment;
+
+/* load a program image; returns 0 on success, -1 if the file can't be
+ * opened or is not an image. Exits on a corrupt image. */
+int image_load(const char *filename);
+
+/* load a .x file (one hex word per line) at 'base', through the image cache
+ * if 'use_cache' is set and a cache directory is available. Returns the
+ * number of words, or -1 if the file can't be opened.
+ *
+ * The cache directory is $MIPS_SIM_CACHE, else $XDG_CACHE_HOME/mips-sim or
+ * $HOME/.cache/mips-sim; setting MIPS_SIM_CACHE to "" disables the cache. */
+int text_load(const char *filename, uint32_t base, int use_cache);
+
+#endif
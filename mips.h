@@ -63,4 +63,9 @@
 #define OP_SH    0x29
 #define OP_SW    0x2b
 
+/* syscall codes (in $v0) */
+#define SYSCALL_EXIT      0xA
+#define SYSCALL_ROI_BEGIN 0x100 /* region of interest starts (fastfwd.c) */
+#define SYSCALL_ROI_END   0x101 /* ... and ends */
+
 #endif
@@ -0,0 +1,133 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Single-pass miss-ratio curves from LRU stack distances. See mrc.h.
+ */
+
+#include "mrc.h"
+#include "pipe.h"
+#include "shell.h"
+#include "config.h"
+#include "isa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MRC_LINE_SHIFT 5 /* 32-byte lines, as both cache models */
+#define MRC_EMPTY      0xFFFFFFFF
+
+typedef struct Mrc {
+    int levels, ways;  /* set counts 1 << 0 .. 1 << (levels - 1) */
+    uint32_t *stacks;  /* per level, per set: 'ways' lines, most recent first */
+    uint64_t *hist;    /* per level: accesses found at each depth, then misses */
+    uint64_t accesses;
+} Mrc;
+
+static void mrc_init(Mrc *m, int levels, int ways)
+{
+    size_t nsets = ((size_t)1 << levels) - 1;
+
+    m->levels = levels;
+    m->ways = ways;
+    m->stacks = malloc(nsets * ways * sizeof(uint32_t));
+    m->hist = calloc((size_t)levels * (ways + 1), sizeof(uint64_t));
+    if (!m->stacks || !m->hist) {
+        printf("Error: out of memory for miss-ratio curves\n");
+        exit(-1);
+    }
+    memset(m->stacks, 0xFF, nsets * ways * sizeof(uint32_t));
+    m->accesses = 0;
+}
+
+static void mrc_access(Mrc *m, uint32_t addr)
+{
+    uint32_t line = addr >> MRC_LINE_SHIFT;
+    int ways = m->ways;
+
+    m->accesses++;
+    for (int k = 0; k < m->levels; k++) {
+        uint32_t sets = 1u << k;
+        uint32_t *s = m->stacks + ((size_t)(sets - 1) + (line & (sets - 1))) * ways;
+        int d = 0;
+
+        while (d < ways && s[d] != line)
+            d++;
+        m->hist[k * (ways + 1) + d]++;
+        if (d == ways)
+            d--;
+        memmove(s + 1, s, d * sizeof(uint32_t));
+        s[0] = line;
+    }
+}
+
+/* the associativities reported: powers of two, and the largest */
+static int mrc_next_ways(int w, int max)
+{
+    return w < max && w * 2 > max ? max : w * 2;
+}
+
+/* one table: a row per set count, a column per power-of-two associativity
+ * (and mrc_max_ways); '*' marks the geometry of the simulator's own cache */
+static void mrc_print(const Mrc *m, const char *name, int model_sets, int model_ways)
+{
+    printf("%s: %llu accesses, miss ratio (%%)\n", name, (unsigned long long)m->accesses);
+    printf("  %8s", "sets");
+    for (int w = 1; w <= m->ways; w = mrc_next_ways(w, m->ways))
+        printf("  %5d-way", w);
+    printf("\n");
+
+    for (int k = 0; k < m->levels; k++) {
+        const uint64_t *h = m->hist + k * (m->ways + 1);
+        uint64_t hits = 0;
+        int d = 0;
+
+        printf("  %8u", 1u << k);
+        for (int w = 1; w <= m->ways; w = mrc_next_ways(w, m->ways)) {
+            for (; d < w; d++)
+                hits += h[d];
+            double ratio = m->accesses ? 100.0 * (m->accesses - hits) / m->accesses : 0.0;
+            printf("  %8.3f%c", ratio, (1 << k) == model_sets && w == model_ways ? '*' : ' ');
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+void mrc_go()
+{
+    int levels = 1, ways = config.mrc_max_ways;
+    Mrc icache, dcache;
+
+    if (config.cores > 1) {
+        printf("Miss-ratio curves are computed for a single core\n\n");
+        return;
+    }
+    while ((2 << (levels - 1)) <= config.mrc_max_sets)
+        levels++;
+    mrc_init(&icache, levels, ways);
+    mrc_init(&dcache, levels, ways);
+
+    reset();
+    while (RUN_BIT) {
+        Pipe_Op op = { .pc = pipe.PC };
+
+        op.instruction = mem_read_32(op.pc);
+        isa_decode(&op);
+        mrc_access(&icache, op.pc);
+        if (op.is_mem)
+            mrc_access(&dcache, pipe.REGS[op.reg_src1] + op.se_imm16);
+        pipe_step(0);
+    }
+    pipe_resume();
+
+    printf("Miss-ratio curves, LRU with 32-byte lines (over %d ways: misses)\n", ways);
+    printf("'*': the simulator's cache geometry, which replaces in fill order (FIFO)\n\n");
+    mrc_print(&icache, "Instruction fetches", 64, 4);
+    mrc_print(&dcache, "Data accesses", 256, 8);
+
+    free(icache.stacks);
+    free(icache.hist);
+    free(dcache.stacks);
+    free(dcache.hist);
+    reset();
+}
@@ -0,0 +1,31 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Miss-ratio curves ("mrc"): the miss ratio of every LRU cache geometry -
+ * 1 .. mrc_max_ways ways, and 1, 2, 4 .. mrc_max_sets sets of 32-byte
+ * lines - for the program's instruction fetches and data accesses, from a
+ * single functional run instead of one run per geometry.
+ *
+ * This is all-associativity simulation with stack distances: for every set
+ * count, each set keeps its lines in an LRU stack, most recent first. An
+ * access found at depth d hits in every cache of that set count with more
+ * than d ways, and moves to the top; so one histogram of depths per set
+ * count gives the whole row of miss ratios. Stacks are kept mrc_max_ways
+ * deep: deeper reuse counts as a miss at every associativity reported.
+ *
+ * The curves are an LRU approximation of the simulator's own caches: both
+ * the instruction cache (64 sets, 4 ways) and the data cache (256 sets, 8
+ * ways) replace lines in the order they were filled, since a hit does not
+ * update recency, and so miss somewhat more than LRU would at the same
+ * geometry. Their geometries are marked '*' in the tables for reference,
+ * not as the timing model's miss ratios.
+ */
+
+#ifndef _MRC_H_
+#define _MRC_H_
+
+/* shell "mrc": run the program from the start and print its curves; the
+ * machine is reset afterwards */
+void mrc_go();
+
+#endif
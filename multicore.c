@@ -0,0 +1,440 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Multicore simulation with quantum-based host threads and a MESI
+ * directory. See multicore.h for the model.
+ */
+
+#include "multicore.h"
+#include "pipe.h"
+#include "shell.h"
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+_Thread_local Core *this_core;
+_Thread_local Store_Log *core_store_log;
+
+static Core cores[MAX_CORES];
+static int ncores; /* number of cores, fixed once the first run starts */
+
+static pthread_barrier_t quantum_start, quantum_end;
+static pthread_barrier_t cores_attached; /* every core's state published */
+static int quantum_cycles; /* length of the quantum being simulated */
+
+/***************************************************************/
+/* Store logs.                                                 */
+/***************************************************************/
+
+void store_log_init(Store_Log *log, int size)
+{
+    log->table = malloc(size * sizeof(Store_Log_Entry));
+    for (int i = 0; i < size; i++)
+        log->table[i].addr = STORE_LOG_EMPTY;
+    log->size = size;
+    log->count = 0;
+}
+
+static inline int store_log_slot(Store_Log *log, uint32_t address)
+{
+    int i = ((address >> 2) * 2654435761u) & (log->size - 1);
+    while (log->table[i].addr != STORE_LOG_EMPTY && log->table[i].addr != address)
+        i = (i + 1) & (log->size - 1);
+    return i;
+}
+
+uint32_t store_log_read(Store_Log *log, uint32_t address, uint32_t value)
+{
+    if (log->count == 0)
+        return value;
+
+    Store_Log_Entry *e = &log->table[store_log_slot(log, address)];
+    if (e->addr == STORE_LOG_EMPTY)
+        return value;
+    return (value & ~e->mask) | (e->value & e->mask);
+}
+
+void store_log_write(Store_Log *log, uint32_t address, uint32_t value, uint32_t mask)
+{
+    /* keep the table at most half full */
+    if (2 * (log->count + 1) > log->size) {
+        Store_Log grown;
+        store_log_init(&grown, log->size * 2);
+        for (int i = 0; i < log->size; i++) {
+            if (log->table[i].addr == STORE_LOG_EMPTY)
+                continue;
+            grown.table[store_log_slot(&grown, log->table[i].addr)] = log->table[i];
+            grown.count++;
+        }
+        free(log->table);
+        *log = grown;
+    }
+
+    Store_Log_Entry *e = &log->table[store_log_slot(log, address)];
+    if (e->addr == STORE_LOG_EMPTY) {
+        e->addr = address;
+        e->value = 0;
+        e->mask = 0;
+        log->count++;
+    }
+    /* only the bytes this core wrote are published, so that other cores'
+     * stores to the rest of the word are not overwritten */
+    e->value = (e->value & ~mask) | (value & mask);
+    e->mask |= mask;
+}
+
+void store_log_clear(Store_Log *log)
+{
+    for (int i = 0; i < log->size && log->count > 0; i++) {
+        if (log->table[i].addr != STORE_LOG_EMPTY) {
+            log->table[i].addr = STORE_LOG_EMPTY;
+            log->count--;
+        }
+    }
+}
+
+/* apply a core's buffered stores to memory and empty the log */
+static void store_log_flush(Store_Log *log)
+{
+    for (int i = 0; i < log->size && log->count > 0; i++) {
+        Store_Log_Entry *e = &log->table[i];
+        if (e->addr == STORE_LOG_EMPTY)
+            continue;
+        uint32_t val = mem_read_32(e->addr);
+        mem_write_32(e->addr, (val & ~e->mask) | (e->value & e->mask));
+        e->addr = STORE_LOG_EMPTY;
+        log->count--;
+    }
+}
+
+/***************************************************************/
+/* MESI directory.                                             */
+/***************************************************************/
+
+/* directory entry: which cores may hold a data-cache line */
+typedef struct {
+    uint32_t line; /* line address (addr >> 5), DIR_EMPTY if unused */
+    uint16_t sharers;
+} Dir_Entry;
+
+#define DIR_EMPTY 0xFFFFFFFF
+
+static Dir_Entry *directory;
+static int dir_size, dir_count;
+
+static inline int dir_slot(uint32_t line)
+{
+    int i = (line * 2654435761u) & (dir_size - 1);
+    while (directory[i].line != DIR_EMPTY && directory[i].line != line)
+        i = (i + 1) & (dir_size - 1);
+    return i;
+}
+
+static void dir_init(int size)
+{
+    directory = malloc(size * sizeof(Dir_Entry));
+    for (int i = 0; i < size; i++)
+        directory[i].line = DIR_EMPTY;
+    dir_size = size;
+    dir_count = 0;
+}
+
+/* only called between quanta, when no core thread is reading it */
+static Dir_Entry *dir_insert(uint32_t line)
+{
+    if (2 * (dir_count + 1) > dir_size) {
+        Dir_Entry *old = directory;
+        int old_size = dir_size;
+        dir_init(old_size * 2);
+        for (int i = 0; i < old_size; i++) {
+            if (old[i].line == DIR_EMPTY)
+                continue;
+            directory[dir_slot(old[i].line)] = old[i];
+            dir_count++;
+        }
+        free(old);
+    }
+
+    Dir_Entry *d = &directory[dir_slot(line)];
+    if (d->line == DIR_EMPTY) {
+        d->line = line;
+        d->sharers = 0;
+        dir_count++;
+    }
+    return d;
+}
+
+/* does another core hold this line (as of the start of the quantum)? */
+int multicore_line_shared(uint32_t line)
+{
+    Dir_Entry *d = &directory[dir_slot(line)];
+    return d->line != DIR_EMPTY && (d->sharers & ~(1u << this_core->id));
+}
+
+void multicore_record_access(uint32_t line, int write)
+{
+    Core *c = this_core;
+    if (c->naccesses == c->access_cap) {
+        c->access_cap = c->access_cap ? 2 * c->access_cap : 1024;
+        c->accesses = realloc(c->accesses, c->access_cap * sizeof(uint32_t));
+    }
+    c->accesses[c->naccesses++] = (line << 1) | (write ? 1 : 0);
+}
+
+/* way of core c's data cache holding 'line', or -1 */
+static int core_find_line(Core *c, uint32_t line)
+{
+    uint32_t set = line & 0xFF, tag = line >> 8;
+    for (int i = 0; i < 8; i++)
+        if (c->data_cache[set][i].tag == tag && c->data_cache[set][i].recentness != 0)
+            return i;
+    return -1;
+}
+
+/* replay one logged access of core 'id' through the directory */
+static void coherence_access(int id, uint32_t line, int write)
+{
+    Dir_Entry *d = dir_insert(line);
+    uint32_t set = line & 0xFF;
+    int holders = 0;
+
+    for (int o = 0; o < ncores; o++) {
+        if (o == id || !(d->sharers & (1u << o)))
+            continue;
+        Core *c = &cores[o];
+        int way = core_find_line(c, line);
+        if (way < 0) {
+            /* silently evicted since */
+            d->sharers &= ~(1u << o);
+            continue;
+        }
+        if (write) {
+            c->data_cache[set][way].tag = 0;
+            c->data_cache[set][way].recentness = 0;
+            c->data_cache_state[set][way] = MESI_I;
+            c->stat_invalidations++;
+            d->sharers &= ~(1u << o);
+        }
+        else {
+            if (c->data_cache_state[set][way] == MESI_M)
+                c->stat_downgrades++;
+            c->data_cache_state[set][way] = MESI_S;
+            holders++;
+        }
+    }
+
+    d->sharers |= 1u << id;
+    int way = core_find_line(&cores[id], line);
+    if (way >= 0) {
+        if (write)
+            cores[id].data_cache_state[set][way] = MESI_M;
+        else if (holders)
+            cores[id].data_cache_state[set][way] = MESI_S;
+    }
+}
+
+/***************************************************************/
+/* Core threads.                                               */
+/***************************************************************/
+
+/* publish the calling thread's per-core state in 'c' */
+static void core_attach(Core *c)
+{
+    this_core = c;
+    c->pipe = &pipe;
+    c->run_bit = &RUN_BIT;
+    c->stat_cycles = &stat_cycles;
+    c->stat_inst_retire = &stat_inst_retire;
+    c->stat_inst_fetch = &stat_inst_fetch;
+    c->stat_squash = &stat_squash;
+    c->data_cache = data_cache;
+    c->data_cache_state = data_cache_state;
+}
+
+/* architectural state every core starts from: core 0's when the cores are
+ * started or reset */
+static struct {
+    uint32_t regs[32], hi, lo, pc;
+} start_state;
+
+static void save_start_state()
+{
+    memcpy(start_state.regs, pipe.REGS, sizeof(start_state.regs));
+    start_state.hi = pipe.HI;
+    start_state.lo = pipe.LO;
+    start_state.pc = pipe.PC;
+}
+
+static void core_load_start_state(Core *c, Pipe_State *p)
+{
+    memcpy(p->REGS, start_state.regs, sizeof(p->REGS));
+    p->HI = start_state.hi;
+    p->LO = start_state.lo;
+    p->PC = start_state.pc;
+    p->REGS[26] = c->id;
+    p->REGS[27] = ncores;
+}
+
+static void core_run_quantum(Core *c)
+{
+    core_store_log = &c->stores;
+    for (int i = 0; i < quantum_cycles && RUN_BIT; )
+        i += cycle(quantum_cycles - i);
+    core_store_log = NULL;
+}
+
+static void *core_thread(void *arg)
+{
+    Core *c = arg;
+
+    /* start from core 0's architectural state */
+    pipe_init();
+    core_load_start_state(c, &pipe);
+    core_attach(c);
+    pthread_barrier_wait(&cores_attached);
+
+    for (;;) {
+        pthread_barrier_wait(&quantum_start);
+        if (c->reset_pending) {
+            /* the rest was reset by multicore_reset */
+            pipe_reset();
+            core_load_start_state(c, &pipe);
+            c->reset_pending = 0;
+        }
+        core_run_quantum(c);
+        pthread_barrier_wait(&quantum_end);
+    }
+    return NULL;
+}
+
+static void multicore_start()
+{
+    ncores = config.cores;
+    dir_init(4096);
+
+    for (int i = 0; i < ncores; i++) {
+        cores[i].id = i;
+        store_log_init(&cores[i].stores, 1024);
+    }
+
+    /* the main thread simulates core 0 */
+    core_attach(&cores[0]);
+    save_start_state();
+    core_load_start_state(&cores[0], &pipe);
+
+    pthread_barrier_init(&quantum_start, NULL, ncores);
+    pthread_barrier_init(&quantum_end, NULL, ncores);
+    pthread_barrier_init(&cores_attached, NULL, ncores);
+    for (int i = 1; i < ncores; i++) {
+        if (pthread_create(&cores[i].thread, NULL, core_thread, &cores[i]) != 0) {
+            printf("Error: can't create thread for core %d\n", i);
+            exit(-1);
+        }
+    }
+
+    /* cores_running, multicore_reset and multicore_dump read the other
+     * cores' state through the pointers their threads publish */
+    pthread_barrier_wait(&cores_attached);
+}
+
+/* end of quantum: coherence and store logs, in core order */
+static void multicore_merge()
+{
+    for (int i = 0; i < ncores; i++) {
+        Core *c = &cores[i];
+        for (int k = 0; k < c->naccesses; k++)
+            coherence_access(i, c->accesses[k] >> 1, c->accesses[k] & 1);
+        c->naccesses = 0;
+    }
+    for (int i = 0; i < ncores; i++)
+        store_log_flush(&cores[i].stores);
+}
+
+static int cores_running()
+{
+    for (int i = 0; i < ncores; i++)
+        if (*cores[i].run_bit)
+            return 1;
+    return 0;
+}
+
+void multicore_run(int cycles)
+{
+    if (!ncores)
+        multicore_start();
+    else if (config.cores != ncores)
+        printf("Note: running with %d cores (fixed at first run)\n\n", ncores);
+
+    if (!cores_running()) {
+        printf("Can't simulate, Simulator is halted\n\n");
+        return;
+    }
+
+    if (cycles < 0)
+        printf("Simulating...\n\n");
+    else
+        printf("Simulating for %d cycles...\n\n", cycles);
+
+    while (cycles != 0 && cores_running()) {
+        quantum_cycles = config.quantum;
+        if (cycles > 0 && quantum_cycles > cycles)
+            quantum_cycles = cycles;
+
+        pthread_barrier_wait(&quantum_start);
+        core_run_quantum(&cores[0]);
+        pthread_barrier_wait(&quantum_end);
+        multicore_merge();
+
+        if (cycles > 0)
+            cycles -= quantum_cycles;
+    }
+
+    if (!cores_running())
+        printf("Simulator halted\n\n");
+}
+
+void multicore_go()
+{
+    multicore_run(-1);
+}
+
+void multicore_reset()
+{
+    if (!ncores)
+        return;
+
+    /* core 0 (this thread) has been reset and its program reloaded; the
+     * other cores are waiting for the next quantum and reset their
+     * microarchitectural state when it starts */
+    save_start_state();
+    for (int i = 0; i < ncores; i++) {
+        Core *c = &cores[i];
+        core_load_start_state(c, c->pipe);
+        *c->run_bit = TRUE;
+        *c->stat_cycles = *c->stat_inst_retire = *c->stat_inst_fetch = *c->stat_squash = 0;
+        c->naccesses = 0;
+        c->stat_invalidations = c->stat_downgrades = c->stat_upgrades = 0;
+        c->reset_pending = i != 0;
+    }
+
+    for (int i = 0; i < dir_size; i++)
+        directory[i].line = DIR_EMPTY;
+    dir_count = 0;
+}
+
+void multicore_dump()
+{
+    if (!ncores)
+        return;
+
+    for (int i = 0; i < ncores; i++) {
+        Core *c = &cores[i];
+        printf("Core %d: PC: 0x%08x Cycles: %u RetiredInstr: %u IPC: %0.3f Flushes: %u "
+               "Invalidations: %u Downgrades: %u Upgrades: %u\n",
+               i, c->pipe->PC, *c->stat_cycles, *c->stat_inst_retire,
+               *c->stat_cycles ? ((float) *c->stat_inst_retire) / *c->stat_cycles : 0.0,
+               *c->stat_squash, c->stat_invalidations, c->stat_downgrades,
+               c->stat_upgrades);
+    }
+}
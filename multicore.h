@@ -0,0 +1,104 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Multicore simulation: N cores, each with its own pipeline state, L1
+ * caches and branch predictor (the thread-local state in pipe.c/ooo.c),
+ * sharing the simulated memory. Each core runs on its own host thread.
+ *
+ * Cores advance in quanta of config.quantum cycles. During a quantum a core
+ * sees memory as it was at the start of the quantum plus its own stores,
+ * which are buffered in a per-core store log; its data-cache accesses are
+ * logged as well. At the barrier ending the quantum the main thread replays
+ * the access logs through a MESI directory (invalidating or downgrading
+ * other cores' data-cache blocks) and applies the store logs to memory, both
+ * in core order. The result therefore only depends on the quantum length:
+ * shorter quanta are more accurate, longer ones synchronize less often.
+ *
+ * At startup every core gets a copy of core 0's registers and PC, with its
+ * core number in $k0 (R26) and the number of cores in $k1 (R27).
+ */
+
+#ifndef _MULTICORE_H_
+#define _MULTICORE_H_
+
+#include "pipe.h"
+#include <pthread.h>
+
+#define MAX_CORES 16
+
+/* MESI states of data-cache blocks */
+#define MESI_I 0
+#define MESI_S 1
+#define MESI_E 2
+#define MESI_M 3
+
+/* stores buffered by one core during a quantum (open-addressed by word) */
+typedef struct Store_Log_Entry {
+    uint32_t addr;  /* word address, STORE_LOG_EMPTY if unused */
+    uint32_t value; /* bytes written by this core */
+    uint32_t mask;  /* which bytes of the word were written */
+} Store_Log_Entry;
+
+#define STORE_LOG_EMPTY 0xFFFFFFFF
+
+typedef struct Store_Log {
+    Store_Log_Entry *table;
+    int size, count;
+} Store_Log;
+
+typedef struct Core {
+    int id;
+    pthread_t thread;
+
+    /* this core's thread-local state, published by its host thread */
+    Pipe_State *pipe;
+    int *run_bit;
+    uint32_t *stat_cycles, *stat_inst_retire, *stat_inst_fetch, *stat_squash;
+    Cache (*data_cache)[8];
+    uint8_t (*data_cache_state)[8];
+
+    int reset_pending; /* reset the core's state before its next quantum */
+
+    /* what this core did during the current quantum */
+    Store_Log stores;
+    uint32_t *accesses; /* data-cache line address << 1 | is_write */
+    int naccesses, access_cap;
+
+    /* coherence statistics */
+    uint32_t stat_invalidations; /* blocks invalidated by other cores' writes */
+    uint32_t stat_downgrades;    /* modified blocks downgraded by other cores' reads */
+    uint32_t stat_upgrades;      /* writes to shared blocks (treated as misses) */
+} Core;
+
+/* the core simulated by the calling thread (NULL in single-core mode) */
+extern _Thread_local Core *this_core;
+
+/* the calling core's store log while it runs a quantum (NULL otherwise);
+ * mem_read_32/mem_write_32 go through it when set */
+extern _Thread_local Store_Log *core_store_log;
+
+/* run all cores for 'cycles' cycles (-1 = until every core halts) */
+void multicore_run(int cycles);
+void multicore_go();
+
+/* return every core to its startup state after the shell's reset (core
+ * 0's own state has already been reset and its program reloaded) */
+void multicore_reset();
+
+/* print per-core statistics (part of rdump) */
+void multicore_dump();
+
+/* store-log access used by the memory functions (word-aligned addresses) */
+uint32_t store_log_read(Store_Log *log, uint32_t address, uint32_t value);
+void store_log_write(Store_Log *log, uint32_t address, uint32_t value, uint32_t mask);
+
+/* a log of 'size' slots (a power of two; it grows), and emptying one
+ * (parallel.c keeps a log per host thread as well) */
+void store_log_init(Store_Log *log, int size);
+void store_log_clear(Store_Log *log);
+
+/* data-cache hooks used by the memory stage */
+void multicore_record_access(uint32_t line, int write);
+int multicore_line_shared(uint32_t line);
+
+#endif
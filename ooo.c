@@ -0,0 +1,458 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Out-of-order core model.
+ *
+ * Each cycle runs, in reverse pipeline order: retire, complete, issue,
+ * dispatch (rename), then the shared decode and fetch stages. Decoded ops are
+ * taken from pipe.execute_op, renamed into the physical register file and
+ * placed in the reorder buffer and issue queue. Results are computed with
+ * pipe_execute_op() when an op issues and become visible to dependents once
+ * its functional-unit latency has elapsed. Ops retire in order into
+ * pipe.REGS/HI/LO; stores write memory only at retire, and loads see older
+ * in-flight stores by merging them from the load/store queue.
+ */
+
+#include "ooo.h"
+#include "pipe.h"
+#include "shell.h"
+#include "mips.h"
+#include "config.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* data-cache miss latency, same as the in-order memory stage */
+#define OOO_MISS_LATENCY 50
+
+/* global out-of-order core state (one per simulated core) */
+_Thread_local OoO_State ooo;
+
+void ooo_init()
+{
+    memset(&ooo, 0, sizeof(OoO_State));
+
+    /* architectural register i starts out in physical register i */
+    for (int i = 0; i < OOO_NUM_AREGS; i++) {
+        ooo.rat[i] = i;
+        ooo.prf_ready[i] = 1;
+    }
+    for (int i = OOO_NUM_PREGS - 1; i >= OOO_NUM_AREGS; i--)
+        ooo.free_list[ooo.free_count++] = i;
+}
+
+static inline int rob_index(int k)
+{
+    return (ooo.rob_head + k) % OOO_MAX_ROB;
+}
+
+static inline int is_hilo_op(Pipe_Op *op, int subop)
+{
+    return op->opcode == OP_SPECIAL && op->subop == subop;
+}
+
+/* the window is empty, so the committed state in 'pipe' is the only state:
+ * reload it so that edits from the shell ("input", "hi", "lo") are seen */
+static void ooo_sync_arch_state()
+{
+    for (int i = 0; i < 32; i++)
+        ooo.prf[ooo.rat[i]] = pipe.REGS[i];
+    ooo.prf[ooo.rat[OOO_AREG_HI]] = pipe.HI;
+    ooo.prf[ooo.rat[OOO_AREG_LO]] = pipe.LO;
+}
+
+/* undo the youngest ROB entry (rename mappings, queues, op) */
+static void ooo_squash_youngest()
+{
+    int idx = rob_index(ooo.rob_count - 1);
+    OoO_Entry *e = &ooo.rob[idx];
+
+    for (int d = 1; d >= 0; d--) {
+        if (e->arch_dst[d] < 0)
+            continue;
+        ooo.rat[e->arch_dst[d]] = e->old_dst[d];
+        ooo.free_list[ooo.free_count++] = e->dst[d];
+    }
+    if (e->op->is_mem)
+        ooo.lsq_count--;
+
+    free(e->op);
+    e->op = NULL;
+    ooo.rob_count--;
+}
+
+void ooo_reset()
+{
+    while (ooo.rob_count > 0)
+        ooo_squash_youngest();
+    ooo_init();
+}
+
+/* squash every op younger than the ROB entry at 'idx' */
+static void ooo_squash_after(int idx)
+{
+    uint64_t seq = ooo.rob[idx].seq;
+
+    while (ooo.rob_count > 0 && ooo.rob[rob_index(ooo.rob_count - 1)].seq > seq)
+        ooo_squash_youngest();
+
+    int n = 0;
+    for (int i = 0; i < ooo.iq_count; i++)
+        if (ooo.rob[ooo.iq[i]].seq <= seq && ooo.rob[ooo.iq[i]].op)
+            ooo.iq[n++] = ooo.iq[i];
+    ooo.iq_count = n;
+
+    n = 0;
+    for (int i = 0; i < ooo.exec_count; i++)
+        if (ooo.rob[ooo.exec[i]].seq <= seq && ooo.rob[ooo.exec[i]].op)
+            ooo.exec[n++] = ooo.exec[i];
+    ooo.exec_count = n;
+}
+
+static void ooo_retire()
+{
+    for (int n = 0; n < config.commit_width && ooo.rob_count > 0; n++) {
+        OoO_Entry *e = &ooo.rob[ooo.rob_head];
+        Pipe_Op *op = e->op;
+
+        if (!e->done)
+            return;
+
+        /* stores access the data cache and write memory at retire */
+        if (op->is_mem && op->mem_write) {
+            if (!e->store_started) {
+                if (ooo.mem_busy_until > ooo.cycle)
+                    return;
+                e->store_started = 1;
+                e->store_done_cycle = ooo.cycle;
+                if (pipe_dcache_access(op->mem_addr, 1)) {
+                    e->store_done_cycle = ooo.cycle + OOO_MISS_LATENCY;
+                    ooo.mem_busy_until = e->store_done_cycle;
+                }
+            }
+            if (ooo.cycle < e->store_done_cycle)
+                return;
+
+            pipe_mem_store(op);
+        }
+
+        /* write architectural state and release the previous mappings */
+        for (int d = 0; d < 2; d++) {
+            int areg = e->arch_dst[d];
+            if (areg < 0)
+                continue;
+
+            uint32_t val = ooo.prf[e->dst[d]];
+            if (areg == OOO_AREG_HI)
+                pipe.HI = val;
+            else if (areg == OOO_AREG_LO)
+                pipe.LO = val;
+            else
+                pipe.REGS[areg] = val;
+#ifdef DEBUG
+            printf("R%d = %08x\n", areg, val);
+#endif
+            ooo.free_list[ooo.free_count++] = e->old_dst[d];
+        }
+
+        if (op->is_mem) {
+            ooo.lsq_head = (ooo.lsq_head + 1) % OOO_MAX_LSQ;
+            ooo.lsq_count--;
+        }
+
+        ooo.rob_head = (ooo.rob_head + 1) % OOO_MAX_ROB;
+        ooo.rob_count--;
+        stat_inst_retire++;
+        pipe.retire_next_pc = op->branch_taken ? op->branch_dest : op->pc + 4;
+
+        /* if this was a syscall, perform action */
+        int syscall = op->opcode == OP_SPECIAL && op->subop == SUBOP_SYSCALL;
+        int halt = syscall && op->reg_src1_value == SYSCALL_EXIT;
+        int marker = syscall && (op->reg_src1_value == SYSCALL_ROI_BEGIN ||
+                                 op->reg_src1_value == SYSCALL_ROI_END);
+        if (halt)
+            pipe.PC = op->pc + 4;
+        if (marker)
+            pipe.roi_marker = op->reg_src1_value;
+        if (trace_on)
+            trace_retire(op);
+
+        free(op);
+        e->op = NULL;
+
+        if (halt) {
+            RUN_BIT = 0;
+            return;
+        }
+        /* nothing after a marker retires in its cycle, so that a region's
+         * statistics end exactly at it */
+        if (marker)
+            return;
+    }
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+    uint64_t sa = ooo.rob[*(const int *)a].seq;
+    uint64_t sb = ooo.rob[*(const int *)b].seq;
+    return (sa > sb) - (sa < sb);
+}
+
+static void ooo_complete()
+{
+    int done[OOO_MAX_ROB];
+    int ndone = 0, n = 0;
+
+    for (int i = 0; i < ooo.exec_count; i++) {
+        int idx = ooo.exec[i];
+        if (ooo.rob[idx].done_cycle <= ooo.cycle)
+            done[ndone++] = idx;
+        else
+            ooo.exec[n++] = idx;
+    }
+    ooo.exec_count = n;
+
+    /* oldest first, so the oldest mispredicted branch wins */
+    qsort(done, ndone, sizeof(int), compare_seq);
+
+    for (int i = 0; i < ndone; i++) {
+        OoO_Entry *e = &ooo.rob[done[i]];
+        Pipe_Op *op = e->op;
+
+        for (int d = 0; d < 2; d++) {
+            int areg = e->arch_dst[d];
+            if (areg < 0)
+                continue;
+            if (areg == OOO_AREG_HI)
+                ooo.prf[e->dst[d]] = op->hi_value;
+            else if (areg == OOO_AREG_LO)
+                ooo.prf[e->dst[d]] = op->lo_value;
+            else
+                ooo.prf[e->dst[d]] = op->reg_dst_value;
+            ooo.prf_ready[e->dst[d]] = 1;
+        }
+        e->done = 1;
+
+        if (!op->is_branch)
+            continue;
+
+        pipe_update_predictor(op);
+        if (check_flush_pipe(op)) {
+            ooo_squash_after(done[i]);
+            pipe_recover(3, op->branch_taken ? op->branch_dest : op->pc + 4);
+            /* everything completing after this op was just squashed */
+            return;
+        }
+    }
+}
+
+static inline int src_ready(int preg)
+{
+    return preg < 0 || ooo.prf_ready[preg];
+}
+
+/* can the load at ROB index 'idx' issue? All older stores must have
+ * computed their address so that overlaps can be merged. */
+static int load_can_issue(int idx)
+{
+    for (int i = 0; i < ooo.lsq_count; i++) {
+        int k = ooo.lsq[(ooo.lsq_head + i) % OOO_MAX_LSQ];
+        if (k == idx)
+            return 1;
+        OoO_Entry *e = &ooo.rob[k];
+        if (e->op->mem_write && !e->issued)
+            return 0;
+    }
+    return 1;
+}
+
+/* value of the aligned word holding a load's address, as seen by the load:
+ * memory overlaid with every older in-flight store to the same word, oldest
+ * first (covers partial overlaps from SB/SH) */
+static uint32_t load_word(int idx)
+{
+    uint32_t addr = ooo.rob[idx].op->mem_addr & ~3;
+    uint32_t val = mem_read_32(addr);
+
+    for (int i = 0; i < ooo.lsq_count; i++) {
+        int k = ooo.lsq[(ooo.lsq_head + i) % OOO_MAX_LSQ];
+        if (k == idx)
+            break;
+        Pipe_Op *st = ooo.rob[k].op;
+        if (st->mem_write && (st->mem_addr & ~3) == addr)
+            val = pipe_store_merge(st, val);
+    }
+    return val;
+}
+
+static void ooo_issue()
+{
+    int issued = 0, alu_used = 0, ld_used = 0;
+    int n = 0;
+
+    for (int i = 0; i < ooo.iq_count; i++) {
+        int idx = ooo.iq[i];
+        OoO_Entry *e = &ooo.rob[idx];
+        Pipe_Op *op = e->op;
+
+        int ok = issued < config.issue_width &&
+            src_ready(e->src1) && src_ready(e->src2) && src_ready(e->src_hilo);
+        if (ok) {
+            switch (e->fu) {
+                case FU_ALU: ok = alu_used < config.alu_units; break;
+                case FU_MUL:
+                case FU_DIV: ok = pipe_muldiv_free(op, ooo.cycle); break;
+                case FU_LD:
+                    ok = !ld_used && ooo.mem_busy_until <= ooo.cycle &&
+                        load_can_issue(idx);
+                    break;
+            }
+        }
+        if (!ok) {
+            ooo.iq[n++] = idx;
+            continue;
+        }
+
+        /* read sources from the physical register file and execute */
+        op->reg_src1_value = e->src1 >= 0 ? ooo.prf[e->src1] : 0;
+        op->reg_src2_value = e->src2 >= 0 ? ooo.prf[e->src2] : 0;
+        if (e->src_hilo >= 0) {
+            op->hi_value = ooo.prf[e->src_hilo];
+            op->lo_value = ooo.prf[e->src_hilo];
+        }
+        pipe_execute_op(op);
+
+        uint64_t latency = config.alu_latency;
+        switch (e->fu) {
+            case FU_ALU:
+                alu_used++;
+                break;
+            case FU_MUL:
+            case FU_DIV:
+                latency = pipe_muldiv_issue(op, ooo.cycle);
+                break;
+            case FU_LD:
+                ld_used = 1;
+                pipe_load_value(op, load_word(idx));
+                latency = config.load_latency;
+                if (pipe_dcache_access(op->mem_addr, 0)) {
+                    latency = OOO_MISS_LATENCY;
+                    ooo.mem_busy_until = ooo.cycle + latency;
+                }
+                break;
+            case FU_ST:
+                latency = 1;
+                break;
+        }
+
+        e->issued = 1;
+        e->done_cycle = ooo.cycle + latency;
+        ooo.exec[ooo.exec_count++] = idx;
+        issued++;
+    }
+    ooo.iq_count = n;
+}
+
+static int op_fu(Pipe_Op *op)
+{
+    if (op->is_mem)
+        return op->mem_write ? FU_ST : FU_LD;
+    if (is_hilo_op(op, SUBOP_MULT) || is_hilo_op(op, SUBOP_MULTU))
+        return FU_MUL;
+    if (is_hilo_op(op, SUBOP_DIV) || is_hilo_op(op, SUBOP_DIVU))
+        return FU_DIV;
+    return FU_ALU;
+}
+
+static inline int rename_src(int areg)
+{
+    /* R0 reads as zero and is never renamed */
+    return areg > 0 ? ooo.rat[areg] : -1;
+}
+
+static void ooo_dispatch()
+{
+    /* a recovery is pending: the op waiting here is on the wrong path */
+    if (pipe.branch_recover)
+        return;
+
+    Pipe_Op *op = pipe.execute_op;
+    if (!op)
+        return;
+
+    int arch_dst[2] = { -1, -1 };
+    if (op->reg_dst > 0)
+        arch_dst[0] = op->reg_dst;
+    if (is_hilo_op(op, SUBOP_MULT) || is_hilo_op(op, SUBOP_MULTU) ||
+        is_hilo_op(op, SUBOP_DIV) || is_hilo_op(op, SUBOP_DIVU)) {
+        arch_dst[0] = OOO_AREG_HI;
+        arch_dst[1] = OOO_AREG_LO;
+    }
+    else if (is_hilo_op(op, SUBOP_MTHI))
+        arch_dst[0] = OOO_AREG_HI;
+    else if (is_hilo_op(op, SUBOP_MTLO))
+        arch_dst[0] = OOO_AREG_LO;
+
+    /* structural stalls: ROB, issue queue, LSQ, free physical registers */
+    if (ooo.rob_count >= config.rob_size || ooo.iq_count >= config.iq_size)
+        return;
+    if (op->is_mem && ooo.lsq_count >= config.lsq_size)
+        return;
+    if (ooo.free_count < 2)
+        return;
+
+    int idx = rob_index(ooo.rob_count);
+    OoO_Entry *e = &ooo.rob[idx];
+    memset(e, 0, sizeof(OoO_Entry));
+    e->op = op;
+    e->seq = ooo.seq++;
+    e->fu = op_fu(op);
+
+    e->src1 = op->reg_src1 >= 0 ? rename_src(op->reg_src1) : -1;
+    e->src2 = op->reg_src2 >= 0 ? rename_src(op->reg_src2) : -1;
+    e->src_hilo = -1;
+    if (is_hilo_op(op, SUBOP_MFHI))
+        e->src_hilo = ooo.rat[OOO_AREG_HI];
+    else if (is_hilo_op(op, SUBOP_MFLO))
+        e->src_hilo = ooo.rat[OOO_AREG_LO];
+
+    for (int d = 0; d < 2; d++) {
+        e->arch_dst[d] = arch_dst[d];
+        if (arch_dst[d] < 0)
+            continue;
+        int preg = ooo.free_list[--ooo.free_count];
+        ooo.prf_ready[preg] = 0;
+        e->dst[d] = preg;
+        e->old_dst[d] = ooo.rat[arch_dst[d]];
+        ooo.rat[arch_dst[d]] = preg;
+    }
+
+    ooo.rob_count++;
+    ooo.iq[ooo.iq_count++] = idx;
+    if (op->is_mem) {
+        ooo.lsq[(ooo.lsq_head + ooo.lsq_count) % OOO_MAX_LSQ] = idx;
+        ooo.lsq_count++;
+    }
+
+    pipe.execute_op = NULL;
+}
+
+void ooo_cycle()
+{
+    ooo.cycle++;
+
+    if (ooo.rob_count == 0)
+        ooo_sync_arch_state();
+
+    ooo_retire();
+    /* immediately stop once syscall was retired */
+    if (RUN_BIT == 0) return;
+    ooo_complete();
+    ooo_issue();
+    ooo_dispatch();
+    pipe_advance_substages(PIPE_DECODE);
+    pipe_stage_decode();
+    pipe_advance_substages(PIPE_FETCH);
+    pipe_stage_fetch();
+}
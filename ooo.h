@@ -0,0 +1,98 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Out-of-order core model: register renaming, reorder buffer, issue queue
+ * and load/store queue behind the same fetch/decode front end, caches and
+ * branch predictor as the in-order pipeline. Selected with "set core ooo".
+ */
+
+#ifndef _OOO_H_
+#define _OOO_H_
+
+#include "pipe.h"
+
+/* architectural registers that are renamed: 32 GPRs plus HI and LO */
+#define OOO_NUM_AREGS 34
+#define OOO_AREG_HI   32
+#define OOO_AREG_LO   33
+
+/* hard upper bounds on the configurable structure sizes */
+#define OOO_MAX_ROB   256
+#define OOO_MAX_IQ    64
+#define OOO_MAX_LSQ   64
+#define OOO_NUM_PREGS (OOO_NUM_AREGS + 2 * OOO_MAX_ROB)
+
+/* functional unit classes */
+#define FU_ALU 0 /* ALU ops, branches, HI/LO moves, syscall */
+#define FU_MUL 1 /* pipelined multiplier */
+#define FU_DIV 2 /* unpipelined divider */
+#define FU_LD  3 /* loads (one data-cache port) */
+#define FU_ST  4 /* store address/data generation */
+
+/* one in-flight instruction in the reorder buffer */
+typedef struct OoO_Entry {
+    Pipe_Op *op;
+    uint64_t seq;         /* program-order sequence number */
+    int fu;               /* functional unit class */
+
+    /* renamed sources (physical register, or -1 for none) */
+    int src1, src2, src_hilo;
+
+    /* up to two destinations (MULT/DIV write both HI and LO) */
+    int arch_dst[2];      /* architectural register, or -1 */
+    int dst[2];           /* newly allocated physical register */
+    int old_dst[2];       /* previous mapping, freed at retire */
+
+    int issued, done;
+    uint64_t done_cycle;  /* cycle at which the result is available */
+
+    /* stores write memory at retire, paying any data-cache miss then */
+    int store_started;
+    uint64_t store_done_cycle;
+} OoO_Entry;
+
+typedef struct OoO_State {
+    uint64_t cycle, seq;
+
+    /* rename table and physical register file */
+    int rat[OOO_NUM_AREGS];
+    uint32_t prf[OOO_NUM_PREGS];
+    uint8_t prf_ready[OOO_NUM_PREGS];
+    int free_list[OOO_NUM_PREGS];
+    int free_count;
+
+    /* reorder buffer (circular) */
+    OoO_Entry rob[OOO_MAX_ROB];
+    int rob_head, rob_count;
+
+    /* issue queue: ROB indices of waiting ops, oldest first */
+    int iq[OOO_MAX_IQ];
+    int iq_count;
+
+    /* load/store queue: ROB indices of memory ops in program order */
+    int lsq[OOO_MAX_LSQ];
+    int lsq_head, lsq_count;
+
+    /* ROB indices of issued ops that have not completed */
+    int exec[OOO_MAX_ROB];
+    int exec_count;
+
+    /* busy-until cycle of the data-cache port, held by a miss (the
+     * multiply/divide units are shared with the in-order core: see
+     * pipe_muldiv_issue) */
+    uint64_t mem_busy_until;
+} OoO_State;
+
+/* global variable -- out-of-order core state */
+extern _Thread_local OoO_State ooo;
+
+/* reset the out-of-order core (called from pipe_init) */
+void ooo_init();
+
+/* free the ops still in the ROB, then reset (called from pipe_reset) */
+void ooo_reset();
+
+/* simulate one cycle of the out-of-order core (called from pipe_cycle) */
+void ooo_cycle();
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Time-parallel simulation. See parallel.h.
+ */
+
+#include "parallel.h"
+#include "pipe.h"
+#include "shell.h"
+#include "config.h"
+#include "multicore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+
+#define PAGE_WORDS (PAGE_SIZE / 4)
+
+/* architectural state at some point of the functional pass */
+typedef struct Checkpoint {
+    uint32_t regs[32], hi, lo, pc;
+    uint32_t npages;
+    uint32_t *vpages;  /* the pages written so far... */
+    uint32_t **words;  /* ...and their contents (shared with the previous
+                          checkpoint's where unchanged) */
+} Checkpoint;
+
+typedef struct Interval {
+    Checkpoint cp;   /* taken 'warmup' instructions before the interval */
+    uint32_t warmup;
+    uint32_t length; /* instructions (0: to the end of the program) */
+    uint32_t tail;   /* last instructions timed for the next interval's
+                        error estimate (its warm-up's second half) */
+
+    /* results */
+    uint32_t cycles, insts, fetched, flushes;
+    Pipe_Stats stats;
+    uint32_t overlap_cycles; /* second half of the warm-up, from cold */
+    uint32_t tail_cycles;    /* the tail, warm */
+} Interval;
+
+static Interval *intervals;
+static int nintervals, intervals_max;
+
+/* next interval for a worker to take */
+static int next_interval;
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void checkpoint_take(Checkpoint *cp, const Checkpoint *prev)
+{
+    const uint32_t *pages;
+    uint32_t buf[PAGE_WORDS];
+
+    memcpy(cp->regs, pipe.REGS, sizeof(cp->regs));
+    cp->hi = pipe.HI;
+    cp->lo = pipe.LO;
+    cp->pc = pipe.PC;
+
+    cp->npages = mem_dirty_list(&pages);
+    cp->vpages = malloc(cp->npages * sizeof(uint32_t));
+    cp->words = malloc(cp->npages * sizeof(uint32_t *));
+    if (cp->npages && (!cp->vpages || !cp->words)) {
+        printf("Error: out of memory for checkpoints\n");
+        exit(-1);
+    }
+    memcpy(cp->vpages, pages, cp->npages * sizeof(uint32_t));
+
+    /* the list only grows, so page i is the same in the previous one */
+    for (uint32_t i = 0; i < cp->npages; i++) {
+        for (int w = 0; w < PAGE_WORDS; w++)
+            buf[w] = mem_read_32((pages[i] << PAGE_SHIFT) + 4 * w);
+        if (prev && i < prev->npages && memcmp(prev->words[i], buf, PAGE_SIZE) == 0) {
+            cp->words[i] = prev->words[i];
+            continue;
+        }
+        cp->words[i] = malloc(PAGE_SIZE);
+        if (!cp->words[i]) {
+            printf("Error: out of memory for checkpoints\n");
+            exit(-1);
+        }
+        memcpy(cp->words[i], buf, PAGE_SIZE);
+    }
+}
+
+/* free cp's pages, except those it shares with prev (so free the later
+ * checkpoints first) */
+static void checkpoint_free(Checkpoint *cp, const Checkpoint *prev)
+{
+    for (uint32_t i = 0; i < cp->npages; i++)
+        if (!prev || i >= prev->npages || cp->words[i] != prev->words[i])
+            free(cp->words[i]);
+    free(cp->words);
+    free(cp->vpages);
+}
+
+/* functional pass: checkpoint the intervals; returns the instructions
+ * executed */
+static uint64_t parallel_checkpoint(uint32_t interval, uint32_t warmup)
+{
+    uint64_t pos = 0;
+
+    nintervals = 0;
+    for (;;) {
+        uint64_t start = (uint64_t)nintervals * interval;
+        uint64_t at = start > warmup ? start - warmup : 0;
+
+        for (; pos < at && RUN_BIT; pos++)
+            pipe_step(0);
+        if (!RUN_BIT)
+            break;
+
+        if (nintervals == intervals_max) {
+            intervals_max = intervals_max ? 2 * intervals_max : 64;
+            intervals = realloc(intervals, intervals_max * sizeof(Interval));
+            if (!intervals) {
+                printf("Error: out of memory for checkpoints\n");
+                exit(-1);
+            }
+        }
+        Interval *iv = &intervals[nintervals];
+        memset(iv, 0, sizeof(Interval));
+        checkpoint_take(&iv->cp, nintervals ? &intervals[nintervals - 1].cp : NULL);
+        iv->warmup = start - at;
+        iv->length = interval;
+        nintervals++;
+    }
+
+    /* the program may have ended during the last warm-ups */
+    while (nintervals > 1 && (uint64_t)(nintervals - 1) * interval >= pos) {
+        nintervals--;
+        checkpoint_free(&intervals[nintervals].cp, &intervals[nintervals - 1].cp);
+    }
+    intervals[nintervals - 1].length = 0;
+    for (int i = 0; i + 1 < nintervals; i++)
+        if (intervals[i + 1].warmup / 2 <= intervals[i].length)
+            intervals[i].tail = intervals[i + 1].warmup / 2;
+    return pos;
+}
+
+/* simulate until n instructions have retired since the checkpoint */
+static void parallel_run(uint32_t n)
+{
+    while (RUN_BIT && stat_inst_retire < n)
+        cycle(INT_MAX);
+}
+
+static void parallel_simulate(Interval *iv, Store_Log *log)
+{
+    Checkpoint *cp = &iv->cp;
+    Pipe_Stats start;
+    uint32_t half = iv->warmup / 2;
+
+    pipe_reset();
+    memcpy(pipe.REGS, cp->regs, sizeof(pipe.REGS));
+    pipe.HI = cp->hi;
+    pipe.LO = cp->lo;
+    pipe.PC = cp->pc;
+    RUN_BIT = TRUE;
+    stat_cycles = stat_inst_retire = stat_inst_fetch = stat_squash = 0;
+
+    /* memory as at the checkpoint: the words that differ from the image */
+    store_log_clear(log);
+    for (uint32_t i = 0; i < cp->npages; i++) {
+        for (int w = 0; w < PAGE_WORDS; w++) {
+            uint32_t address = (cp->vpages[i] << PAGE_SHIFT) + 4 * w;
+            if (cp->words[i][w] != mem_read_32(address))
+                store_log_write(log, address, cp->words[i][w], 0xFFFFFFFF);
+        }
+    }
+    core_store_log = log;
+
+    parallel_run(iv->warmup - half);
+    uint32_t overlap = stat_cycles;
+    parallel_run(iv->warmup);
+    iv->overlap_cycles = stat_cycles - overlap;
+
+    uint32_t cycles = stat_cycles, insts = stat_inst_retire;
+    uint32_t fetched = stat_inst_fetch, flushes = stat_squash;
+    start = pipe_stats;
+    if (iv->length) {
+        parallel_run(iv->warmup + iv->length - iv->tail);
+        uint32_t tail = stat_cycles;
+        parallel_run(iv->warmup + iv->length);
+        iv->tail_cycles = stat_cycles - tail;
+    } else {
+        parallel_run(UINT32_MAX);
+    }
+    iv->cycles = stat_cycles - cycles;
+    iv->insts = stat_inst_retire - insts;
+    iv->fetched = stat_inst_fetch - fetched;
+    iv->flushes = stat_squash - flushes;
+    memset(&iv->stats, 0, sizeof(Pipe_Stats));
+    pipe_stats_add(&iv->stats, &pipe_stats, &start);
+
+    core_store_log = NULL;
+}
+
+static void *parallel_worker(void *arg)
+{
+    Store_Log log;
+
+    (void)arg;
+    pipe_quiet = 1;
+    pipe_init();
+    store_log_init(&log, 1024);
+    for (;;) {
+        pthread_mutex_lock(&next_lock);
+        int i = next_interval++;
+        pthread_mutex_unlock(&next_lock);
+        if (i >= nintervals)
+            break;
+        parallel_simulate(&intervals[i], &log);
+    }
+    free(log.table);
+    return NULL;
+}
+
+static double seconds_since(struct timespec *t0)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - t0->tv_sec) + (t.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+void parallel_go()
+{
+    int nthreads = config.parallel_threads ? config.parallel_threads : get_nprocs();
+    pthread_t threads[256];
+    struct timespec t0;
+    Checkpoint final;
+
+    if (config.cores > 1) {
+        printf("Time-parallel simulation simulates a single core\n\n");
+        return;
+    }
+
+    reset();
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t insts = parallel_checkpoint(config.parallel_interval, config.parallel_warmup);
+    checkpoint_take(&final, &intervals[nintervals - 1].cp);
+    double functional = seconds_since(&t0);
+
+    /* the workers see the program's image under their checkpoints */
+    reset();
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (nthreads > nintervals)
+        nthreads = nintervals;
+    if (nthreads > 256)
+        nthreads = 256;
+    next_interval = 0;
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, parallel_worker, NULL) != 0) {
+            printf("Error: can't create thread for time-parallel simulation\n");
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    double detailed = seconds_since(&t0);
+
+    /* stitch the intervals together */
+    Pipe_Stats zero;
+    uint64_t cold = 0, warm = 0;
+    memset(&zero, 0, sizeof(zero));
+    for (int i = 0; i < nintervals; i++) {
+        Interval *iv = &intervals[i];
+        stat_cycles += iv->cycles;
+        stat_inst_retire += iv->insts;
+        stat_inst_fetch += iv->fetched;
+        stat_squash += iv->flushes;
+        pipe_stats_add(&pipe_stats, &iv->stats, &zero);
+        if (i > 0 && intervals[i - 1].tail) {
+            cold += iv->overlap_cycles;
+            warm += intervals[i - 1].tail_cycles;
+        }
+    }
+
+    /* and leave the machine as the program ended */
+    memcpy(pipe.REGS, final.regs, sizeof(pipe.REGS));
+    pipe.HI = final.hi;
+    pipe.LO = final.lo;
+    pipe.PC = final.pc;
+    for (uint32_t i = 0; i < final.npages; i++) {
+        for (int w = 0; w < PAGE_WORDS; w++) {
+            uint32_t address = (final.vpages[i] << PAGE_SHIFT) + 4 * w;
+            if (final.words[i][w] != mem_read_32(address))
+                mem_write_32(address, final.words[i][w]);
+        }
+    }
+    RUN_BIT = FALSE;
+
+    printf("Simulated %d intervals of %d instructions (%d warm-up) on %d threads\n",
+           nintervals, config.parallel_interval, config.parallel_warmup, nthreads);
+    printf("  %llu instructions: functional pass %.3f s, detailed %.3f s\n",
+           (unsigned long long)insts, functional, detailed);
+    if (warm > 0)
+        printf("  warm-up error: with half the warm-up, %+lld cycles, %.3f%% of the run "
+               "(second halves: %llu cycles from cold, %llu warm)\n",
+               (long long)cold - (long long)warm, 100.0 * ((double)cold - warm) / stat_cycles,
+               (unsigned long long)cold, (unsigned long long)warm);
+    printf("\n");
+
+    checkpoint_free(&final, &intervals[nintervals - 1].cp);
+    for (int i = nintervals - 1; i >= 0; i--)
+        checkpoint_free(&intervals[i].cp, i ? &intervals[i - 1].cp : NULL);
+    nintervals = 0;
+}
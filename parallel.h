@@ -0,0 +1,34 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Time-parallel simulation. A single run keeps only one host core busy;
+ * here the program is cut into intervals of parallel_interval instructions
+ * that are simulated at the same time:
+ *
+ *   1. a functional pass (pipe_step) runs the program to completion,
+ *      checkpointing its architectural state - registers, and the contents
+ *      of every page written so far - parallel_warmup instructions before
+ *      the start of each interval;
+ *   2. a pool of host threads simulates the intervals in detail, each from
+ *      its checkpoint, with its own pipeline, caches and predictor (the
+ *      thread-local state) and its own view of memory: the program's image
+ *      plus the checkpoint's words, held in a store log like a multicore
+ *      core's stores. The warm-up instructions before the interval only
+ *      warm up the model; the statistics of the interval itself are kept;
+ *   3. the intervals' statistics are added up into the shell's counters,
+ *      and the machine is left in the program's final state, as after "go".
+ *
+ * Every interval starts with cold caches and predictor, so some error
+ * remains after its warm-up. To gauge it, the second half of each warm-up,
+ * which the previous interval also simulated fully warmed, is timed in
+ * both: the difference is the error half the warm-up would have left, an
+ * upper estimate of the real one.
+ */
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+/* shell "parallel": run the program to completion as above */
+void parallel_go();
+
+#endif
@@ -9,11 +9,18 @@
 #include "pipe.h"
 #include "shell.h"
 #include "mips.h"
+#include "config.h"
+#include "ooo.h"
+#include "multicore.h"
+#include "event.h"
+#include "isa.h"
+#include "trace.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
 
 // #define DEBUG
 
@@ -28,26 +35,79 @@ void print_op(Pipe_Op *op)
         printf("(null)\n");
 }
 
-/* global pipeline state */
-Pipe_State pipe;
+/* global pipeline state. Everything that belongs to one core is
+ * thread-local so that each simulated core can run on its own host thread
+ * (see multicore.c); with a single core only the main thread uses it. */
+_Thread_local Pipe_State pipe;
+_Thread_local Pipe_Stats pipe_stats;
 
-Cache instr_cache[64][4];
-Cache data_cache[256][8];
+_Thread_local Cache instr_cache[64][4];
+_Thread_local Cache data_cache[256][8];
+_Thread_local uint8_t data_cache_state[256][8]; /* MESI state per block */
 
-PHT global_pattern[256];
-BTB branch_buffer[1024];
+_Thread_local PHT global_pattern[256];
+_Thread_local BTB branch_buffer[1024];
 
-int cycle_count = 0;
+_Thread_local int cycle_count = 0;
+_Thread_local int pipe_quiet = 0;
 
-uint32_t data_set_number;   //Extract only bits 5 to 12 ( up to 256)
+_Thread_local uint32_t data_set_number;   //Extract only bits 5 to 12 ( up to 256)
 
-uint32_t data_current_tag;  //Extract bits 13 to 31
-uint8_t GHR;
+_Thread_local uint32_t data_current_tag;  //Extract bits 13 to 31
+_Thread_local uint8_t GHR;
+
+_Thread_local uint32_t set_number;
+_Thread_local uint32_t current_tag;
+
+/* a new op with no operands, on a cache line of its own; free() it */
+Pipe_Op *pipe_op_alloc()
+{
+    Pipe_Op *op = aligned_alloc(_Alignof(Pipe_Op), sizeof(Pipe_Op));
+    if (!op) {
+        printf("Error: out of memory for pipeline ops\n");
+        exit(-1);
+    }
+    memset(op, 0, sizeof(Pipe_Op));
+    op->reg_src1 = op->reg_src2 = op->reg_dst = -1;
+    return op;
+}
 
 void pipe_init()
 {
     memset(&pipe, 0, sizeof(Pipe_State));
     pipe.PC = 0x00400000; 
+    event_init();
+    ooo_init();
+}
+
+static void pipe_flush_front_end();
+
+void pipe_reset()
+{
+    /* drop in-flight instructions */
+    free(pipe.decode_op);
+    free(pipe.execute_op);
+    free(pipe.mem_op);
+    free(pipe.wb_op);
+    pipe_flush_front_end();
+    for (int stage = PIPE_FETCH; stage < PIPE_WB; stage++)
+        for (int i = 0; i < PIPE_MAX_SUBSTAGES - 1; i++)
+            free(pipe.substage[stage][i]);
+    ooo_reset();
+
+    /* caches, predictor and the rest of the microarchitectural state */
+    memset(instr_cache, 0, sizeof(instr_cache));
+    memset(data_cache, 0, sizeof(data_cache));
+    memset(data_cache_state, 0, sizeof(data_cache_state));
+    memset(global_pattern, 0, sizeof(global_pattern));
+    memset(branch_buffer, 0, sizeof(branch_buffer));
+    GHR = 0;
+    cycle_count = 0;
+    memset(&pipe_stats, 0, sizeof(pipe_stats));
+    set_number = current_tag = 0;
+    data_set_number = data_current_tag = 0;
+
+    pipe_init();
 }
 
 void pipe_cycle(){
@@ -61,31 +121,224 @@ void pipe_cycle(){
     printf("\n");
 #endif
 
-    if(cycle_count % 100000 == 0){
+    if(cycle_count % 100000 == 0 && !pipe_quiet && (!this_core || this_core->id == 0)){
         printf("===================================\n");
         printf("        Cycle No. %d\n", cycle_count);
         printf("===================================\n");
     }
 
-    pipe_stage_wb();
-    //immediately stop once syscall was written back
-    if(RUN_BIT == 0) return;
-    pipe_stage_mem();
-    pipe_stage_execute();
-    pipe_stage_decode();
-    pipe_stage_fetch();
+    if (config.core == CORE_OOO) {
+        ooo_cycle();
+        if (RUN_BIT == 0) return;
+    }
+    else {
+        pipe_stage_wb();
+        //immediately stop once syscall was written back
+        if(RUN_BIT == 0) return;
+        pipe_advance_substages(PIPE_MEM);
+        pipe_stage_mem();
+        pipe_advance_substages(PIPE_EXECUTE);
+        pipe_stage_execute();
+        pipe_advance_substages(PIPE_DECODE);
+        pipe_stage_decode();
+        pipe_advance_substages(PIPE_FETCH);
+        pipe_stage_fetch();
+    }
+
+    /* complete whatever finishes this cycle: cache fills, multiply/divide
+     * results and branch recoveries */
+    event_run(cycle_count);
+}
+
+static _Bool check_instr_cache_at(uint32_t pc);
+static uint32_t pipe_fetch_pc();
+static void sb_flush();
+static _Bool pipe_hilo_wait(Pipe_Op *op);
+static void scoreboard_move(Pipe_Op *op, int stage);
+static void pipe_resolve_branch(Pipe_Op *op);
+
+/* number of sub-stages 'stage' is split into */
+static int pipe_substages(int stage)
+{
+    switch (stage) {
+        case PIPE_FETCH:   return config.fetch_stages;
+        case PIPE_DECODE:  return config.decode_stages;
+        case PIPE_EXECUTE: return config.execute_stages;
+        case PIPE_MEM:     return config.mem_stages;
+    }
+    return 1;
+}
+
+/* input slot of 'stage' (PIPE_DECODE .. PIPE_WB) */
+static Pipe_Op **pipe_stage_in(int stage)
+{
+    switch (stage) {
+        case PIPE_DECODE:  return &pipe.decode_op;
+        case PIPE_EXECUTE: return &pipe.execute_op;
+        case PIPE_MEM:     return &pipe.mem_op;
+    }
+    return &pipe.wb_op;
+}
+
+/* where 'stage' places the ops it is done with: its second sub-stage, or
+ * the input of the next stage */
+static Pipe_Op **pipe_stage_out(int stage)
+{
+    if (pipe_substages(stage) > 1)
+        return &pipe.substage[stage][0];
+    return pipe_stage_in(stage + 1);
+}
+
+void pipe_advance_substages(int stage)
+{
+    int n = pipe_substages(stage) - 1;
+    Pipe_Op **sub = pipe.substage[stage];
+    Pipe_Op **next = pipe_stage_in(stage + 1);
+
+    if (n <= 0)
+        return;
+
+    if (!*next && sub[n - 1]) {
+        *next = sub[n - 1];
+        sub[n - 1] = NULL;
+        scoreboard_move(*next, stage + 1);
+    }
+    for (int i = n - 1; i > 0; i--) {
+        if (!sub[i] && sub[i - 1]) {
+            sub[i] = sub[i - 1];
+            sub[i - 1] = NULL;
+        }
+    }
+}
+
+static _Bool pipe_substages_busy()
+{
+    for (int stage = PIPE_FETCH; stage < PIPE_WB; stage++)
+        for (int i = 0; i < pipe_substages(stage) - 1; i++)
+            if (pipe.substage[stage][i])
+                return true;
+    return false;
+}
+
+/* a core is idle when no stage can do anything until an event completes:
+ * every op is stalled behind a cache fill or a multiply/divide */
+static _Bool pipe_idle()
+{
+    if (pipe.wb_op || pipe.branch_recover || !RUN_BIT || pipe_substages_busy())
+        return false;
+    if (pipe.mem_op && !pipe.dcache_miss_pending)
+        return false;
+    if (pipe.sb_count && !pipe.sb_drain_pending && !pipe.dcache_miss_pending)
+        return false;
+    if (pipe.execute_op && !*pipe_stage_out(PIPE_EXECUTE)) {
+        if (!pipe_hilo_wait(pipe.execute_op))
+            return false;
+    }
+    if (pipe.decode_op && !*pipe_stage_out(PIPE_DECODE))
+        return false;
+
+    /* decoupled: the predictor waits for a free queue entry, and fetch for
+     * a fill or a free buffer entry */
+    if (config.ftq > 0) {
+        if (pipe.ftq_count < config.ftq)
+            return false;
+        if (pipe.ibuf_count && !*pipe_stage_out(PIPE_FETCH))
+            return false;
+        return pipe.icache_miss_pending || pipe.ibuf_count >= config.ibuf;
+    }
+
+    /* fetch waits for a fill, or for decode with its line present */
+    if (pipe.icache_miss_pending)
+        return true;
+    if (!*pipe_stage_out(PIPE_FETCH))
+        return false;
+    return pipe.icache_filled || !check_instr_cache_at(pipe.PC);
+}
+
+int pipe_skip_idle(int max)
+{
+    if (config.core != CORE_INORDER || max <= 0 || !pipe_idle())
+        return 0;
+
+    /* run up to the cycle in which the next event completes, and don't skip
+     * the cycles that print progress */
+    uint64_t limit = event_next(cycle_count);
+    uint64_t report = (cycle_count / 100000 + 1) * 100000ull;
+    if (report < limit)
+        limit = report;
+    if (limit == EVENT_NONE || limit - cycle_count <= 1)
+        return 0;
+
+    int n = limit - 1 - cycle_count;
+    if (n > max)
+        n = max;
+    cycle_count += n;
+
+    /* the op in execute waited all along */
+    if (pipe.execute_op) {
+        if (*pipe_stage_out(PIPE_EXECUTE))
+            pipe_stats.stall_mem += n;
+        else
+            pipe_stats.stall_hilo += n;
+    }
+
+    /* ... and so did the front end */
+    if (config.ftq > 0) {
+        pipe_stats.ftq_occupancy += (uint64_t)n * pipe.ftq_count;
+        pipe_stats.ibuf_occupancy += (uint64_t)n * pipe.ibuf_count;
+        if (!*pipe_stage_out(PIPE_FETCH) && pipe.icache_miss_pending)
+            pipe_stats.fe_bubble_icache += n;
+    }
+    return n;
+}
+
+/* a producer is flushed: its register reads from the register file again */
+static void scoreboard_forget(Pipe_Op *op)
+{
+    if (op->reg_dst > 0 && pipe.scoreboard[op->reg_dst].producer == op)
+        pipe.scoreboard[op->reg_dst].producer = NULL;
+}
+
+/* a producer has moved on to 'stage'; in writeback its value is there */
+static void scoreboard_move(Pipe_Op *op, int stage)
+{
+    if (op->reg_dst <= 0 || pipe.scoreboard[op->reg_dst].producer != op)
+        return;
+
+    Scoreboard_Entry *e = &pipe.scoreboard[op->reg_dst];
+    e->stage = stage;
+    if (stage == PIPE_WB && e->ready_cycle > (uint64_t)cycle_count)
+        e->ready_cycle = cycle_count;
+}
 
-    /* handle branch recoveries */
+/* end of the cycle in which a recovery was requested */
+static void pipe_recover_done(uint32_t unused)
+{
     if (pipe.branch_recover) {
 #ifdef DEBUG
         printf("branch recovery: new dest %08x flush %d stages\n", pipe.branch_dest, pipe.branch_flush);
 #endif
-        if (pipe.branch_dest != pipe.PC){
-            pipe.instr_stall_count = 0;
-            pipe.instr_stall_state = false;
+        /* fetch is redirected: an instruction-cache fill in progress is
+         * abandoned */
+        if (pipe.branch_dest != pipe_fetch_pc()){
+            pipe.icache_miss_pending = 0;
+            pipe.icache_filled = 0;
+            pipe.icache_gen++;
         }
 
         pipe.PC = pipe.branch_dest;
+        pipe_flush_front_end();
+
+        /* the sub-stages behind the flushed stage inputs */
+        for (int stage = PIPE_FETCH; stage < PIPE_WB && stage < pipe.branch_flush - 1; stage++) {
+            for (int i = 0; i < PIPE_MAX_SUBSTAGES - 1; i++) {
+                Pipe_Op *op = pipe.substage[stage][i];
+                if (!op) continue;
+                scoreboard_forget(op);
+                free(op);
+                pipe.substage[stage][i] = NULL;
+            }
+        }
 
         if (pipe.branch_flush >= 2) {
             if (pipe.decode_op) free(pipe.decode_op);
@@ -98,11 +351,13 @@ void pipe_cycle(){
         }
 
         if (pipe.branch_flush >= 4) {
+            if (pipe.mem_op) scoreboard_forget(pipe.mem_op);
             if (pipe.mem_op) free(pipe.mem_op);
             pipe.mem_op = NULL;
         }
 
         if (pipe.branch_flush >= 5) {
+            if (pipe.wb_op) scoreboard_forget(pipe.wb_op);
             if (pipe.wb_op) free(pipe.wb_op);
             pipe.wb_op = NULL;
         }
@@ -115,6 +370,14 @@ void pipe_cycle(){
     }
 }
 
+int pipe_branch_flush()
+{
+    /* the branch has just left the stage: flush it and everything before */
+    if (config.core == CORE_INORDER && config.branch_stage == BRANCH_DECODE)
+        return 2;
+    return 3;
+}
+
 void pipe_recover(int flush, uint32_t dest)
 {
     /* if there is already a recovery scheduled, it must have come from a later
@@ -126,6 +389,7 @@ void pipe_recover(int flush, uint32_t dest)
     pipe.branch_recover = 1;
     pipe.branch_flush = flush;
     pipe.branch_dest = dest;
+    event_schedule(cycle_count, pipe_recover_done, 0);
 }
 
 void pipe_stage_wb()
@@ -144,16 +408,30 @@ void pipe_stage_wb()
 #ifdef DEBUG
         printf("R%d = %08x\n", op->reg_dst, op->reg_dst_value);
 #endif
+        /* unless a younger op is producing it, the value is in the
+         * register file now */
+        if (pipe.scoreboard[op->reg_dst].producer == op)
+            pipe.scoreboard[op->reg_dst].producer = NULL;
     }
 
     /* if this was a syscall, perform action */
     if (op->opcode == OP_SPECIAL && op->subop == SUBOP_SYSCALL) {
-        if (op->reg_src1_value == 0xA) {
+        if (op->reg_src1_value == SYSCALL_EXIT) {
             pipe.PC = op->pc + 4; /* fetch will do pc += 4, then we stop with correct PC */
             RUN_BIT = 0;
+            /* leave memory complete for the dump */
+            sb_flush();
         }
+        else if (op->reg_src1_value == SYSCALL_ROI_BEGIN || op->reg_src1_value == SYSCALL_ROI_END)
+            pipe.roi_marker = op->reg_src1_value;
     }
 
+    /* where execution goes on after it */
+    pipe.retire_next_pc = op->branch_taken ? op->branch_dest : op->pc + 4;
+
+    if (trace_on)
+        trace_retire(op);
+
     /* free the op */
     free(op);
 
@@ -169,27 +447,57 @@ void update_data_recentness(int i){
     data_cache[data_set_number][i].recentness = 1; //Set that block's recency to 1, and the first slot to 1 (lower = newer)
 }
 
-_Bool check_data_cache(Pipe_Op *op) //Returns true for cache miss or false for cache hit
+_Bool check_data_cache(_Bool write) //Returns true for cache miss or false for cache hit
 {
+    /* multicore: log the access for the coherence directory */
+    if (this_core)
+        multicore_record_access((data_current_tag << 8) | data_set_number, write);
+
     /* Loop through each cache block */
     for (int i = 0; i < 8; i++){
         // printf("Tag in Struct (Data): %d\n", data_cache[data_set_number][i].tag);
         /* see if this cache array postion contains our instruction */
         if (data_cache[data_set_number][i].tag == data_current_tag && data_cache[data_set_number][i].recentness != 0){ // Cache hit
             // printf("Data Cache Hit\n");
+            /* a write to a shared block has to invalidate the other copies
+             * first, which costs as much as a miss */
+            if (write && data_cache_state[data_set_number][i] == MESI_S) {
+                this_core->stat_upgrades++;
+                break;
+            }
+            if (write)
+                data_cache_state[data_set_number][i] = MESI_M;
             return false; //True if stall, false if no stall
         }
     }
-    pipe.data_stall_count = 50;
     return true; //cache miss (stall)
 }
 
-void store_data_cache(Pipe_Op *op){ //Takes in the PC value and store it into the appropriate position
+/* MESI state of a newly filled data-cache block */
+static uint8_t data_fill_state(_Bool write)
+{
+    if (write)
+        return MESI_M;
+    if (this_core && multicore_line_shared((data_current_tag << 8) | data_set_number))
+        return MESI_S;
+    return MESI_E;
+}
+
+void store_data_cache(_Bool write){ //Takes in the PC value and store it into the appropriate position
+    /* Case 0 - upgrade of a shared block that is already present */
+    for (int i = 0; i < 8; i++){
+        if (data_cache[data_set_number][i].tag == data_current_tag && data_cache[data_set_number][i].recentness != 0){
+            data_cache_state[data_set_number][i] = data_fill_state(write);
+            update_data_recentness(i);
+            return;
+        }
+    }
     /* Case 1 - Cache Miss - when there is an empty block, store into the first empty slot (numerical order) for that block*/ 
     for (int i = 0; i < 8; i++){
         if (data_cache[data_set_number][i].tag == 0){ //Empty block exists (tag is empty for that block)
             //store the data and tag into that block, and add recency to it
             data_cache[data_set_number][i].tag = data_current_tag;
+            data_cache_state[data_set_number][i] = data_fill_state(write);
             update_data_recentness(i);
             return;
         }
@@ -206,103 +514,58 @@ void store_data_cache(Pipe_Op *op){ //Takes in the PC value and store it into th
         }
     }
     data_cache[data_set_number][oldest_position].tag = data_current_tag;
+    data_cache_state[data_set_number][oldest_position] = data_fill_state(write);
     update_data_recentness(oldest_position);
     return;
 }
 
-void pipe_stage_mem()
+/* extract a load's destination value from the aligned memory word that
+ * contains its address (sign- or zero-extending sub-word loads) */
+void pipe_load_value(Pipe_Op *op, uint32_t val)
 {
-    /* if there is no instruction in this pipeline stage, we are done */
-    if (!pipe.mem_op)
-        return;
-
-    /* grab the op out of our input slot */
-    Pipe_Op *op = pipe.mem_op;
-
-    /* Instert Stalling Check Algo here =================================================*/
-    data_set_number = (op->mem_addr >> 5) & 0xFF; //Extract only bits 5 to 12 ( up to 256)
-    data_current_tag = (op->mem_addr >> 13); // & 0x1FFFFF; //Extract bits 13 to 31 (19 bits)
-    
-    /* check instr cache stall */
-    if (pipe.data_stall_state == true){
-        pipe.data_stall_count -= 1;
+    op->reg_dst_value_ready = 1;
+    if (op->opcode == OP_LW) {
+        op->reg_dst_value = val;
     }
+    else if (op->opcode == OP_LH || op->opcode == OP_LHU) {
+        if (op->mem_addr & 2)
+            val = (val >> 16) & 0xFFFF;
+        else
+            val = val & 0xFFFF;
 
-    //Only check data cache if this is a load/store op
-    if (pipe.data_stall_state == false && op->is_mem == 1){
-        // Check the set index to look for the set with the current pipe's PC
-        pipe.data_stall_state = check_data_cache(op); // accesses instr cache & store value without implementing delay 
-        //returns false if cache hit, and true for cache miss 
-    }
+        if (op->opcode == OP_LH)
+            val |= (val & 0x8000) ? 0xFFFF8000 : 0;
 
-    if (pipe.data_stall_count == 1){
-        /* This branch would only be entered in the 50th (last stall) cycle */
-        /* Store this pipe.pc into the designated cache block*/ // Might need to store PC from the first cycle if that changes
-        store_data_cache(op);
-    }
-    
-    if (pipe.data_stall_state == true && pipe.data_stall_count != 0){
-        return;
+        op->reg_dst_value = val;
     }
+    else if (op->opcode == OP_LB || op->opcode == OP_LBU) {
+        switch (op->mem_addr & 3) {
+            case 0:
+                val = val & 0xFF;
+                break;
+            case 1:
+                val = (val >> 8) & 0xFF;
+                break;
+            case 2:
+                val = (val >> 16) & 0xFF;
+                break;
+            case 3:
+                val = (val >> 24) & 0xFF;
+                break;
+        }
 
-    if (pipe.data_stall_count == 0){
-        /* Set stall state to false to check the cache again in the next cycle */
-        pipe.data_stall_state = false;
-    }
-    /* ===================================================================== */
+        if (op->opcode == OP_LB)
+            val |= (val & 0x80) ? 0xFFFFFF80 : 0;
 
-    //Loading the data from main memory using the address obtained from the execution stage (mem_addr)
-    uint32_t val = 0;
-    if (op->is_mem)
-        val = mem_read_32(op->mem_addr & ~3);
+        op->reg_dst_value = val;
+    }
+}
 
+/* merge a store's data into the aligned memory word that contains its
+ * address, returning the word to write back */
+uint32_t pipe_store_merge(Pipe_Op *op, uint32_t val)
+{
     switch (op->opcode) {
-        case OP_LW:
-        case OP_LH:
-        case OP_LHU:
-        case OP_LB:
-        case OP_LBU:
-            {
-                /* extract needed value */
-                op->reg_dst_value_ready = 1;
-                if (op->opcode == OP_LW) {
-                    op->reg_dst_value = val;
-                }
-                else if (op->opcode == OP_LH || op->opcode == OP_LHU) {
-                    if (op->mem_addr & 2)
-                        val = (val >> 16) & 0xFFFF;
-                    else
-                        val = val & 0xFFFF;
-
-                    if (op->opcode == OP_LH)
-                        val |= (val & 0x8000) ? 0xFFFF8000 : 0;
-
-                    op->reg_dst_value = val;
-                }
-                else if (op->opcode == OP_LB || op->opcode == OP_LBU) {
-                    switch (op->mem_addr & 3) {
-                        case 0:
-                            val = val & 0xFF;
-                            break;
-                        case 1:
-                            val = (val >> 8) & 0xFF;
-                            break;
-                        case 2:
-                            val = (val >> 16) & 0xFF;
-                            break;
-                        case 3:
-                            val = (val >> 24) & 0xFF;
-                            break;
-                    }
-
-                    if (op->opcode == OP_LB)
-                        val |= (val & 0x80) ? 0xFFFFFF80 : 0;
-
-                    op->reg_dst_value = val;
-                }
-            }
-            break;
-
         case OP_SB:
             switch (op->mem_addr & 3) {
                 case 0: val = (val & 0xFFFFFF00) | ((op->mem_value & 0xFF) << 0); break;
@@ -310,8 +573,6 @@ void pipe_stage_mem()
                 case 2: val = (val & 0xFF00FFFF) | ((op->mem_value & 0xFF) << 16); break;
                 case 3: val = (val & 0x00FFFFFF) | ((op->mem_value & 0xFF) << 24); break;
             }
-
-            mem_write_32(op->mem_addr & ~3, val);
             break;
 
         case OP_SH:
@@ -325,19 +586,306 @@ void pipe_stage_mem()
 #ifdef DEBUG
             printf("new word %08x\n", val);
 #endif
-
-            mem_write_32(op->mem_addr & ~3, val);
             break;
 
         case OP_SW:
             val = op->mem_value;
-            mem_write_32(op->mem_addr & ~3, val);
             break;
     }
+    return val;
+}
+
+/* read the bytes a load accesses, with the access size of its opcode, and
+ * set its destination value */
+void pipe_mem_load(Pipe_Op *op)
+{
+    uint32_t val;
+
+    /* place the bytes in their lanes of the containing word */
+    switch (op->opcode) {
+        case OP_LB:
+        case OP_LBU:
+            val = mem_read_8(op->mem_addr) << (8 * (op->mem_addr & 3));
+            break;
+        case OP_LH:
+        case OP_LHU:
+            val = mem_read_16(op->mem_addr & ~1) << (8 * (op->mem_addr & 2));
+            break;
+        default:
+            val = mem_read_32(op->mem_addr & ~3);
+            break;
+    }
+    pipe_load_value(op, val);
+}
+
+/* write a store's data, with the access size of its opcode */
+void pipe_mem_store(Pipe_Op *op)
+{
+    switch (op->opcode) {
+        case OP_SB:
+            mem_write_8(op->mem_addr, op->mem_value);
+            break;
+        case OP_SH:
+            mem_write_16(op->mem_addr & ~1, op->mem_value);
+            break;
+        case OP_SW:
+            mem_write_32(op->mem_addr & ~3, op->mem_value);
+            break;
+    }
+}
+
+/* bytes of the aligned word a load or store accesses (bit i: byte i) */
+static uint8_t pipe_mem_mask(Pipe_Op *op)
+{
+    switch (op->opcode) {
+        case OP_LB:
+        case OP_LBU:
+        case OP_SB:
+            return 1 << (op->mem_addr & 3);
+        case OP_LH:
+        case OP_LHU:
+        case OP_SH:
+            return 3 << (op->mem_addr & 2);
+    }
+    return 0xF;
+}
+
+/* the bits of a word in the bytes of 'mask' */
+static uint32_t sb_lanes(uint8_t mask)
+{
+    uint32_t lanes = 0;
+    for (int i = 0; i < 4; i++)
+        if (mask & (1 << i))
+            lanes |= 0xFFu << (8 * i);
+    return lanes;
+}
+
+/* a store leaves the memory stage into the youngest entry */
+static void sb_push(Pipe_Op *op)
+{
+    Store_Buffer_Entry *e = &pipe.store_buffer[(pipe.sb_head + pipe.sb_count) % STORE_BUFFER_MAX];
+    e->addr = op->mem_addr & ~3;
+    e->mask = pipe_mem_mask(op);
+    e->data = pipe_store_merge(op, 0) & sb_lanes(e->mask);
+    pipe.sb_count++;
+}
+
+/* the oldest entry writes memory, with the access size of its store */
+static void sb_pop()
+{
+    Store_Buffer_Entry *e = &pipe.store_buffer[pipe.sb_head];
+    switch (e->mask) {
+        case 0xF:
+            mem_write_32(e->addr, e->data);
+            break;
+        case 0x3:
+            mem_write_16(e->addr, e->data);
+            break;
+        case 0xC:
+            mem_write_16(e->addr + 2, e->data >> 16);
+            break;
+        default: {
+            int byte = __builtin_ctz(e->mask);
+            mem_write_8(e->addr + byte, e->data >> (8 * byte));
+            break;
+        }
+    }
+    pipe.sb_head = (pipe.sb_head + 1) % STORE_BUFFER_MAX;
+    pipe.sb_count--;
+}
+
+/* write out every buffered store at once (the program has ended) */
+static void sb_flush()
+{
+    while (pipe.sb_count)
+        sb_pop();
+    pipe.sb_drain_pending = 0;
+}
+
+/* end of the data-cache miss of the oldest buffered store */
+static void sb_fill_done(uint32_t unused)
+{
+    if (!pipe.sb_drain_pending)
+        return;
+
+    Store_Buffer_Entry *e = &pipe.store_buffer[pipe.sb_head];
+    data_set_number = (e->addr >> 5) & 0xFF;
+    data_current_tag = (e->addr >> 13);
+    store_data_cache(1);
+    pipe.sb_drain_pending = 0;
+    sb_pop();
+}
+
+/* the buffer drains in the background, one store per cycle while the
+ * oldest hits in the data cache. A missing store holds the buffer until its
+ * line arrives; the memory stage's own misses go first. */
+static void sb_drain()
+{
+    if (!pipe.sb_count || pipe.sb_drain_pending || pipe.dcache_miss_pending)
+        return;
+
+    Store_Buffer_Entry *e = &pipe.store_buffer[pipe.sb_head];
+    data_set_number = (e->addr >> 5) & 0xFF;
+    data_current_tag = (e->addr >> 13);
+    if (check_data_cache(1)) {
+        pipe.sb_drain_pending = 1;
+        pipe_stats.dcache_miss++;
+        event_schedule(cycle_count + DCACHE_MISS_LATENCY - 1, sb_fill_done, 0);
+        return;
+    }
+    sb_pop();
+}
+
+/* merge the bytes of 'want' in the word at addr that buffered stores
+ * write into *val, the youngest store's first; returns the bytes found */
+static uint8_t sb_forward(uint32_t addr, uint8_t want, uint32_t *val)
+{
+    uint8_t found = 0;
+
+    for (int i = pipe.sb_count - 1; i >= 0 && found != want; i--) {
+        Store_Buffer_Entry *e = &pipe.store_buffer[(pipe.sb_head + i) % STORE_BUFFER_MAX];
+        uint8_t take = e->mask & want & ~found;
+        if (e->addr != addr || !take)
+            continue;
+        uint32_t lanes = sb_lanes(take);
+        *val = (*val & ~lanes) | (e->data & lanes);
+        found |= take;
+    }
+    return found;
+}
+
+/* a load with the store buffer on: bytes of older stores still in the
+ * buffer come from there, even if they cover only part of the load */
+static void sb_load(Pipe_Op *op)
+{
+    uint8_t want = pipe_mem_mask(op);
+    uint32_t val = 0;
+    uint8_t found = sb_forward(op->mem_addr & ~3, want, &val);
+
+    pipe_stats.sb_loads++;
+    if (found == want) {
+        pipe_stats.sb_forward++;
+        pipe_load_value(op, val);
+    }
+    else if (found) {
+        uint32_t lanes = sb_lanes(found);
+        pipe_stats.sb_forward_part++;
+        pipe_load_value(op, (mem_read_32(op->mem_addr & ~3) & ~lanes) | (val & lanes));
+    }
+    else {
+        pipe_mem_load(op);
+    }
+}
+
+/* end of a data-cache miss: install mem_op's line */
+static void dcache_fill_done(uint32_t unused)
+{
+    Pipe_Op *op = pipe.mem_op;
+
+    data_set_number = (op->mem_addr >> 5) & 0xFF;
+    data_current_tag = (op->mem_addr >> 13);
+    store_data_cache(op->mem_write);
+    pipe.dcache_miss_pending = 0;
+    pipe.dcache_filled = 1;
+}
+
+void pipe_stage_mem()
+{
+    /* buffered stores drain whether or not there is an op here */
+    sb_drain();
+
+    /* if there is no instruction in this pipeline stage, we are done */
+    if (!pipe.mem_op)
+        return;
+
+    /* grab the op out of our input slot */
+    Pipe_Op *op = pipe.mem_op;
+
+    /* waiting for the line: the fill event lets us go on */
+    if (pipe.dcache_miss_pending)
+        return;
+
+    /* if downstream stall, return */
+    Pipe_Op **out = pipe_stage_out(PIPE_MEM);
+    if (*out != NULL)
+        return;
+
+    /* with a store buffer, a store needs a free entry rather than its line
+     * (stores also wait while a buffer switched off still drains), and a
+     * load whose bytes are all in the buffer needs no line either */
+    _Bool buffered = config.store_buffer > 0 || pipe.sb_count > 0;
+    _Bool need_line = op->is_mem == 1;
+    if (op->is_mem && buffered) {
+        if (op->mem_write) {
+            if (pipe.sb_count >= config.store_buffer) {
+                pipe_stats.sb_full++;
+                return;
+            }
+            need_line = false;
+        }
+        else {
+            uint32_t val = 0;
+            uint8_t want = pipe_mem_mask(op);
+            need_line = sb_forward(op->mem_addr & ~3, want, &val) != want;
+        }
+    }
+
+    //Only check data cache if this is a load/store op whose line hasn't just been filled
+    if (need_line && !pipe.dcache_filled){
+        data_set_number = (op->mem_addr >> 5) & 0xFF; //Extract only bits 5 to 12 ( up to 256)
+        data_current_tag = (op->mem_addr >> 13); // & 0x1FFFFF; //Extract bits 13 to 31 (19 bits)
+
+        if (check_data_cache(op->mem_write)){
+            /* miss: the line arrives at the end of the 50th cycle of the
+             * stall, and the access is made in the cycle after that */
+            pipe.dcache_miss_pending = 1;
+            pipe.dcache_miss_cycle = cycle_count;
+            pipe_stats.dcache_miss++;
+            event_schedule(cycle_count + DCACHE_MISS_LATENCY - 1, dcache_fill_done, 0);
+            return;
+        }
+    }
+    pipe.dcache_filled = 0;
+
+    //Accessing main memory using the address obtained from the execution stage (mem_addr)
+    if (op->is_mem) {
+        if (op->mem_write && buffered)
+            sb_push(op);
+        else if (op->mem_write)
+            pipe_mem_store(op);
+        else if (buffered)
+            sb_load(op);
+        else
+            pipe_mem_load(op);
+    }
+
+    /* a load's data comes out of the last memory sub-stage */
+    if (op->reg_dst > 0 && pipe.scoreboard[op->reg_dst].producer == op) {
+        Scoreboard_Entry *e = &pipe.scoreboard[op->reg_dst];
+        uint64_t ready = (uint64_t)cycle_count + config.mem_stages - 1;
+        if (e->ready_cycle > ready)
+            e->ready_cycle = ready;
+    }
 
     /* clear stage input and transfer to next stage */
     pipe.mem_op = NULL;
-    pipe.wb_op = op;
+    *out = op;
+    scoreboard_move(op, out == &pipe.wb_op ? PIPE_WB : PIPE_MEM);
+}
+
+/* probe the data cache for addr and fill the line on a miss right away.
+ * Returns true on a miss. Core models that keep their own miss timing use
+ * this instead of the mem stage. */
+_Bool pipe_dcache_access(uint32_t addr, _Bool write)
+{
+    data_set_number = (addr >> 5) & 0xFF;
+    data_current_tag = (addr >> 13);
+    _Bool miss = check_data_cache(write);
+    if (miss) {
+        store_data_cache(write);
+        pipe_stats.dcache_miss++;
+    }
+    return miss;
 }
 
 void update_BTB(uint32_t PC, Pipe_Op *op){
@@ -371,340 +919,318 @@ _Bool check_flush_pipe(Pipe_Op *op){ //if true, flush
     return false;
 }
 
-void pipe_stage_execute()
+/* train the PHT, GHR and BTB with a resolved branch */
+void pipe_update_predictor(Pipe_Op *op)
 {
-    /* if a multiply/divide is in progress, decrement cycles until value is ready */
-    if (pipe.multiplier_stall > 0)
-        pipe.multiplier_stall--;
-
-    /* if downstream stall, return (and leave any input we had) */
-    if (pipe.mem_op != NULL)
-        return;
-
-    /* if no op to execute, return */
-    if (pipe.execute_op == NULL)
-        return;
-
-    /* grab op and read sources */
-    Pipe_Op *op = pipe.execute_op;
-
-    /* read register values, and check for bypass; stall if necessary */
-    int stall = 0;
-    if (op->reg_src1 != -1) {
-        if (op->reg_src1 == 0)
-            op->reg_src1_value = 0;
-        else if (pipe.mem_op && pipe.mem_op->reg_dst == op->reg_src1) {
-            if (!pipe.mem_op->reg_dst_value_ready)
-                stall = 1;
-            else
-                op->reg_src1_value = pipe.mem_op->reg_dst_value;
-        }
-        else if (pipe.wb_op && pipe.wb_op->reg_dst == op->reg_src1) {
-            op->reg_src1_value = pipe.wb_op->reg_dst_value;
-        }
-        else
-            op->reg_src1_value = pipe.REGS[op->reg_src1];
-    }
-    if (op->reg_src2 != -1) {
-        if (op->reg_src2 == 0)
-            op->reg_src2_value = 0;
-        else if (pipe.mem_op && pipe.mem_op->reg_dst == op->reg_src2) {
-            if (!pipe.mem_op->reg_dst_value_ready)
-                stall = 1;
-            else
-                op->reg_src2_value = pipe.mem_op->reg_dst_value;
+    /* Update Branch Prediction*/
+    if (op->branch_cond == true){
+    /* 1. Updating PHT*/
+        if (op->branch_taken == 1 && global_pattern[op->pattern_index].PHT_entry < 3){
+            global_pattern[op->pattern_index].PHT_entry += 1;
         }
-        else if (pipe.wb_op && pipe.wb_op->reg_dst == op->reg_src2) {
-            op->reg_src2_value = pipe.wb_op->reg_dst_value;
+        if (op->branch_taken == 0 && global_pattern[op->pattern_index].PHT_entry > 0){
+            global_pattern[op->pattern_index].PHT_entry -= 1;
         }
-        else
-            op->reg_src2_value = pipe.REGS[op->reg_src2];
+    /* 2. Updating GHR */
+        GHR = (GHR << 1) | op->branch_taken;
     }
 
-    /* if bypassing requires a stall (e.g. use immediately after load),
-     * return without clearing stage input */
-    if (stall) 
-        return;
+    if (op->is_branch){
+    /* 3. Updating BTB */
+        update_BTB(pipe.PC, op);
+    }
+}
 
-    /* execute the op */
-    switch (op->opcode) {
-        case OP_SPECIAL:
-            op->reg_dst_value_ready = 1;
-            switch (op->subop) {
-                case SUBOP_SLL:
-                    op->reg_dst_value = op->reg_src2_value << op->shamt;
-                    break;
-                case SUBOP_SLLV:
-                    op->reg_dst_value = op->reg_src2_value << op->reg_src1_value;
-                    break;
-                case SUBOP_SRL:
-                    op->reg_dst_value = op->reg_src2_value >> op->shamt;
-                    break;
-                case SUBOP_SRLV:
-                    op->reg_dst_value = op->reg_src2_value >> op->reg_src1_value;
-                    break;
-                case SUBOP_SRA:
-                    op->reg_dst_value = (int32_t)op->reg_src2_value >> op->shamt;
-                    break;
-                case SUBOP_SRAV:
-                    op->reg_dst_value = (int32_t)op->reg_src2_value >> op->reg_src1_value;
-                    break;
-                case SUBOP_JR:
-                case SUBOP_JALR:
-                    op->reg_dst_value = op->pc + 4;
-                    op->branch_dest = op->reg_src1_value;
-                    op->branch_taken = 1;
-                    break;
-
-                case SUBOP_MULT:
-                    {
-                        /* we set a result value right away; however, we will
-                         * model a stall if the program tries to read the value
-                         * before it's ready (or overwrite HI/LO). Also, if
-                         * another multiply comes down the pipe later, it will
-                         * update the values and re-set the stall cycle count
-                         * for a new operation.
-                         */
-                        int64_t val = (int64_t)((int32_t)op->reg_src1_value) * (int64_t)((int32_t)op->reg_src2_value);
-                        uint64_t uval = (uint64_t)val;
-                        pipe.HI = (uval >> 32) & 0xFFFFFFFF;
-                        pipe.LO = (uval >>  0) & 0xFFFFFFFF;
-
-                        /* four-cycle multiplier latency */
-                        pipe.multiplier_stall = 4;
-                    }
-                    break;
-                case SUBOP_MULTU:
-                    {
-                        uint64_t val = (uint64_t)op->reg_src1_value * (uint64_t)op->reg_src2_value;
-                        pipe.HI = (val >> 32) & 0xFFFFFFFF;
-                        pipe.LO = (val >>  0) & 0xFFFFFFFF;
-
-                        /* four-cycle multiplier latency */
-                        pipe.multiplier_stall = 4;
-                    }
-                    break;
-
-                case SUBOP_DIV:
-                    if (op->reg_src2_value != 0) {
-
-                        int32_t val1 = (int32_t)op->reg_src1_value;
-                        int32_t val2 = (int32_t)op->reg_src2_value;
-                        int32_t div, mod;
-
-                        div = val1 / val2;
-                        mod = val1 % val2;
-
-                        pipe.LO = div;
-                        pipe.HI = mod;
-                    } else {
-                        // really this would be a div-by-0 exception
-                        pipe.HI = pipe.LO = 0;
-                    }
-
-                    /* 32-cycle divider latency */
-                    pipe.multiplier_stall = 32;
-                    break;
-
-                case SUBOP_DIVU:
-                    if (op->reg_src2_value != 0) {
-                        pipe.HI = (uint32_t)op->reg_src1_value % (uint32_t)op->reg_src2_value;
-                        pipe.LO = (uint32_t)op->reg_src1_value / (uint32_t)op->reg_src2_value;
-                    } else {
-                        /* really this would be a div-by-0 exception */
-                        pipe.HI = pipe.LO = 0;
-                    }
-
-                    /* 32-cycle divider latency */
-                    pipe.multiplier_stall = 32;
-                    break;
-
-                case SUBOP_MFHI:
-                    /* stall until value is ready */
-                    if (pipe.multiplier_stall > 0)
-                        return;
-
-                    op->reg_dst_value = pipe.HI;
-                    break;
-                case SUBOP_MTHI:
-                    /* stall to respect WAW dependence */
-                    if (pipe.multiplier_stall > 0)
-                        return;
-
-                    pipe.HI = op->reg_src1_value;
-                    break;
-
-                case SUBOP_MFLO:
-                    /* stall until value is ready */
-                    if (pipe.multiplier_stall > 0)
-                        return;
-
-                    op->reg_dst_value = pipe.LO;
-                    break;
-                case SUBOP_MTLO:
-                    /* stall to respect WAW dependence */
-                    if (pipe.multiplier_stall > 0)
-                        return;
-
-                    pipe.LO = op->reg_src1_value;
-                    break;
-
-                case SUBOP_ADD:
-                case SUBOP_ADDU:
-                    op->reg_dst_value = op->reg_src1_value + op->reg_src2_value;
-                    break;
-                case SUBOP_SUB:
-                case SUBOP_SUBU:
-                    op->reg_dst_value = op->reg_src1_value - op->reg_src2_value;
-                    break;
-                case SUBOP_AND:
-                    op->reg_dst_value = op->reg_src1_value & op->reg_src2_value;
-                    break;
-                case SUBOP_OR:
-                    op->reg_dst_value = op->reg_src1_value | op->reg_src2_value;
-                    break;
-                case SUBOP_NOR:
-                    op->reg_dst_value = ~(op->reg_src1_value | op->reg_src2_value);
-                    break;
-                case SUBOP_XOR:
-                    op->reg_dst_value = op->reg_src1_value ^ op->reg_src2_value;
-                    break;
-                case SUBOP_SLT:
-                    op->reg_dst_value = ((int32_t)op->reg_src1_value <
-                            (int32_t)op->reg_src2_value) ? 1 : 0;
-                    break;
-                case SUBOP_SLTU:
-                    op->reg_dst_value = (op->reg_src1_value < op->reg_src2_value) ? 1 : 0;
-                    break;
-            }
-            break;
+/* how a source operand reaches execute (pipe_read_source) */
+#define READ_REGFILE    0
+#define READ_BYPASS_EX  1
+#define READ_BYPASS_MEM 2
+#define READ_BYPASS_WB  3
+#define READ_WAIT_LOAD  4 /* hazard: a load hasn't got its data yet */
+#define READ_WAIT_DATA  5 /* hazard: another op is still computing it */
+#define READ_WAIT_PATH  6 /* hazard: it has, but there is no bypass path */
+
+/* read source register 'reg' (-1 for none) into 'value' for the op in
+ * execute: from the register file if no result for it is in flight,
+ * otherwise forwarded from its producer if that is allowed yet */
+static int pipe_read_source(int reg, uint32_t *value)
+{
+    if (reg == -1)
+        return READ_REGFILE;
+    if (reg == 0) {
+        *value = 0;
+        return READ_REGFILE;
+    }
 
-        case OP_BRSPEC:
-            switch (op->subop) {
-                case BROP_BLTZ:
-                case BROP_BLTZAL:
-                    if ((int32_t)op->reg_src1_value < 0) op->branch_taken = 1;
-                    break;
-
-                case BROP_BGEZ:
-                case BROP_BGEZAL:
-                    if ((int32_t)op->reg_src1_value >= 0) op->branch_taken = 1;
-                    break;
-            }
-            break;
+    Scoreboard_Entry *e = &pipe.scoreboard[reg];
+    if (!e->producer) {
+        *value = pipe.REGS[reg];
+        return READ_REGFILE;
+    }
+    if (e->ready_cycle > (uint64_t)cycle_count)
+        return e->producer->is_mem ? READ_WAIT_LOAD : READ_WAIT_DATA;
+    int path = e->stage == PIPE_EXECUTE ? READ_BYPASS_EX :
+               e->stage == PIPE_MEM ? READ_BYPASS_MEM : READ_BYPASS_WB;
+    if ((path == READ_BYPASS_EX && !config.bypass_ex) ||
+        (path == READ_BYPASS_MEM && !config.bypass_mem) ||
+        (path == READ_BYPASS_WB && !config.bypass_wb))
+        return READ_WAIT_PATH;
+
+    *value = e->producer->reg_dst_value;
+    return path;
+}
 
-        case OP_BEQ:
-            if (op->reg_src1_value == op->reg_src2_value) op->branch_taken = 1;
-            break;
+static void pipe_count_stall(int read)
+{
+    if (read == READ_WAIT_LOAD)
+        pipe_stats.stall_load_use++;
+    else if (read == READ_WAIT_DATA)
+        pipe_stats.stall_data++;
+    else
+        pipe_stats.stall_no_bypass++;
+}
 
-        case OP_BNE:
-            if (op->reg_src1_value != op->reg_src2_value) op->branch_taken = 1;
-            break;
+static void pipe_count_bypass(int read)
+{
+    if (read == READ_BYPASS_EX)
+        pipe_stats.bypass_ex++;
+    else if (read == READ_BYPASS_MEM)
+        pipe_stats.bypass_mem++;
+    else if (read == READ_BYPASS_WB)
+        pipe_stats.bypass_wb++;
+}
 
-        case OP_BLEZ:
-            if ((int32_t)op->reg_src1_value <= 0) op->branch_taken = 1;
-            break;
+/* does this op move to or from HI/LO while a multiply/divide is busy? */
+static _Bool pipe_hilo_wait(Pipe_Op *op)
+{
+    return op->opcode == OP_SPECIAL && pipe.hilo_busy &&
+            (op->subop == SUBOP_MFHI || op->subop == SUBOP_MTHI ||
+             op->subop == SUBOP_MFLO || op->subop == SUBOP_MTLO);
+}
 
-        case OP_BGTZ:
-            if ((int32_t)op->reg_src1_value > 0) op->branch_taken = 1;
-            break;
+/* end of a multiply/divide latency */
+static void hilo_ready(uint32_t gen)
+{
+    if (gen == pipe.hilo_gen)
+        pipe.hilo_busy = 0;
+}
 
-        case OP_ADDI:
-        case OP_ADDIU:
-            op->reg_dst_value_ready = 1;
-            op->reg_dst_value = op->reg_src1_value + op->se_imm16;
-            break;
-        case OP_SLTI:
-            op->reg_dst_value_ready = 1;
-            op->reg_dst_value = (int32_t)op->reg_src1_value < (int32_t)op->se_imm16 ? 1 : 0;
-            break;
-        case OP_SLTIU:
-            op->reg_dst_value_ready = 1;
-            op->reg_dst_value = (uint32_t)op->reg_src1_value < (uint32_t)op->se_imm16 ? 1 : 0;
-            break;
-        case OP_ANDI:
-            op->reg_dst_value_ready = 1;
-            op->reg_dst_value = op->reg_src1_value & op->imm16;
-            break;
-        case OP_ORI:
-            op->reg_dst_value_ready = 1;
-            op->reg_dst_value = op->reg_src1_value | op->imm16;
-            break;
-        case OP_XORI:
-            op->reg_dst_value_ready = 1;
-            op->reg_dst_value = op->reg_src1_value ^ op->imm16;
-            break;
-        case OP_LUI:
-            op->reg_dst_value_ready = 1;
-            op->reg_dst_value = op->imm16 << 16;
-            break;
+static _Bool pipe_is_muldiv(Pipe_Op *op)
+{
+    return op->opcode == OP_SPECIAL &&
+            (op->subop == SUBOP_MULT || op->subop == SUBOP_MULTU ||
+             op->subop == SUBOP_DIV || op->subop == SUBOP_DIVU);
+}
 
-        case OP_LW:
-        case OP_LH:
-        case OP_LHU:
-        case OP_LB:
-        case OP_LBU:
-            op->mem_addr = op->reg_src1_value + op->se_imm16;
-            break;
+static _Bool pipe_is_div(Pipe_Op *op)
+{
+    return op->subop == SUBOP_DIV || op->subop == SUBOP_DIVU;
+}
 
-        case OP_SW:
-        case OP_SH:
-        case OP_SB:
-            op->mem_addr = op->reg_src1_value + op->se_imm16;
-            op->mem_value = op->reg_src2_value;
-            break;
+/* cycles until HI/LO hold a multiply/divide's result. div_latency is for a
+ * full 32-bit quotient; an early-terminating divider produces the quotient
+ * bits at the same rate but only as many as the operands call for. */
+static int pipe_muldiv_latency(Pipe_Op *op)
+{
+    if (!pipe_is_div(op))
+        return config.mul_latency;
+
+    uint32_t a = op->reg_src1_value, b = op->reg_src2_value;
+    if (!config.div_early || b == 0)
+        return config.div_latency;
+    if (op->subop == SUBOP_DIV) {
+        if ((int32_t)a < 0) a = -a;
+        if ((int32_t)b < 0) b = -b;
     }
 
-    /* Update Branch Prediction*/
-    if (op->branch_cond == true){
-    /* 1. Updating PHT*/
-        if (op->branch_taken == 1 && global_pattern[op->pattern_index].PHT_entry < 3){
-            global_pattern[op->pattern_index].PHT_entry += 1;
-        }
-        if (op->branch_taken == 0 && global_pattern[op->pattern_index].PHT_entry > 0){
-            global_pattern[op->pattern_index].PHT_entry -= 1;
-        }
-    /* 2. Updating GHR */
-        GHR = (GHR << 1) | op->branch_taken;
+    /* quotient bits: how far the divisor's top bit is below the dividend's */
+    int bits = a ? __builtin_clz(b) - __builtin_clz(a) + 1 : 1;
+    if (bits < 1)
+        bits = 1;
+    return (config.div_latency * bits + 31) / 32;
+}
+
+_Bool pipe_muldiv_free(Pipe_Op *op, uint64_t now)
+{
+    _Bool div = pipe_is_div(op);
+    uint64_t *free_at = div ? pipe.div_free : pipe.mul_free;
+    int units = div ? config.div_units : config.mul_units;
+
+    for (int i = 0; i < units; i++)
+        if (free_at[i] <= now)
+            return true;
+    return false;
+}
+
+int pipe_muldiv_issue(Pipe_Op *op, uint64_t now)
+{
+    _Bool div = pipe_is_div(op);
+    uint64_t *free_at = div ? pipe.div_free : pipe.mul_free;
+    int units = div ? config.div_units : config.mul_units;
+    int interval = div ? config.div_interval : config.mul_interval;
+    int latency = pipe_muldiv_latency(op);
+
+    /* the unit that has been free longest */
+    int u = 0;
+    for (int i = 1; i < units; i++)
+        if (free_at[i] < free_at[u])
+            u = i;
+
+    /* a unit is busy for its initiation interval, or until an op that ends
+     * early is done */
+    free_at[u] = now + (interval < latency ? interval : latency);
+    return latency;
+}
+
+void pipe_stage_execute()
+{
+    /* if downstream stall, return (and leave any input we had) */
+    Pipe_Op **out = pipe_stage_out(PIPE_EXECUTE);
+    if (*out != NULL) {
+        if (pipe.execute_op)
+            pipe_stats.stall_mem++;
+        return;
     }
 
-    if (op->is_branch){
-    /* 3. Updating BTB */
-        update_BTB(pipe.PC, op);
+    /* if no op to execute, return */
+    if (pipe.execute_op == NULL)
+        return;
+
+    /* grab op and read sources */
+    Pipe_Op *op = pipe.execute_op;
+
+    /* read register values through the scoreboard; stall if necessary */
+    int src1 = pipe_read_source(op->reg_src1, &op->reg_src1_value);
+    int src2 = pipe_read_source(op->reg_src2, &op->reg_src2_value);
+
+    /* if bypassing requires a stall (e.g. use immediately after load),
+     * return without clearing stage input */
+    if (src1 >= READ_WAIT_LOAD || src2 >= READ_WAIT_LOAD) {
+        pipe_count_stall(src1 >= READ_WAIT_LOAD ? src1 : src2);
+        return;
+    }
+
+    /* HI/LO moves must wait for an outstanding multiply/divide: a read
+     * until the value is ready, a write to respect the WAW dependence */
+    if (pipe_hilo_wait(op)) {
+        pipe_stats.stall_hilo++;
+        return;
+    }
+
+    /* with multiply/divide units, a multiply or divide needs one that can
+     * take it this cycle */
+    _Bool units = config.muldiv == MULDIV_UNITS && pipe_is_muldiv(op);
+    if (units && !pipe_muldiv_free(op, cycle_count)) {
+        pipe_stats.stall_unit++;
+        return;
+    }
+
+    pipe_count_bypass(src1);
+    pipe_count_bypass(src2);
+
+    /* execute the op */
+    op->hi_value = pipe.HI;
+    op->lo_value = pipe.LO;
+    pipe_execute_op(op);
+    pipe.HI = op->hi_value;
+    pipe.LO = op->lo_value;
+
+    /* we set a result value right away; however, we will model a stall if
+     * the program tries to read the value before it's ready (or overwrite
+     * HI/LO). With the restart timing, if another multiply comes down the
+     * pipe later, it will update the values and restart the latency for a
+     * new operation (the completion event of the old one becomes stale).
+     * With units, results reach HI/LO in program order: one that is done
+     * early still waits for an older, slower one.
+     */
+    if (pipe_is_muldiv(op)) {
+        int latency = units ? pipe_muldiv_issue(op, cycle_count) : pipe_muldiv_latency(op);
+        uint64_t ready = (uint64_t)cycle_count + latency;
+        if (units && pipe.hilo_busy && pipe.hilo_ready_cycle > ready)
+            ready = pipe.hilo_ready_cycle;
+
+        pipe.hilo_busy = 1;
+        pipe.hilo_gen++;
+        pipe.hilo_ready_cycle = ready;
+        /* HI/LO can be read from the 'latency'th cycle on */
+        event_schedule(ready - 1, hilo_ready, pipe.hilo_gen);
+    }
+
+    /* resolve branches here unless decode has done it already */
+    if (pipe_branch_flush() == 3)
+        pipe_resolve_branch(op);
+
+    /* the result is in flight from now on: it comes out of the last
+     * execute sub-stage, unless this is a load */
+    if (op->reg_dst > 0) {
+        Scoreboard_Entry *e = &pipe.scoreboard[op->reg_dst];
+        e->producer = op;
+        e->stage = out == &pipe.mem_op ? PIPE_MEM : PIPE_EXECUTE;
+        e->ready_cycle = op->reg_dst_value_ready ? (uint64_t)cycle_count + config.execute_stages : SCOREBOARD_NOT_READY;
     }
 
+    /* remove from upstream stage and place in downstream stage */
+    pipe.execute_op = NULL;
+    *out = op;
+}
+
+/* train the predictor with a branch whose outcome is known (any other op is
+ * ignored), and recover from a misprediction */
+static void pipe_resolve_branch(Pipe_Op *op)
+{
+    pipe_update_predictor(op);
+
     /* handle branch recoveries at this point */
     _Bool check_flush_return = check_flush_pipe(op);
-    if (pipe.decode_op != 0){
-        Pipe_Op *temp_pointer = pipe.decode_op;
-        if(check_flush_return && pipe.instr_stall_state &&
-            op->branch_dest == temp_pointer->pc){
-            
-            //backup stall count
-            uint32_t instr_stall_cbackup = pipe.instr_stall_count;
-            pipe_recover(3, op->branch_dest);
-            pipe.instr_stall_count = instr_stall_cbackup;
-            pipe.instr_stall_state = true;
-        }
-    }
+    /* (an instruction-cache fill for the op already at the destination
+     * carries on: pipe_recover_done only abandons fills that fetch is
+     * redirected away from) */
     if(check_flush_return && op->branch_taken){
-        //Actually flusing 3 stages
-        pipe_recover(3, op->branch_dest);
+        //Actually flusing the stages up to this one
+        pipe_recover(pipe_branch_flush(), op->branch_dest);
     }
     else if(check_flush_return && !op->branch_taken)
     {
-        pipe_recover(3, op->pc + 4);
+        pipe_recover(pipe_branch_flush(), op->pc + 4);
     }
+}
 
-    /* remove from upstream stage and place in downstream stage */
-    pipe.execute_op = NULL;
-    pipe.mem_op = op;
+/* does an op that has been decoded but not executed write 'reg'? Such ops
+ * are not in the scoreboard yet. */
+static _Bool pipe_unexecuted_write(int reg)
+{
+    if (reg <= 0)
+        return false;
+    if (pipe.execute_op && pipe.execute_op->reg_dst == reg)
+        return true;
+    for (int i = 0; i < config.decode_stages - 1; i++)
+        if (pipe.substage[PIPE_DECODE][i] && pipe.substage[PIPE_DECODE][i]->reg_dst == reg)
+            return true;
+    return false;
+}
+
+/* resolve a branch in decode if its sources are available; returns false
+ * if it has to wait */
+static _Bool pipe_decode_resolve(Pipe_Op *op)
+{
+    if (pipe_unexecuted_write(op->reg_src1) || pipe_unexecuted_write(op->reg_src2))
+        return false;
+    if (pipe_read_source(op->reg_src1, &op->reg_src1_value) >= READ_WAIT_LOAD ||
+        pipe_read_source(op->reg_src2, &op->reg_src2_value) >= READ_WAIT_LOAD)
+        return false;
+
+    /* only the branch outcome (and link value) is computed here; execute
+     * computes the same again from the same sources */
+    pipe_execute_op(op);
+    pipe_resolve_branch(op);
+    return true;
 }
 
 void pipe_stage_decode()
 {
     /* if downstream stall, return (and leave any input we had) */
-    if (pipe.execute_op != NULL) // if the address pointed to by the pointer is NOT empty (it is still pointing to sth), return
+    Pipe_Op **out = pipe_stage_out(PIPE_DECODE);
+    if (*out != NULL) // if the address pointed to by the pointer is NOT empty (it is still pointing to sth), return
         return;
 
     /* if no op to decode, return */
@@ -715,133 +1241,22 @@ void pipe_stage_decode()
     Pipe_Op *op = pipe.decode_op;
     pipe.decode_op = NULL;
 
-    /* set up info fields (source/dest regs, immediate, jump dest) as necessary */
-    uint32_t opcode = (op->instruction >> 26) & 0x3F;
-    uint32_t rs = (op->instruction >> 21) & 0x1F;
-    uint32_t rt = (op->instruction >> 16) & 0x1F;
-    uint32_t rd = (op->instruction >> 11) & 0x1F;
-    uint32_t shamt = (op->instruction >> 6) & 0x1F;
-    uint32_t funct1 = (op->instruction >> 0) & 0x1F;
-    uint32_t funct2 = (op->instruction >> 0) & 0x3F;
-    uint32_t imm16 = (op->instruction >> 0) & 0xFFFF;
-    uint32_t se_imm16 = imm16 | ((imm16 & 0x8000) ? 0xFFFF8000 : 0);
-    uint32_t targ = (op->instruction & ((1UL << 26) - 1)) << 2;
-
-    op->opcode = opcode;
-    op->imm16 = imm16;
-    op->se_imm16 = se_imm16;
-    op->shamt = shamt;
-
-    switch (opcode) {
-        case OP_SPECIAL:
-            /* all "SPECIAL" insts are R-types that use the ALU and both source
-             * regs. Set up source regs and immediate value. */
-            op->reg_src1 = rs;
-            op->reg_src2 = rt;
-            op->reg_dst = rd;
-            op->subop = funct2;
-            if (funct2 == SUBOP_SYSCALL) {
-                op->reg_src1 = 2; // v0
-                op->reg_src2 = 3; // v1
-            }
-            if (funct2 == SUBOP_JR || funct2 == SUBOP_JALR) {
-                op->is_branch = 1;
-                op->branch_cond = 0;
-            }
-
-            break;
-
-        case OP_BRSPEC:
-            /* branches that have -and-link variants come here */
-            op->is_branch = 1;
-            op->reg_src1 = rs;
-            op->reg_src2 = rt;
-            op->is_branch = 1;
-            op->branch_cond = 1; /* conditional branch */
-            op->branch_dest = op->pc + 4 + (se_imm16 << 2);
-            op->subop = rt;
-            if (rt == BROP_BLTZAL || rt == BROP_BGEZAL) {
-                /* link reg */
-                op->reg_dst = 31;
-                op->reg_dst_value = op->pc + 4;
-                op->reg_dst_value_ready = 1;
-            }
-            break;
-
-        case OP_JAL:
-            op->reg_dst = 31;
-            op->reg_dst_value = op->pc + 4;
-            op->reg_dst_value_ready = 1;
-            op->branch_taken = 1;
-            /* fallthrough */
-        case OP_J:
-            op->is_branch = 1;
-            op->branch_cond = 0;
-            op->branch_taken = 1;
-            op->branch_dest = (op->pc & 0xF0000000) | targ;
-            break;
-
-        case OP_BEQ:
-        case OP_BNE:
-        case OP_BLEZ:
-        case OP_BGTZ:
-            /* ordinary conditional branches (resolved after execute) */
-            op->is_branch = 1;
-            op->branch_cond = 1;
-            op->branch_dest = op->pc + 4 + (se_imm16 << 2);
-            op->reg_src1 = rs;
-            op->reg_src2 = rt;
-            break;
-
-        case OP_ADDI:
-        case OP_ADDIU:
-        case OP_SLTI:
-        case OP_SLTIU:
-            /* I-type ALU ops with sign-extended immediates */
-            op->reg_src1 = rs;
-            op->reg_dst = rt;
-            break;
-
-        case OP_ANDI:
-        case OP_ORI:
-        case OP_XORI:
-        case OP_LUI:
-            /* I-type ALU ops with non-sign-extended immediates */
-            op->reg_src1 = rs;
-            op->reg_dst = rt;
-            break;
+    /* set up info fields (source/dest regs, immediate, jump dest) from the
+     * instruction table */
+    isa_decode(op);
 
-        case OP_LW:
-        case OP_LH:
-        case OP_LHU:
-        case OP_LB:
-        case OP_LBU:
-        case OP_SW:
-        case OP_SH:
-        case OP_SB:
-            /* memory ops */
-            op->is_mem = 1;
-            op->reg_src1 = rs;
-            if (opcode == OP_LW || opcode == OP_LH || opcode == OP_LHU || opcode == OP_LB || opcode == OP_LBU) {
-                /* load */
-                op->mem_write = 0;
-                op->reg_dst = rt;
-            }
-            else {
-                /* store */
-                op->mem_write = 1;
-                op->reg_src2 = rt;
-            }
-            break;
+    /* branches resolving in decode read their sources here; they wait in
+     * decode until they can */
+    if (op->is_branch && pipe_branch_flush() == 2 && !pipe_decode_resolve(op)) {
+        pipe.decode_op = op;
+        return;
     }
+
     /* we will handle reg-read together with bypass in the execute stage */
     /* place op in downstream slot */
-    pipe.execute_op = op;
+    *out = op;
 }
 
-uint32_t set_number;
-uint32_t current_tag;
-
 void update_recentness(int i){
     for (int k = 0; k < 4; k++){
         if (instr_cache[set_number][k].tag != 0){
@@ -860,11 +1275,6 @@ _Bool check_instr_cache() //Returns true for cache miss or false for cache hit
             return false; //True if stall, false if no stall
         }
     }
-
-    pipe.instr_stall_count = 50;
-    if (pipe.data_stall_state == true && pipe.data_stall_count == 50) {
-        pipe.instr_stall_count += 50;
-    }
     return true; //cache miss (stall)
 }
 
@@ -897,10 +1307,51 @@ void store_instr_cache(){ //Takes in the PC value and store it into the appropri
     return;
 }
 
+/* probe the instruction cache for the line holding pc */
+static _Bool check_instr_cache_at(uint32_t pc)
+{
+    set_number = (pc >> 5) & 0x3F; //Extract only bits 5 to 10
+    current_tag = (pc >> 11); // & 0x1FFFFF; //Extract bits 11 to 31
+    return check_instr_cache();
+}
+
+/* probe the instruction cache for pc and fill the line on a miss right
+ * away, as pipe_dcache_access. Returns true on a miss. */
+_Bool pipe_icache_access(uint32_t pc)
+{
+    _Bool miss = check_instr_cache_at(pc);
+    if (miss) {
+        store_instr_cache();
+        pipe_stats.icache_miss++;
+    }
+    return miss;
+}
+
+/* the address fetch reads next */
+static uint32_t pipe_fetch_pc()
+{
+    if (pipe.ftq_count)
+        return pipe.ftq[pipe.ftq_head].pc + 4 * pipe.ftq_pos;
+    return pipe.PC;
+}
+
+/* end of an instruction-cache miss: install the line of the fetch PC */
+static void icache_fill_done(uint32_t gen)
+{
+    if (gen != pipe.icache_gen)
+        return;
+    uint32_t pc = pipe_fetch_pc();
+    set_number = (pc >> 5) & 0x3F;
+    current_tag = (pc >> 11);
+    store_instr_cache();
+    pipe.icache_miss_pending = 0;
+    pipe.icache_filled = 1;
+}
+
 _Bool check_BTB_taken (Pipe_Op *op){
-    /* check whether pipe.PC matches the tag, and also check the valid bit */
+    /* check whether the op's PC matches the tag, and also check the valid bit */
     if ((branch_buffer[op->BTB_index].valid == true && 
-        branch_buffer[op->BTB_index].addr_tag == pipe.PC) || 
+        branch_buffer[op->BTB_index].addr_tag == op->pc) || 
         branch_buffer[op->BTB_index].conditional == false){
         return true;
     }
@@ -909,7 +1360,7 @@ _Bool check_BTB_taken (Pipe_Op *op){
 
 _Bool BTB_hit_check (Pipe_Op *op){
     //check if BTB hits or misses
-    if (branch_buffer[op->BTB_index].addr_tag == pipe.PC || branch_buffer[op->BTB_index].valid == 1){
+    if (branch_buffer[op->BTB_index].addr_tag == op->pc || branch_buffer[op->BTB_index].valid == 1){
         return true; //BTB hit
     }
     else{
@@ -917,75 +1368,349 @@ _Bool BTB_hit_check (Pipe_Op *op){
     }
 }
 
-void pipe_stage_fetch()
+/* predict the op at op->pc: fill in its prediction fields and return the
+ * address to fetch after it */
+uint32_t pipe_predict(Pipe_Op *op)
 {
-    set_number = (pipe.PC >> 5) & 0x3F; //Extract only bits 5 to 10
-    current_tag = (pipe.PC >> 11); // & 0x1FFFFF; //Extract bits 11 to 31
-    
-    /* check instr cache stall */
-    if (pipe.instr_stall_state == true && pipe.instr_stall_count > 0){
-        pipe.instr_stall_count -= 1;
-    }
+    uint8_t bits_2_to_9_PC = (op->pc >> 2) & 0xFF;
+
+    op->pattern_index = bits_2_to_9_PC ^ GHR;
+    op->BTB_index = (op->pc >> 2) & 0x3FF;
+    op->predict_taken = false;
 
-    if (pipe.instr_stall_state == false){
-        pipe.instr_stall_state = check_instr_cache(); // accesses instr cache & store value without implementing delay 
+    op->BTB_miss = !BTB_hit_check(op);
+    if (op->BTB_miss == false){
+        if (global_pattern[op->pattern_index].PHT_entry >= 2 && check_BTB_taken(op) == true){
+            op->predict_taken = true;
+        }
+        else{
+            op->predict_taken = false;
+        }
+    }
+    else{
+        op->predict_taken = false;
     }
 
-    if (pipe.instr_stall_count == 1){
-        /* This branch would only be entered in the 50th (last stall) cycle */
-        /* Store this pipe.pc into the designated cache block*/ // Might need to store PC from the first cycle if that changes
-        store_instr_cache();
+    if (op->predict_taken == false) {
+        /* update PC */
+        return op->pc + 4;
     }
+    // Get the target from BTB and apply that as the next PC
+    return branch_buffer[op->BTB_index].target;
+}
 
-    /* if pipeline is stalled (our output slot is not empty), return */
-    if (pipe.decode_op != NULL)
+/* the instruction-cache line of pc is missing: fetch waits for it */
+static void pipe_fetch_miss()
+{
+    /* the line arrives at the end of the 50th cycle of the stall (100th if
+     * the mem stage started a miss this cycle, as the two share the memory),
+     * and fetch goes on in the cycle after that */
+    int latency = ICACHE_MISS_LATENCY;
+    if (pipe.dcache_miss_pending && pipe.dcache_miss_cycle == (uint64_t)cycle_count)
+        latency += DCACHE_MISS_LATENCY;
+    pipe.icache_miss_pending = 1;
+    pipe_stats.icache_miss++;
+    event_schedule(cycle_count + latency - 1, icache_fill_done, pipe.icache_gen);
+}
+
+/* branch prediction unit of the decoupled front end: queue the block that
+ * starts at pipe.PC, and go on after it */
+static void pipe_predict_block()
+{
+    if (pipe.ftq_count >= config.ftq)
         return;
 
-    /* Allocate an op and send it down the pipeline. */
-    Pipe_Op *op = malloc(sizeof(Pipe_Op));
-    memset(op, 0, sizeof(Pipe_Op));
-    op->reg_src1 = op->reg_src2 = op->reg_dst = -1;
+    Fetch_Block *b = &pipe.ftq[(pipe.ftq_head + pipe.ftq_count) % FTQ_MAX];
+    int n = FETCH_BLOCK_MAX - ((pipe.PC >> 2) & (FETCH_BLOCK_MAX - 1));
+
+    b->pc = pipe.PC;
+    b->count = n;
+    b->taken = 0;
+    b->btb_miss = 0;
+    b->next = pipe.PC + 4 * n;
+    for (int i = 0; i < n; i++) {
+        Pipe_Op op = { .pc = pipe.PC + 4 * i };
+        uint32_t next = pipe_predict(&op);
+
+        b->pattern_index[i] = op.pattern_index;
+        if (op.BTB_miss)
+            b->btb_miss |= 1 << i;
+        if (op.predict_taken) {
+            b->count = i + 1;
+            b->taken = 1;
+            b->next = next;
+            break;
+        }
+    }
+    pipe.ftq_count++;
+    pipe.PC = b->next;
+}
 
-    if (pipe.instr_stall_state == true && pipe.instr_stall_count != 0){
+/* drop the predicted blocks and fetched ops (a redirect) */
+static void pipe_flush_front_end()
+{
+    while (pipe.ibuf_count) {
+        free(pipe.ibuf[pipe.ibuf_head]);
+        pipe.ibuf_head = (pipe.ibuf_head + 1) % IBUF_MAX;
+        pipe.ibuf_count--;
+    }
+    pipe.ftq_count = pipe.ftq_pos = 0;
+}
+
+/* fetch of the decoupled front end: one instruction of the oldest block per
+ * cycle goes into the instruction buffer, whatever decode does, and the
+ * oldest buffered op goes to decode */
+static void pipe_fetch_decoupled()
+{
+    /* a block predicted this cycle can be fetched right away */
+    pipe_predict_block();
+
+    if (!pipe.icache_miss_pending && pipe.ftq_count && pipe.ibuf_count < config.ibuf) {
+        Fetch_Block *b = &pipe.ftq[pipe.ftq_head];
+        uint32_t pc = b->pc + 4 * pipe.ftq_pos;
+
+        if (!pipe.icache_filled && check_instr_cache_at(pc)) {
+            pipe_fetch_miss();
+        }
+        else {
+            pipe.icache_filled = 0;
+
+            Pipe_Op *op = pipe_op_alloc();
+            op->instruction = mem_read_32(pc);
+            op->pc = pc;
+            op->pattern_index = b->pattern_index[pipe.ftq_pos];
+            op->BTB_index = (pc >> 2) & 0x3FF;
+            op->BTB_miss = (b->btb_miss >> pipe.ftq_pos) & 1;
+            op->predict_taken = b->taken && pipe.ftq_pos == b->count - 1;
+            stat_inst_fetch++;
+
+            pipe.ibuf[(pipe.ibuf_head + pipe.ibuf_count) % IBUF_MAX] = op;
+            pipe.ibuf_count++;
+
+            if (++pipe.ftq_pos == b->count) {
+                pipe.ftq_head = (pipe.ftq_head + 1) % FTQ_MAX;
+                pipe.ftq_count--;
+                pipe.ftq_pos = 0;
+
+                /* a resolved branch has changed the target since the block
+                 * was predicted: predict again from the new one, as fetch
+                 * would have */
+                uint32_t target = branch_buffer[op->BTB_index].target;
+                if (op->predict_taken && target != b->next) {
+                    pipe.ftq_count = 0;
+                    pipe.PC = target;
+                    pipe_stats.fe_resteer++;
+                }
+            }
+        }
+    }
+
+    Pipe_Op **out = pipe_stage_out(PIPE_FETCH);
+    if (!*out && pipe.ibuf_count) {
+        *out = pipe.ibuf[pipe.ibuf_head];
+        pipe.ibuf_head = (pipe.ibuf_head + 1) % IBUF_MAX;
+        pipe.ibuf_count--;
+    }
+
+    pipe_stats.ftq_occupancy += pipe.ftq_count;
+    pipe_stats.ibuf_occupancy += pipe.ibuf_count;
+    if (!*out) {
+        if (pipe.icache_miss_pending)
+            pipe_stats.fe_bubble_icache++;
+        else if (!pipe.ftq_count)
+            pipe_stats.fe_bubble_ftq++;
+    }
+}
+
+void pipe_stage_fetch()
+{
+    if (pipe.fetch_stop)
+        return;
+
+    if (config.ftq > 0 && config.core == CORE_INORDER) {
+        pipe_fetch_decoupled();
         return;
     }
 
-    if (pipe.instr_stall_count == 0){
-        /* Set stall state to false to check the cache again in the next cycle */
-        pipe.instr_stall_state = false;
+    /* waiting for the line: the fill event lets us go on */
+    if (pipe.icache_miss_pending)
+        return;
+
+    if (!pipe.icache_filled && check_instr_cache_at(pipe.PC)){
+        pipe_fetch_miss();
+        return;
     }
-    
+
+    /* if pipeline is stalled (our output slot is not empty), return */
+    Pipe_Op **out = pipe_stage_out(PIPE_FETCH);
+    if (*out != NULL)
+        return;
+    pipe.icache_filled = 0;
+
+    /* Allocate an op and send it down the pipeline. */
+    Pipe_Op *op = pipe_op_alloc();
+
     op->instruction = mem_read_32(pipe.PC);
     op->pc = pipe.PC;
-    pipe.decode_op = op;
+    *out = op;
 
     /* Check Branch Prediction */
-    uint8_t bits_2_to_9_PC = (pipe.PC >> 2) & 0xFF;
+    pipe.PC = pipe_predict(op);
+    stat_inst_fetch++;
+}
+_Bool pipe_drain()
+{
+    if (!pipe.fetch_stop) {
+        /* fetched ops that have not reached decode are simply dropped; if
+         * nothing is further on, the oldest of them is the next to run */
+        if (!pipe.decode_op && !pipe.execute_op && !pipe.mem_op && !pipe.wb_op &&
+            !pipe_substages_busy() && !ooo.rob_count && !pipe.branch_recover)
+            pipe.retire_next_pc = pipe.ibuf_count ? pipe.ibuf[pipe.ibuf_head]->pc : pipe_fetch_pc();
+        pipe.fetch_stop = 1;
+        pipe_flush_front_end();
+    }
 
-    op->pattern_index = bits_2_to_9_PC ^ GHR;
-    op->BTB_index = (pipe.PC >> 2) & 0x3FF;
-    op->predict_taken = false;
+    if (pipe.decode_op || pipe.execute_op || pipe.mem_op || pipe.wb_op ||
+        pipe_substages_busy() || ooo.rob_count || pipe.sb_count ||
+        pipe.branch_recover || pipe.icache_miss_pending ||
+        pipe.dcache_miss_pending || pipe.hilo_busy)
+        return false;
 
-    op->BTB_miss = !BTB_hit_check(op);
-    if (op->BTB_miss == false){
-        if (global_pattern[op->pattern_index].PHT_entry >= 2 && check_BTB_taken(op) == true){
-            op->predict_taken = true;
-        }
-        else{
-            op->predict_taken = false;
-        }
+    pipe.PC = pipe.retire_next_pc;
+    return true;
+}
+
+void pipe_resume()
+{
+    pipe.fetch_stop = 0;
+    pipe.icache_filled = 0;
+    pipe.dcache_filled = 0;
+}
+
+void pipe_switch_core(int core)
+{
+    /* the models keep their in-flight state apart (the ROB or the stage
+     * latches), so the old one finishes what it has started and the new
+     * one fetches from the next instruction to retire */
+    if (stat_cycles) {
+        while (RUN_BIT && !pipe_drain())
+            cycle(INT_MAX);
+        pipe_resume();
     }
-    else{
-        op->predict_taken = false;
+    config.core = core;
+}
+
+void pipe_step(int warm)
+{
+    Pipe_Op op = { .pc = pipe.PC };
+
+    op.instruction = mem_read_32(op.pc);
+    if (warm) {
+        pipe_icache_access(op.pc);
+        pipe_predict(&op);
     }
-    
-    if (op->predict_taken == false) {
-        /* update PC */
-        pipe.PC += 4;
+    isa_decode(&op);
+
+    op.reg_src1_value = op.reg_src1 > 0 ? pipe.REGS[op.reg_src1] : 0;
+    op.reg_src2_value = op.reg_src2 > 0 ? pipe.REGS[op.reg_src2] : 0;
+    op.hi_value = pipe.HI;
+    op.lo_value = pipe.LO;
+    pipe_execute_op(&op);
+
+    if (op.is_mem) {
+        if (warm)
+            pipe_dcache_access(op.mem_addr, op.mem_write);
+        if (op.mem_write)
+            pipe_mem_store(&op);
+        else
+            pipe_mem_load(&op);
     }
-    else{
-        // Get the target from BTB and apply that as the next pipe.PC
-        pipe.PC = branch_buffer[op->BTB_index].target; 
+    if (op.reg_dst > 0)
+        pipe.REGS[op.reg_dst] = op.reg_dst_value;
+    pipe.HI = op.hi_value;
+    pipe.LO = op.lo_value;
+    if (warm && op.is_branch)
+        pipe_update_predictor(&op);
+    if (trace_on)
+        trace_retire(&op);
+
+    if (op.opcode == OP_SPECIAL && op.subop == SUBOP_SYSCALL) {
+        if (op.reg_src1_value == SYSCALL_EXIT) {
+            pipe.PC = op.pc + 4;
+            RUN_BIT = 0;
+            return;
+        }
+        if (op.reg_src1_value == SYSCALL_ROI_BEGIN || op.reg_src1_value == SYSCALL_ROI_END)
+            pipe.roi_marker = op.reg_src1_value;
     }
-    stat_inst_fetch++;
-}
\ No newline at end of file
+    pipe.PC = op.branch_taken ? op.branch_dest : op.pc + 4;
+    pipe.retire_next_pc = pipe.PC;
+}
+
+void pipe_stats_add(Pipe_Stats *sum, const Pipe_Stats *to, const Pipe_Stats *from)
+{
+    sum->bypass_ex += to->bypass_ex - from->bypass_ex;
+    sum->bypass_mem += to->bypass_mem - from->bypass_mem;
+    sum->bypass_wb += to->bypass_wb - from->bypass_wb;
+    sum->stall_load_use += to->stall_load_use - from->stall_load_use;
+    sum->stall_data += to->stall_data - from->stall_data;
+    sum->stall_no_bypass += to->stall_no_bypass - from->stall_no_bypass;
+    sum->stall_hilo += to->stall_hilo - from->stall_hilo;
+    sum->stall_mem += to->stall_mem - from->stall_mem;
+    sum->stall_unit += to->stall_unit - from->stall_unit;
+    sum->fe_bubble_icache += to->fe_bubble_icache - from->fe_bubble_icache;
+    sum->fe_bubble_ftq += to->fe_bubble_ftq - from->fe_bubble_ftq;
+    sum->fe_resteer += to->fe_resteer - from->fe_resteer;
+    sum->ftq_occupancy += to->ftq_occupancy - from->ftq_occupancy;
+    sum->ibuf_occupancy += to->ibuf_occupancy - from->ibuf_occupancy;
+    sum->sb_full += to->sb_full - from->sb_full;
+    sum->sb_loads += to->sb_loads - from->sb_loads;
+    sum->sb_forward += to->sb_forward - from->sb_forward;
+    sum->sb_forward_part += to->sb_forward_part - from->sb_forward_part;
+    sum->icache_miss += to->icache_miss - from->icache_miss;
+    sum->dcache_miss += to->dcache_miss - from->dcache_miss;
+}
+
+/* what fast-forwarding warms, with the counters that go with it */
+struct Pipe_Warm {
+    Cache instr_cache[64][4];
+    Cache data_cache[256][8];
+    uint8_t data_cache_state[256][8];
+    PHT global_pattern[256];
+    BTB branch_buffer[1024];
+    uint8_t GHR;
+    int cycle_count;
+    Pipe_Stats stats;
+};
+
+Pipe_Warm *pipe_warm_save()
+{
+    Pipe_Warm *w = malloc(sizeof(Pipe_Warm));
+
+    if (!w) {
+        printf("Error: out of memory for the warm state\n");
+        exit(-1);
+    }
+    memcpy(w->instr_cache, instr_cache, sizeof(instr_cache));
+    memcpy(w->data_cache, data_cache, sizeof(data_cache));
+    memcpy(w->data_cache_state, data_cache_state, sizeof(data_cache_state));
+    memcpy(w->global_pattern, global_pattern, sizeof(global_pattern));
+    memcpy(w->branch_buffer, branch_buffer, sizeof(branch_buffer));
+    w->GHR = GHR;
+    w->cycle_count = cycle_count;
+    w->stats = pipe_stats;
+    return w;
+}
+
+void pipe_warm_restore(const Pipe_Warm *w)
+{
+    pipe_reset();
+    memcpy(instr_cache, w->instr_cache, sizeof(instr_cache));
+    memcpy(data_cache, w->data_cache, sizeof(data_cache));
+    memcpy(data_cache_state, w->data_cache_state, sizeof(data_cache_state));
+    memcpy(global_pattern, w->global_pattern, sizeof(global_pattern));
+    memcpy(branch_buffer, w->branch_buffer, sizeof(branch_buffer));
+    GHR = w->GHR;
+    cycle_count = w->cycle_count;
+    pipe_stats = w->stats;
+}
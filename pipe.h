@@ -15,54 +15,129 @@
  * the instructions that actually flow through the pipeline. This struct does
  * not correspond 1-to-1 with the control signals that would actually pass
  * through the pipeline. Rather, it carries the orginal instruction, operand
- * information and values as they are collected, and destination information. */
+ * information and values as they are collected, and destination information.
+ *
+ * Every op fills exactly one 64-byte host cache line: the fields are as
+ * narrow as their values allow and ordered so that there is no padding, and
+ * ops are allocated line-aligned (pipe_op_alloc). The stages, the bypass
+ * checks and the out-of-order scheduler look at many ops per simulated cycle;
+ * one line each keeps that to one host cache miss per op. */
 typedef struct Pipe_Op {
     /* PC of this instruction */
     uint32_t pc;
     /* raw instruction */
     uint32_t instruction;
-    /* decoded opcode and subopcode fields */
-    int opcode, subop;
 
-    /* immediate value, if any, for ALU immediates */
-    uint32_t imm16, se_imm16;
+    /* decoded opcode and subopcode fields */
+    uint8_t opcode, subop;
     /* shift amount */
-    int shamt;
+    uint8_t shamt;
 
-    /* register source values */
-    int reg_src1, reg_src2; /* 0 -- 31 if this inst has register source(s), or
-                               -1 otherwise */
-    uint32_t reg_src1_value, reg_src2_value; /* values of operands from source
-                                                regs */
+    /* register numbers: 0 -- 31 if this inst has a register source
+     * (destination), or -1 otherwise */
+    int8_t reg_src1, reg_src2;
+    int8_t reg_dst;
+    uint8_t reg_dst_value_ready; /* destination value produced yet? */
 
     /* memory access information */
-    int is_mem;       /* is this a load/store? */
-    uint32_t mem_addr; /* address if applicable */
-    int mem_write; /* is this a write to memory? */
-    uint32_t mem_value; /* value loaded from memory or to be written to memory */
-
-    /* register destination information */
-    int reg_dst; /* 0 -- 31 if this inst has a destination register, -1
-                    otherwise */
-    uint32_t reg_dst_value; /* value to write into dest reg. */
-    int reg_dst_value_ready; /* destination value produced yet? */
+    uint8_t is_mem;    /* is this a load/store? */
+    uint8_t mem_write; /* is this a write to memory? */
 
     /* branch information */
-    int is_branch;        /* is this a branch? */
-    uint32_t branch_dest; /* branch destination (if taken) */
-    int branch_cond;      /* is this a conditional branch? */
-    int branch_taken;     /* branch taken? (set as soon as resolved: in decode
+    uint8_t is_branch;    /* is this a branch? */
+    uint8_t branch_cond;  /* is this a conditional branch? */
+    uint8_t branch_taken; /* branch taken? (set as soon as resolved: in decode
                              for unconditional, execute for conditional) */
-    int is_link;          /* jump-and-link or branch-and-link inst? */
-    int link_reg;         /* register to place link into? */
+    uint8_t insn;         /* instruction number (INSN_*, isa.h), set by decode */
 
     /* Branch Prediction Parameters */
     _Bool BTB_miss; // True = miss, False = hit
-    uint32_t BTB_index;
     _Bool predict_taken;
     uint8_t pattern_index;
+    uint16_t BTB_index;
+
+    /* immediate value, if any, for ALU immediates */
+    uint16_t imm16;
+    uint32_t se_imm16;
+
+    /* register source values */
+    uint32_t reg_src1_value, reg_src2_value; /* values of operands from source
+                                                regs */
+    uint32_t reg_dst_value; /* value to write into dest reg. */
+
+    uint32_t mem_addr;  /* address if applicable */
+    uint32_t mem_value; /* value loaded from memory or to be written to memory */
+
+    uint32_t branch_dest; /* branch destination (if taken) */
+
+    /* HI/LO values read and written by multiply/divide and HI/LO moves */
+    uint32_t hi_value, lo_value;
+} __attribute__((aligned(64))) Pipe_Op;
+
+_Static_assert(sizeof(Pipe_Op) == 64, "Pipe_Op must fill exactly one cache line");
+_Static_assert(_Alignof(Pipe_Op) == 64, "Pipe_Op must be cache-line aligned");
+
+/* pipeline stages. Fetch, decode, execute and memory can each be split into
+ * several sub-stages (config.fetch_stages etc.): the stage's work is done in
+ * its first sub-stage and the op then moves through the others, one per
+ * cycle, before it reaches the next stage's input. */
+#define PIPE_FETCH   0
+#define PIPE_DECODE  1
+#define PIPE_EXECUTE 2
+#define PIPE_MEM     3
+#define PIPE_WB      4
+
+#define PIPE_MAX_SUBSTAGES 8
+
+/* Register scoreboard: for each architectural register with a result still
+ * in flight, the youngest op producing it, the stage that op is in, and the
+ * first cycle in which its value can be forwarded to execute. The execute
+ * stage reads its sources through it instead of comparing register numbers
+ * against every later stage. */
 
-} Pipe_Op;
+#define SCOREBOARD_NOT_READY UINT64_MAX
+
+typedef struct Scoreboard_Entry {
+    Pipe_Op *producer;    /* NULL: the register file holds the value */
+    int stage;            /* PIPE_EXECUTE, PIPE_MEM or PIPE_WB */
+    uint64_t ready_cycle; /* value produced (SCOREBOARD_NOT_READY if not yet) */
+} Scoreboard_Entry;
+
+/* Decoupled front end (in-order core, "set ftq <n>"): the branch predictor
+ * runs ahead of fetch, from pipe.PC, and queues fetch blocks: the
+ * instructions from a fetch address to the end of its instruction-cache
+ * line, or to the first one predicted taken. Fetch reads the blocks
+ * through the instruction cache into an instruction buffer, which feeds
+ * decode, so an instruction-cache miss can start while decode is stalled. */
+
+#define FTQ_MAX         32
+#define IBUF_MAX        16
+#define FETCH_BLOCK_MAX 8  /* instructions in a 32-byte cache line */
+
+typedef struct Fetch_Block {
+    uint32_t pc;      /* first instruction */
+    uint32_t next;    /* predicted fetch address after the block */
+    uint8_t count;    /* instructions in the block */
+    uint8_t taken;    /* the last one is predicted taken */
+    uint8_t btb_miss; /* bit i: instruction i missed in the BTB */
+    uint8_t pattern_index[FETCH_BLOCK_MAX];
+} Fetch_Block;
+
+/* Store buffer (in-order core, "set store_buffer <n>"): a store that
+ * leaves the memory stage waits here, oldest first, until it has written its
+ * bytes to the data cache and memory in the background. Loads take the bytes
+ * of buffered stores before those of memory. */
+
+#define STORE_BUFFER_MAX 64
+
+/* most multiply or divide units ("set mul_units/div_units <n>") */
+#define PIPE_MAX_UNITS 8
+
+typedef struct Store_Buffer_Entry {
+    uint32_t addr;  /* address of the aligned word written */
+    uint32_t data;  /* store data, in its byte lanes of the word */
+    uint8_t mask;   /* bytes of the word written (bit i: byte addr+i) */
+} Store_Buffer_Entry;
 
 /* The pipe state represents the current state of the pipeline. It holds a
  * pointer to the op that is currently at the input of each stage. As stages
@@ -77,11 +152,19 @@ typedef struct Pipe_State {
     /* pipe op currently at the input of the given stage (NULL for none) */
     Pipe_Op *decode_op, *execute_op, *mem_op, *wb_op; //initializes pointer variables of type Pipe_Op (as shown above)
 
+    /* ops in the extra sub-stages of fetch, decode, execute and memory,
+     * in pipeline order */
+    Pipe_Op *substage[PIPE_WB][PIPE_MAX_SUBSTAGES - 1];
+
     /* register file state */
     uint32_t REGS[32];
     uint32_t HI, LO;
 
-    /* program counter in fetch stage */
+    /* results in flight, per register (see Scoreboard_Entry) */
+    Scoreboard_Entry scoreboard[32];
+
+    /* program counter in fetch stage (of the branch predictor, with a
+     * decoupled front end) */
     uint32_t PC;
 
     /* information for PC update (branch recovery). Branches should use this
@@ -91,16 +174,43 @@ typedef struct Pipe_State {
     uint32_t branch_dest; /* next fetch will be from this PC */
     int branch_flush; /* how many stages to flush during recover? (1 = fetch, 2 = fetch/decode, ...) */
 
-    /* multiplier stall info */
-    int multiplier_stall; /* number of remaining cycles until HI/LO are ready */
+    /* outstanding long-latency work. Each one completes through an event
+     * (see event.h) rather than a per-cycle countdown. The generation numbers
+     * let a newer request or a redirect make a scheduled completion stale. */
+    int icache_miss_pending;     /* instruction-cache fill in progress */
+    int icache_filled;           /* fill done, the instruction not yet fetched */
+    uint32_t icache_gen;
+    int dcache_miss_pending;     /* data-cache fill for mem_op in progress */
+    int dcache_filled;           /* fill done, mem_op not yet accessed memory */
+    uint64_t dcache_miss_cycle;  /* cycle in which the last data miss started */
+    int hilo_busy;               /* multiply/divide still producing HI/LO */
+    uint32_t hilo_gen;
+    uint64_t hilo_ready_cycle;   /* first cycle HI/LO can be read */
+
+    /* multiply and divide units: first cycle each can take a new op */
+    uint64_t mul_free[PIPE_MAX_UNITS], div_free[PIPE_MAX_UNITS];
 
-    /* place other information here as necessary */
-    
-    uint32_t instr_stall_count;
-    int instr_stall_state;
+    /* decoupled front end: rings of predicted fetch blocks (fetch is at
+     * instruction ftq_pos of the oldest) and of fetched ops */
+    Fetch_Block ftq[FTQ_MAX];
+    int ftq_head, ftq_count, ftq_pos;
+    Pipe_Op *ibuf[IBUF_MAX];
+    int ibuf_head, ibuf_count;
 
-    uint32_t data_stall_count;
-    int data_stall_state;
+    /* store buffer: a ring of sb_count entries from sb_head (the oldest) */
+    Store_Buffer_Entry store_buffer[STORE_BUFFER_MAX];
+    int sb_head, sb_count;
+    int sb_drain_pending;        /* oldest entry waits for a data-cache fill */
+
+    /* switching to functional simulation (sample.c): fetch stops while the
+     * instructions in flight retire, and execution goes on from the one
+     * after the last of them */
+    int fetch_stop;
+    uint32_t retire_next_pc;
+
+    /* last region-of-interest marker syscall executed (SYSCALL_ROI_*; the
+     * driver clears it) */
+    uint32_t roi_marker;
 
 } Pipe_State;
 
@@ -118,20 +228,76 @@ typedef struct Branch_Target_Buffer{ //branch
     uint32_t target;
 } BTB;
 
-/* global variable -- pipeline state */
-extern Pipe_State pipe;
+/* in-order pipeline statistics: operands forwarded per bypass path, cycles
+ * the op in execute waits, per hazard, and front end and store buffer
+ * activity */
+typedef struct Pipe_Stats {
+    uint32_t bypass_ex;       /* from the op in a later execute sub-stage */
+    uint32_t bypass_mem;      /* from the op in the memory stage */
+    uint32_t bypass_wb;       /* from the op in the writeback stage */
+    uint32_t stall_load_use;  /* source is a load's data, not there yet */
+    uint32_t stall_data;      /* source still being computed (deep execute) */
+    uint32_t stall_no_bypass; /* source produced, but no path to execute */
+    uint32_t stall_hilo;      /* HI/LO move waits for multiply/divide */
+    uint32_t stall_mem;       /* memory stage still busy (cache miss) */
+    uint32_t stall_unit;      /* every multiply or divide unit busy */
+    uint32_t fe_bubble_icache; /* decode gets nothing: icache miss */
+    uint32_t fe_bubble_ftq;   /* ... the fetch target queue is empty */
+    uint32_t fe_resteer;      /* BTB target changed after prediction */
+    uint64_t ftq_occupancy;   /* sums over cycles, for the averages */
+    uint64_t ibuf_occupancy;
+    uint32_t sb_full;         /* store waits in memory for a buffer entry */
+    uint32_t sb_loads;        /* loads made with the store buffer on */
+    uint32_t sb_forward;      /* ... with all their bytes from the buffer */
+    uint32_t sb_forward_part; /* ... with some bytes from the buffer */
+    uint32_t icache_miss;     /* instruction-cache fills (both cores) */
+    uint32_t dcache_miss;     /* data-cache fills, stores' included */
+} Pipe_Stats;
+
+/* global variable -- pipeline state (one per simulated core) */
+extern _Thread_local Pipe_State pipe;
+extern _Thread_local Pipe_Stats pipe_stats;
+
+/* no cycle banners from this thread (time-parallel workers) */
+extern _Thread_local int pipe_quiet;
+
+/* cache miss penalties, in cycles */
+#define ICACHE_MISS_LATENCY 50
+#define DCACHE_MISS_LATENCY 50
+
+/* data cache tags and MESI state of each block (one per simulated core) */
+extern _Thread_local Cache data_cache[256][8];
+extern _Thread_local uint8_t data_cache_state[256][8];
 
 /* called during simulator startup */
 void pipe_init();
 
+/* return the core to its power-on state: drops in-flight instructions and
+ * clears the caches, branch predictor and pipeline (shell "reset") */
+void pipe_reset();
+
 /* this function calls the others */
 void pipe_cycle();
 
+/* skip up to 'max' cycles in which no stage can make progress before the
+ * next pending event (in-order core only); returns the number skipped */
+int pipe_skip_idle(int max);
+
 /* helper: pipe stages can call this to schedule a branch recovery */
-/* flushes 'flush' stages (1 = execute only, 2 = fetch/decode, ...) and then
- * sets the fetch PC to the given destination. */
+/* flushes 'flush' stages (1 = fetch only, 2 = fetch/decode, ...): the
+ * inputs of stages 2 .. flush and the sub-stages behind stages 1 .. flush-1
+ * (everything younger than an op that stage 'flush' has just finished) and
+ * then sets the fetch PC to the given destination. */
 void pipe_recover(int flush, uint32_t dest);
 
+/* the 'flush' argument for a misprediction found where branches resolve */
+int pipe_branch_flush();
+
+/* move ops along the extra sub-stages of 'stage' (PIPE_FETCH .. PIPE_MEM),
+ * the last one into the next stage's input if that is free; call right
+ * before the stage itself */
+void pipe_advance_substages(int stage);
+
 /* each of these functions implements one stage of the pipeline */
 void pipe_stage_fetch();
 void pipe_stage_decode();
@@ -139,4 +305,48 @@ void pipe_stage_execute();
 void pipe_stage_mem();
 void pipe_stage_wb();
 
+/* helpers shared by the core models */
+Pipe_Op *pipe_op_alloc();
+void pipe_execute_op(Pipe_Op *op); /* isa.c */
+void pipe_update_predictor(Pipe_Op *op);
+_Bool check_flush_pipe(Pipe_Op *op);
+void pipe_load_value(Pipe_Op *op, uint32_t val);
+uint32_t pipe_store_merge(Pipe_Op *op, uint32_t val);
+void pipe_mem_load(Pipe_Op *op);
+void pipe_mem_store(Pipe_Op *op);
+_Bool pipe_dcache_access(uint32_t addr, _Bool write);
+_Bool pipe_icache_access(uint32_t pc);
+uint32_t pipe_predict(Pipe_Op *op);
+
+/* functional simulation, for sampling (sample.c). pipe_drain() stops fetch
+ * and returns true once nothing is in flight: pipe.PC is then the next
+ * instruction to execute, and pipe_step() executes it at once, without
+ * timing; with 'warm', its lines are filled into the caches and, if it is a
+ * branch, the predictor predicts it and is trained. pipe_resume() lets the
+ * pipeline fetch from pipe.PC again. */
+_Bool pipe_drain();
+void pipe_step(int warm);
+void pipe_resume();
+
+/* change config.core, draining the running core first */
+void pipe_switch_core(int core);
+
+/* add the statistics gathered between snapshots 'from' and 'to' to 'sum'
+ * (for piecing runs together, parallel.c) */
+void pipe_stats_add(Pipe_Stats *sum, const Pipe_Stats *to, const Pipe_Stats *from);
+
+/* a copy of the state functional warming updates - caches with their
+ * replacement state, predictor tables and GHR - and of the statistics.
+ * Restoring it also resets everything else, dropping any instructions in
+ * flight (pipe_reset), so the architectural state must be put back after.
+ * (fastfwd.c; free the copy with free) */
+typedef struct Pipe_Warm Pipe_Warm;
+Pipe_Warm *pipe_warm_save();
+void pipe_warm_restore(const Pipe_Warm *w);
+
+/* multiply/divide units: can a unit take op (a MULT/MULTU/DIV/DIVU) in
+ * cycle 'now'? If so, claim one, and get the op's latency */
+_Bool pipe_muldiv_free(Pipe_Op *op, uint64_t now);
+int pipe_muldiv_issue(Pipe_Op *op, uint64_t now);
+
 #endif
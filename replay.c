@@ -0,0 +1,223 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Trace-driven cache and predictor simulation. See replay.h.
+ */
+
+#include "replay.h"
+#include "trace.h"
+#include "pipe.h"
+#include "isa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct Replay {
+    /* the mapped trace, and the decoder's state (as the writer's) */
+    const uint8_t *p, *end;
+    _Bool bad;
+    uint32_t next_pc, last_addr;
+    uint32_t itable[TRACE_ITABLE][2]; /* pc, instruction */
+
+    /* results */
+    uint64_t insts, branches, mispredicts, loads, stores;
+    uint32_t icache_miss, dcache_miss;
+} Replay;
+
+static inline uint32_t get_varint(Replay *r)
+{
+    uint32_t v = 0;
+
+    for (int shift = 0; r->p < r->end && shift < 35; shift += 7) {
+        uint8_t b = *r->p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (b < 0x80)
+            return v;
+    }
+    r->bad = true;
+    return 0;
+}
+
+static inline uint32_t unzigzag(uint32_t v)
+{
+    return (v >> 1) ^ -(v & 1);
+}
+
+/* decode the next record into op's pc, instruction and data address (the
+ * register and HI/LO values are skipped); false at the end of the trace or
+ * on a malformed record */
+static _Bool replay_record(Replay *r, Pipe_Op *op)
+{
+    if (r->p >= r->end)
+        return false;
+    uint8_t flags = *r->p++;
+
+    op->pc = r->next_pc;
+    if (flags & TRACE_PC)
+        op->pc += unzigzag(get_varint(r));
+    r->next_pc = op->pc + 4;
+
+    uint32_t *slot = r->itable[(op->pc >> 2) & (TRACE_ITABLE - 1)];
+    if (flags & TRACE_INSTR) {
+        if (r->end - r->p < 4) {
+            r->bad = true;
+            return false;
+        }
+        slot[0] = op->pc;
+        slot[1] = r->p[0] | r->p[1] << 8 | r->p[2] << 16 | (uint32_t)r->p[3] << 24;
+        r->p += 4;
+    }
+    else if (slot[0] != op->pc) {
+        r->bad = true;
+        return false;
+    }
+    op->instruction = slot[1];
+
+    if (flags & TRACE_REG) {
+        r->p++;
+        get_varint(r);
+    }
+    if (flags & TRACE_MEM) {
+        r->last_addr += unzigzag(get_varint(r));
+        op->mem_addr = r->last_addr;
+        get_varint(r);
+    }
+    if (flags & TRACE_HILO) {
+        get_varint(r);
+        get_varint(r);
+    }
+    return !r->bad;
+}
+
+/* run on a thread of its own, whose caches and predictor start cold */
+static void *replay_thread(void *arg)
+{
+    Replay *r = arg;
+    Pipe_Op op, next;
+    _Bool more;
+
+    pipe_quiet = 1;
+    memset(&op, 0, sizeof(op));
+    if (!replay_record(r, &op))
+        return NULL;
+
+    /* the fetch side of op has happened; its outcome is the next pc */
+    pipe_icache_access(op.pc);
+    pipe_predict(&op);
+    do {
+        memset(&next, 0, sizeof(next));
+        more = replay_record(r, &next);
+        uint32_t next_pc = more ? next.pc : op.pc + 4;
+
+        uint32_t mem_addr = op.mem_addr;
+        isa_decode(&op);
+        r->insts++;
+        if (op.is_branch) {
+            if (op.insn == INSN_JR || op.insn == INSN_JALR) {
+                op.branch_taken = 1;
+                op.branch_dest = next_pc;
+            }
+            else if (op.branch_cond)
+                op.branch_taken = next_pc != op.pc + 4;
+            r->branches++;
+            pipe_update_predictor(&op);
+            r->mispredicts += check_flush_pipe(&op);
+        }
+        if (op.is_mem) {
+            pipe_dcache_access(mem_addr, op.mem_write);
+            if (op.mem_write)
+                r->stores++;
+            else
+                r->loads++;
+        }
+
+        if (more) {
+            op = next;
+            pipe_icache_access(op.pc);
+            pipe_predict(&op);
+        }
+    } while (more);
+
+    r->icache_miss = pipe_stats.icache_miss;
+    r->dcache_miss = pipe_stats.dcache_miss;
+    return NULL;
+}
+
+static void replay_rate(const char *name, uint64_t misses, uint64_t accesses, uint64_t insts)
+{
+    printf("  %-20s %12llu accesses  %10llu misses  %6.2f%% hits  %8.3f MPKI\n", name,
+           (unsigned long long)accesses, (unsigned long long)misses,
+           accesses ? 100.0 * (accesses - misses) / accesses : 100.0,
+           insts ? 1000.0 * misses / insts : 0.0);
+}
+
+void replay(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    struct stat st;
+    struct timespec t0, t1;
+    pthread_t thread;
+    void *map = MAP_FAILED;
+
+    if (!file) {
+        printf("Can't open trace file %s\n\n", path);
+        return;
+    }
+    if (fstat(fileno(file), &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    fclose(file);
+    if (map == MAP_FAILED || st.st_size < 8 || memcmp(map, TRACE_MAGIC, 8) != 0) {
+        printf("%s is not a native trace\n\n", path);
+        if (map != MAP_FAILED)
+            munmap(map, st.st_size);
+        return;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    Replay *r = calloc(1, sizeof(Replay));
+    if (!r) {
+        printf("Error: out of memory for trace replay\n");
+        exit(-1);
+    }
+    r->p = (const uint8_t *)map + 8;
+    r->end = (const uint8_t *)map + st.st_size;
+    memset(r->itable, 0xFF, sizeof(r->itable));
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (pthread_create(&thread, NULL, replay_thread, r) != 0) {
+        printf("Error: can't create thread for trace replay\n");
+        exit(-1);
+    }
+    pthread_join(thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    munmap(map, st.st_size);
+
+    if (r->bad)
+        printf("Warning: the trace is malformed or truncated after %llu records\n",
+               (unsigned long long)r->insts);
+
+    /* cycles: one per instruction, the pipeline's fill, and the stalls */
+    uint64_t istall = (uint64_t)r->icache_miss * ICACHE_MISS_LATENCY;
+    uint64_t dstall = (uint64_t)r->dcache_miss * DCACHE_MISS_LATENCY;
+    uint64_t bstall = r->mispredicts * (pipe_branch_flush() - 1);
+    uint64_t cycles = r->insts + 4 + istall + dstall + bstall;
+
+    printf("Replayed %llu instructions in %.3f s (%.1f million per second)\n\n",
+           (unsigned long long)r->insts, seconds,
+           seconds > 0 ? r->insts / seconds / 1e6 : 0.0);
+    replay_rate("instruction cache", r->icache_miss, r->insts, r->insts);
+    replay_rate("data cache", r->dcache_miss, r->loads + r->stores, r->insts);
+    replay_rate("branch predictor", r->mispredicts, r->branches, r->insts);
+    printf("\n  Estimated cycles %llu (CPI %.3f): %llu instruction cache, %llu data cache\n"
+           "  and %llu branch stall cycles\n\n",
+           (unsigned long long)cycles, r->insts ? (double)cycles / r->insts : 0.0,
+           (unsigned long long)istall, (unsigned long long)dstall,
+           (unsigned long long)bstall);
+    free(r);
+}
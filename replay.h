@@ -0,0 +1,27 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Trace-driven simulation ("replay file"): a native trace (trace.h) is
+ * streamed through the instruction and data caches and the branch
+ * predictor, without executing anything. The trace is mapped into memory
+ * and decoded record by record: each instruction's line is looked up in the
+ * instruction cache, it is predicted as fetch would, then decoded from its
+ * raw instruction; branches are resolved from the pc of the next record and
+ * train the predictor as in execute, and loads and stores access the data
+ * cache at their traced address.
+ *
+ * The models start cold, on a host thread of their own, so the machine in
+ * the shell is left as it was. Reported are the hit rates and misses per
+ * thousand instructions, and cycles estimated as one per instruction plus
+ * the miss latencies and the flush of each mispredicted branch - an upper
+ * bound for cache stalls (misses that overlap are counted in full) that
+ * leaves out data hazards.
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+/* shell "replay file" */
+void replay(const char *path);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Statistical sampling. See sample.h.
+ */
+
+#include "sample.h"
+#include "pipe.h"
+#include "shell.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+static Sample *samples;
+static int nsamples, samples_max;
+
+/* z for each confidence level (config.sample_confidence) */
+static const double confidence_z[] = { 1.645, 1.960, 2.576, 3.0 };
+static const char *const confidence_names[] = { "90", "95", "99", "99.7" };
+
+/* rounds of sampling before giving up on the target error */
+#define SAMPLE_MAX_ROUNDS 4
+
+static void sample_add(Sample *s)
+{
+    if (nsamples == samples_max) {
+        samples_max = samples_max ? 2 * samples_max : 256;
+        samples = realloc(samples, samples_max * sizeof(Sample));
+        if (!samples) {
+            printf("Error: out of memory for samples\n");
+            exit(-1);
+        }
+    }
+    samples[nsamples++] = *s;
+}
+
+/* run the timing model until n more instructions retire */
+static void sample_detailed(uint32_t n)
+{
+    uint32_t start = stat_inst_retire;
+
+    while (RUN_BIT && stat_inst_retire - start < n)
+        cycle(INT_MAX);
+}
+
+int sample_measure(uint32_t warmup, uint32_t unit, Sample *s, uint64_t *insts)
+{
+    uint32_t start = stat_inst_retire;
+    int complete;
+
+    pipe_resume();
+    sample_detailed(warmup);
+
+    s->cycles = stat_cycles;
+    s->insts = stat_inst_retire;
+    s->fetched = stat_inst_fetch;
+    s->icache_miss = pipe_stats.icache_miss;
+    s->dcache_miss = pipe_stats.dcache_miss;
+    s->flushes = stat_squash;
+    sample_detailed(unit);
+    complete = RUN_BIT;
+    s->cycles = stat_cycles - s->cycles;
+    s->insts = stat_inst_retire - s->insts;
+    s->fetched = stat_inst_fetch - s->fetched;
+    s->icache_miss = pipe_stats.icache_miss - s->icache_miss;
+    s->dcache_miss = pipe_stats.dcache_miss - s->dcache_miss;
+    s->flushes = stat_squash - s->flushes;
+
+    /* back to functional simulation once nothing is in flight */
+    while (RUN_BIT && !pipe_drain())
+        cycle(INT_MAX);
+    *insts += stat_inst_retire - start;
+    return complete;
+}
+
+/* one pass over the rest of the program, with a unit at the end of every
+ * 'period' instructions; returns the instructions executed */
+static uint64_t sample_round(uint64_t period)
+{
+    uint32_t unit = config.sample_unit, warmup = config.sample_warmup;
+    uint64_t insts = 0;
+    Sample s;
+
+    nsamples = 0;
+    while (RUN_BIT) {
+        for (uint64_t i = unit + warmup; i < period && RUN_BIT; i++) {
+            pipe_step(1);
+            insts++;
+        }
+        if (RUN_BIT && sample_measure(warmup, unit, &s, &insts))
+            sample_add(&s);
+    }
+    pipe_resume();
+    return insts;
+}
+
+/* per-unit values of the estimated quantities */
+#define METRIC_CPI    0
+#define METRIC_ICACHE 1
+#define METRIC_DCACHE 2
+#define METRIC_FLUSH  3
+
+static double sample_value(const Sample *s, int metric)
+{
+    switch (metric) {
+        case METRIC_CPI:    return (double)s->cycles / s->insts;
+        case METRIC_ICACHE: return 1000.0 * s->icache_miss / s->insts;
+        case METRIC_DCACHE: return 1000.0 * s->dcache_miss / s->insts;
+        default:            return 1000.0 * s->flushes / s->insts;
+    }
+}
+
+/* sample mean and standard deviation of a metric */
+static void sample_stats(int metric, double *mean, double *sd)
+{
+    double sum = 0, sq = 0;
+
+    for (int i = 0; i < nsamples; i++)
+        sum += sample_value(&samples[i], metric);
+    *mean = nsamples ? sum / nsamples : 0;
+    for (int i = 0; i < nsamples; i++) {
+        double d = sample_value(&samples[i], metric) - *mean;
+        sq += d * d;
+    }
+    *sd = nsamples > 1 ? sqrt(sq / (nsamples - 1)) : 0;
+}
+
+static void sample_report_line(const char *name, int metric, double z)
+{
+    double mean, sd;
+
+    sample_stats(metric, &mean, &sd);
+    double half = z * sd / sqrt(nsamples);
+    printf("  %-13s %10.4f +/- %.4f", name, mean, half);
+    if (mean > 0)
+        printf(" (%.1f%%)", 100 * half / mean);
+    printf("\n");
+}
+
+static void sample_report(uint64_t insts, uint64_t period, double z)
+{
+    double cpi, sd;
+    uint64_t detailed = 0;
+
+    for (int i = 0; i < nsamples; i++)
+        detailed += samples[i].insts;
+    sample_stats(METRIC_CPI, &cpi, &sd);
+
+    printf("Sampled %d units of %d instructions (%d warm-up), one per %llu, in %llu instructions\n",
+           nsamples, config.sample_unit, config.sample_warmup,
+           (unsigned long long)period, (unsigned long long)insts);
+    sample_report_line("CPI", METRIC_CPI, z);
+    sample_report_line("ICache MPKI", METRIC_ICACHE, z);
+    sample_report_line("DCache MPKI", METRIC_DCACHE, z);
+    sample_report_line("Flushes PKI", METRIC_FLUSH, z);
+    printf("  %-13s %10.0f +/- %.0f\n", "Cycles", cpi * insts,
+           z * sd / sqrt(nsamples) * insts);
+    printf("  (%s%% confidence; %.2f%% of instructions measured)\n\n",
+           confidence_names[config.sample_confidence],
+           insts ? 100.0 * detailed / insts : 0.0);
+}
+
+void sample_go()
+{
+    uint64_t min_period = (uint64_t)config.sample_unit + config.sample_warmup;
+    uint64_t period = config.sample_period;
+    double z = confidence_z[config.sample_confidence];
+    double target = config.sample_error / 100.0;
+
+    if (config.cores > 1) {
+        printf("Sampling simulates a single core\n\n");
+        return;
+    }
+    if (RUN_BIT == FALSE) {
+        printf("Can't simulate, Simulator is halted\n\n");
+        return;
+    }
+    if (period < min_period)
+        period = min_period;
+
+    for (int round = 1; ; round++) {
+        printf("Sampling, one unit per %llu instructions...\n\n", (unsigned long long)period);
+        uint64_t insts = sample_round(period);
+        if (nsamples < 2) {
+            printf("Only %d sample(s) in %llu instructions: lower sample_period\n\n",
+                   nsamples, (unsigned long long)insts);
+            return;
+        }
+        sample_report(insts, period, z);
+
+        double cpi, sd;
+        sample_stats(METRIC_CPI, &cpi, &sd);
+        double error = z * sd / sqrt(nsamples) / cpi;
+        if (error <= target || round == SAMPLE_MAX_ROUNDS || period == min_period)
+            break;
+
+        /* samples needed for the target: n = (z V / e)^2, V = sd / mean */
+        double v = sd / cpi;
+        uint64_t need = (uint64_t)ceil(z * v / target * (z * v / target));
+        uint64_t next = insts / (need > 0 ? need : 1);
+        if (next >= period)
+            next = period / 2;
+        if (next < min_period)
+            next = min_period;
+        printf("CPI error %.1f%% is over %d%%: about %llu samples needed, running again\n\n",
+               100 * error, config.sample_error, (unsigned long long)need);
+        period = next;
+        reset();
+    }
+}
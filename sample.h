@@ -0,0 +1,45 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Statistical sampling (SMARTS). Instead of simulating every cycle, the
+ * program runs functionally and the timing model is only used for short
+ * units spread evenly through it, one every sample_period instructions:
+ *
+ *   functional warming  fast-forward, with the caches and branch predictor
+ *                       updated by every instruction (pipe_step)
+ *   detailed warm-up    sample_warmup instructions on the timing model, to
+ *                       fill the pipeline and its queues
+ *   measurement         sample_unit instructions, whose cycles, cache
+ *                       misses and flushes are recorded
+ *
+ * after which the pipeline drains and functional warming goes on. The
+ * samples give estimates of the CPI and of the miss rates, each with a
+ * confidence interval. If the CPI's interval is wider than sample_error
+ * percent, the number of samples needed follows from the CPI's coefficient
+ * of variation, and the program is run again from the start with the
+ * sampling period that gives that many.
+ */
+
+#ifndef _SAMPLE_H_
+#define _SAMPLE_H_
+
+#include <stdint.h>
+
+/* the measurements of one detailed unit */
+typedef struct Sample {
+    uint32_t cycles, insts, fetched;
+    uint32_t icache_miss, dcache_miss, flushes;
+} Sample;
+
+/* from a functional state (pipe_step), simulate 'warmup' and then 'unit'
+ * instructions on the timing model and drain back to one. s gets the
+ * unit's measurements and *insts the instructions retired in all; returns
+ * FALSE if the program ended before the unit did. Call pipe_resume once
+ * the program has halted. (simpoint.c uses it too) */
+int sample_measure(uint32_t warmup, uint32_t unit, Sample *s, uint64_t *insts);
+
+/* shell "sample": run the program to completion, sampled, and report the
+ * estimates */
+void sample_go();
+
+#endif
@@ -16,16 +16,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
+#include <sys/mman.h>
 
 #include "shell.h"
 #include "pipe.h"
+#include "config.h"
+#include "multicore.h"
+#include "loader.h"
+#include "isa.h"
+#include "sample.h"
+#include "simpoint.h"
+#include "parallel.h"
+#include "fastfwd.h"
+#include "trace.h"
+#include "replay.h"
+#include "mrc.h"
+#include "sweep.h"
+#include "bench.h"
 
 /***************************************************************/
 /* Statistics.                                                 */
 /***************************************************************/
 
-uint32_t stat_cycles = 0, stat_inst_retire = 0, stat_inst_fetch = 0;
-uint32_t stat_squash = 0;
+/* kept per simulated core, like the pipeline state */
+_Thread_local uint32_t stat_cycles = 0, stat_inst_retire = 0, stat_inst_fetch = 0;
+_Thread_local uint32_t stat_squash = 0;
 
 /***************************************************************/
 /* Main memory.                                                */
@@ -42,48 +58,414 @@ uint32_t stat_squash = 0;
 #define MEM_KTEXT_START 0x80000000
 #define MEM_KTEXT_SIZE  0x00100000
 
+/* Conventional regions of the address space. Memory is no longer limited
+ * to these (see the page table below); they are kept to label the page
+ * usage report. */
 typedef struct {
     uint32_t start, size;
-    uint8_t *mem;
+    const char *name;
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
 mem_region_t MEM_REGIONS[] = {
-    { MEM_TEXT_START, MEM_TEXT_SIZE, NULL },
-    { MEM_DATA_START, MEM_DATA_SIZE, NULL },
-    { MEM_STACK_START, MEM_STACK_SIZE, NULL },
-    { MEM_KDATA_START, MEM_KDATA_SIZE, NULL },
-    { MEM_KTEXT_START, MEM_KTEXT_SIZE, NULL }
+    { MEM_TEXT_START, MEM_TEXT_SIZE, "text" },
+    { MEM_DATA_START, MEM_DATA_SIZE, "data" },
+    { MEM_STACK_START, MEM_STACK_SIZE, "stack" },
+    { MEM_KDATA_START, MEM_KDATA_SIZE, "kdata" },
+    { MEM_KTEXT_START, MEM_KTEXT_SIZE, "ktext" }
 };
 
 #define MEM_NREGIONS (sizeof(MEM_REGIONS)/sizeof(mem_region_t))
 
-int RUN_BIT = TRUE;
+_Thread_local int RUN_BIT = TRUE;
+
+/* The whole 32-bit address space is backed by a sparse two-level page
+ * table: the top 10 address bits select a second-level table, the next 10
+ * a 4 KB page. Second-level tables are created when first needed and pages
+ * when first written; reads of untouched memory return 0 without allocating.
+ * Page frames are carved out of anonymous mmap()ed chunks, so they start out
+ * zeroed and cost no host memory until used. */
+#define L1_ENTRIES   (1 << (32 - PAGE_SHIFT - L2_BITS))
+#define L2_BITS      10
+#define L2_ENTRIES   (1 << L2_BITS)
+#define CHUNK_SIZE   (2 << 20) /* host memory is mapped 2 MB at a time */
+
+static uint8_t **page_table[L1_ENTRIES];
+
+static uint8_t *chunk_next, *chunk_end;
+static uint32_t pages_allocated, tables_allocated, chunks_mapped, huge_chunks;
+static uint32_t pages_mapped; /* frames provided by mem_map_pages */
+
+/* get a zeroed page frame from the current chunk, mapping a new one (with
+ * huge pages if configured) when it is used up */
+static uint8_t *alloc_page_frame()
+{
+    if (chunk_next == chunk_end) {
+        void *p = MAP_FAILED;
+
+        if (config.huge_pages) {
+#ifdef MAP_HUGETLB
+            p = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+            if (p != MAP_FAILED)
+                huge_chunks++;
+        }
+        if (p == MAP_FAILED) {
+            p = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                printf("Error: out of host memory for simulated pages\n");
+                exit(-1);
+            }
+#ifdef MADV_HUGEPAGE
+            /* fall back to transparent huge pages if they are available */
+            if (config.huge_pages)
+                madvise(p, CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+        }
+
+        chunk_next = p;
+        chunk_end = chunk_next + CHUNK_SIZE;
+        chunks_mapped++;
+    }
+
+    uint8_t *frame = chunk_next;
+    chunk_next += PAGE_SIZE;
+    pages_allocated++;
+    return frame;
+}
+
+/* page-table slot of 'address', creating its second-level table if
+ * 'create' is set (NULL if it doesn't exist otherwise) */
+static uint8_t **page_slot(uint32_t address, int create)
+{
+    uint32_t l1 = address >> (PAGE_SHIFT + L2_BITS);
+    uint32_t l2 = (address >> PAGE_SHIFT) & (L2_ENTRIES - 1);
+
+    uint8_t **table = page_table[l1];
+    if (!table) {
+        if (!create)
+            return NULL;
+        table = calloc(L2_ENTRIES, sizeof(uint8_t *));
+        page_table[l1] = table;
+        tables_allocated++;
+    }
+    return &table[l2];
+}
 
 /***************************************************************/
 /*                                                             */
-/* Procedure: mem_read_32                                      */
+/* Procedure: mem_page                                         */
 /*                                                             */
-/* Purpose: Read a 32-bit word from memory                     */
+/* Purpose: Host address of the page holding 'address'. If the */
+/*          page is untouched, it is created when 'create' is  */
+/*          set, otherwise NULL is returned.                   */
 /*                                                             */
 /***************************************************************/
-uint32_t mem_read_32(uint32_t address)
+uint8_t *mem_page(uint32_t address, int create)
+{
+    uint8_t **slot = page_slot(address, create);
+    if (!slot)
+        return NULL;
+
+    if (!*slot && create)
+        *slot = alloc_page_frame();
+    return *slot;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_map_pages                                    */
+/*                                                             */
+/* Purpose: Use 'npages' pages of host memory starting at      */
+/*          'host' (e.g. a private mapping of a program image) */
+/*          as the frames of the pages starting at the         */
+/*          page-aligned 'address'. The host memory must stay  */
+/*          mapped.                                            */
+/*                                                             */
+/***************************************************************/
+void mem_map_pages(uint32_t address, uint8_t *host, uint32_t npages)
+{
+    uint32_t i;
+
+    for (i = 0; i < npages; i++) {
+        uint8_t **slot = page_slot(address + i * PAGE_SIZE, TRUE);
+
+        /* a reset maps an unchanged image's frames again */
+        if (*slot != host + i * PAGE_SIZE)
+            pages_mapped++;
+        *slot = host + i * PAGE_SIZE;
+    }
+
+    /* frames may have been replaced */
+    mem_tlb_flush();
+}
+
+/* Host-side translation cache: the host frames of recently used pages,
+ * direct-mapped by page number, so that the common access costs one tag
+ * compare instead of a page-table walk. Only existing frames are cached.
+ * Writes use their own cache, filled only once a page has been marked
+ * dirty, so that dirty tracking costs nothing on the fast path. Each host
+ * thread has its own; they are all invalidated by bumping mem_epoch
+ * whenever frames are dropped or replaced, or dirty pages are cleaned. */
+#define TLB_ENTRIES 256
+
+typedef struct {
+    uint32_t vpage;
+    uint8_t *frame;
+} tlb_entry_t;
+
+static _Thread_local tlb_entry_t mem_tlb[TLB_ENTRIES], mem_wtlb[TLB_ENTRIES];
+static _Thread_local uint32_t mem_tlb_epoch;
+static uint32_t mem_epoch = 1;
+
+/* Pages written since the last mem_reset (one bit per page, plus a list so
+ * that a reset only visits those). Only one thread writes memory at a time:
+ * during multicore quanta stores go to the per-core store logs. */
+static uint32_t page_dirty[(1 << (32 - PAGE_SHIFT)) / 32];
+static uint32_t *dirty_pages, ndirty, dirty_cap;
+
+void mem_tlb_flush()
+{
+    mem_epoch++;
+}
+
+static void mem_tlb_check_epoch()
 {
     int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
-        if (address >= MEM_REGIONS[i].start &&
-                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-            uint32_t offset = address - MEM_REGIONS[i].start;
-
-            return
-                (MEM_REGIONS[i].mem[offset+3] << 24) |
-                (MEM_REGIONS[i].mem[offset+2] << 16) |
-                (MEM_REGIONS[i].mem[offset+1] <<  8) |
-                (MEM_REGIONS[i].mem[offset+0] <<  0);
+
+    if (mem_tlb_epoch != mem_epoch) {
+        for (i = 0; i < TLB_ENTRIES; i++) {
+            mem_tlb[i].vpage = 0xFFFFFFFF;
+            mem_wtlb[i].vpage = 0xFFFFFFFF;
+        }
+        mem_tlb_epoch = mem_epoch;
+    }
+}
+
+static uint8_t *mem_translate_slow(uint32_t address)
+{
+    mem_tlb_check_epoch();
+
+    uint8_t *frame = mem_page(address, FALSE);
+    if (frame) {
+        tlb_entry_t *e = &mem_tlb[(address >> PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+        e->vpage = address >> PAGE_SHIFT;
+        e->frame = frame;
+    }
+    return frame;
+}
+
+static inline uint8_t *mem_translate(uint32_t address)
+{
+    tlb_entry_t *e = &mem_tlb[(address >> PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+    if (e->vpage == (address >> PAGE_SHIFT) && mem_tlb_epoch == mem_epoch)
+        return e->frame;
+    return mem_translate_slow(address);
+}
+
+static uint8_t *mem_translate_write_slow(uint32_t address)
+{
+    uint32_t vpage = address >> PAGE_SHIFT;
+
+    mem_tlb_check_epoch();
+
+    if (!(page_dirty[vpage / 32] & (1u << (vpage % 32)))) {
+        page_dirty[vpage / 32] |= 1u << (vpage % 32);
+        if (ndirty == dirty_cap) {
+            dirty_cap = dirty_cap ? 2 * dirty_cap : 1024;
+            dirty_pages = realloc(dirty_pages, dirty_cap * sizeof(uint32_t));
         }
+        dirty_pages[ndirty++] = vpage;
     }
 
-    return 0;
+    uint8_t *frame = mem_page(address, TRUE);
+    tlb_entry_t *e = &mem_wtlb[vpage & (TLB_ENTRIES - 1)];
+    e->vpage = vpage;
+    e->frame = frame;
+    return frame;
+}
+
+/* host address of a page about to be written (created if needed) */
+static inline uint8_t *mem_translate_write(uint32_t address)
+{
+    tlb_entry_t *e = &mem_wtlb[(address >> PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+    if (e->vpage == (address >> PAGE_SHIFT) && mem_tlb_epoch == mem_epoch)
+        return e->frame;
+    return mem_translate_write_slow(address);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_reset                                        */
+/*                                                             */
+/* Purpose: Zero every page written since the last reset, so   */
+/*          that memory looks untouched again at a cost        */
+/*          proportional to what was written. Returns the      */
+/*          number of pages cleaned.                           */
+/*                                                             */
+/***************************************************************/
+uint32_t mem_reset()
+{
+    uint32_t i, cleaned = ndirty;
+
+    for (i = 0; i < ndirty; i++) {
+        uint32_t vpage = dirty_pages[i];
+        uint8_t *frame = mem_page(vpage << PAGE_SHIFT, FALSE);
+        if (frame)
+            memset(frame, 0, PAGE_SIZE);
+        page_dirty[vpage / 32] &= ~(1u << (vpage % 32));
+    }
+    ndirty = 0;
+
+    /* pages must be marked dirty again when next written */
+    mem_tlb_flush();
+    return cleaned;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_unmap_pages                                  */
+/*                                                             */
+/* Purpose: Undo mem_map_pages: the 'npages' pages starting at */
+/*          'address' read as untouched again, and are no      */
+/*          longer dirty.                                      */
+/*                                                             */
+/***************************************************************/
+void mem_unmap_pages(uint32_t address, uint32_t npages)
+{
+    uint32_t first = address >> PAGE_SHIFT, i, n = 0;
+
+    if (npages == 0)
+        return;
+    for (i = 0; i < npages; i++) {
+        uint32_t vpage = first + i;
+        uint8_t **slot = page_slot(vpage << PAGE_SHIFT, FALSE);
+
+        if (slot && *slot) {
+            *slot = NULL;
+            pages_mapped--;
+        }
+        page_dirty[vpage / 32] &= ~(1u << (vpage % 32));
+    }
+    for (i = 0; i < ndirty; i++)
+        if (dirty_pages[i] - first >= npages)
+            dirty_pages[n++] = dirty_pages[i];
+    ndirty = n;
+
+    /* second-level tables left empty go as well */
+    for (i = first >> L2_BITS; i <= (first + npages - 1) >> L2_BITS; i++) {
+        uint32_t l2 = 0;
+        if (!page_table[i])
+            continue;
+        while (l2 < L2_ENTRIES && !page_table[i][l2])
+            l2++;
+        if (l2 == L2_ENTRIES) {
+            free(page_table[i]);
+            page_table[i] = NULL;
+            tables_allocated--;
+        }
+    }
+
+    mem_tlb_flush();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_dirty_list                                   */
+/*                                                             */
+/* Purpose: Point 'pages' at the numbers of the pages written  */
+/*          since the last reset, in the order they were first */
+/*          written, and return how many there are.            */
+/*                                                             */
+/***************************************************************/
+uint32_t mem_dirty_list(const uint32_t **pages)
+{
+    *pages = dirty_pages;
+    return ndirty;
+}
+
+/* simulated memory is little-endian; a single host load/store suffices on
+ * little-endian hosts */
+static inline uint32_t load_le(const uint8_t *p, int size)
+{
+    uint32_t value = 0;
+    memcpy(&value, p, size);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value) >> (32 - 8 * size);
+#endif
+    return value;
+}
+
+static inline void store_le(uint8_t *p, uint32_t value, int size)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value << (32 - 8 * size));
+#endif
+    memcpy(p, &value, size);
+}
+
+/* Naturally aligned accesses never straddle a page: read 'size' bytes at
+ * 'address' as seen by the calling core (merging its buffered stores during
+ * a multicore quantum). */
+static inline uint32_t mem_read_aligned(uint32_t address, int size)
+{
+    uint8_t *page = mem_translate(address);
+    uint32_t value = page ? load_le(page + (address & (PAGE_SIZE - 1)), size) : 0;
+
+    if (core_store_log) {
+        uint32_t shift = 8 * (address & 3);
+        value = store_log_read(core_store_log, address & ~3, value << shift) >> shift;
+        if (size < 4)
+            value &= (1u << (8 * size)) - 1;
+    }
+    return value;
+}
+
+static inline void mem_write_aligned(uint32_t address, uint32_t value, int size)
+{
+    /* a core in a multicore quantum buffers its stores until the end of the
+     * quantum */
+    if (core_store_log) {
+        uint32_t shift = 8 * (address & 3);
+        uint32_t mask = size == 4 ? 0xFFFFFFFF : ((1u << (8 * size)) - 1) << shift;
+        store_log_write(core_store_log, address & ~3, value << shift, mask);
+        return;
+    }
+
+    store_le(mem_translate_write(address) + (address & (PAGE_SIZE - 1)), value, size);
+}
+
+/* unaligned words (e.g. from mdump) may straddle two pages; kept out of
+ * line so that the aligned fast paths stay leaf-like */
+static __attribute__((noinline)) uint32_t mem_read_unaligned(uint32_t address)
+{
+    uint32_t value = 0;
+    int i;
+    for (i = 3; i >= 0; i--)
+        value = (value << 8) | mem_read_aligned(address + i, 1);
+    return value;
+}
+
+static __attribute__((noinline)) void mem_write_unaligned(uint32_t address, uint32_t value)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+        mem_write_aligned(address + i, (value >> (8 * i)) & 0xFF, 1);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_read_32                                      */
+/*                                                             */
+/* Purpose: Read a 32-bit word from memory                     */
+/*                                                             */
+/***************************************************************/
+uint32_t mem_read_32(uint32_t address)
+{
+    if (address & 3)
+        return mem_read_unaligned(address);
+    return mem_read_aligned(address, 4);
 }
 
 /***************************************************************/
@@ -95,19 +477,87 @@ uint32_t mem_read_32(uint32_t address)
 /***************************************************************/
 void mem_write_32(uint32_t address, uint32_t value)
 {
-    int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
+    if (address & 3)
+        mem_write_unaligned(address, value);
+    else
+        mem_write_aligned(address, value, 4);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_read_16 / mem_read_8                         */
+/*                                                             */
+/* Purpose: Read a halfword (address must be even) or a byte   */
+/*                                                             */
+/***************************************************************/
+uint16_t mem_read_16(uint32_t address)
+{
+    return mem_read_aligned(address, 2);
+}
+
+uint8_t mem_read_8(uint32_t address)
+{
+    return mem_read_aligned(address, 1);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_write_16 / mem_write_8                       */
+/*                                                             */
+/* Purpose: Write a halfword (address must be even) or a byte  */
+/*                                                             */
+/***************************************************************/
+void mem_write_16(uint32_t address, uint16_t value)
+{
+    mem_write_aligned(address, value, 2);
+}
+
+void mem_write_8(uint32_t address, uint8_t value)
+{
+    mem_write_aligned(address, value, 1);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_usage_report                                 */
+/*                                                             */
+/* Purpose: Print how much of the address space was touched    */
+/*                                                             */
+/***************************************************************/
+void mem_usage_report() {
+  uint32_t region_pages[MEM_NREGIONS] = { 0 };
+  uint32_t other_pages = 0;
+  uint32_t l1, l2;
+  int i;
+
+  for (l1 = 0; l1 < L1_ENTRIES; l1++) {
+    if (!page_table[l1])
+      continue;
+    for (l2 = 0; l2 < L2_ENTRIES; l2++) {
+      if (!page_table[l1][l2])
+        continue;
+      uint32_t address = (l1 << (PAGE_SHIFT + L2_BITS)) | (l2 << PAGE_SHIFT);
+      for (i = 0; i < MEM_NREGIONS; i++)
         if (address >= MEM_REGIONS[i].start &&
-                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-            uint32_t offset = address - MEM_REGIONS[i].start;
-
-            MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-            MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-            MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-            MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
-            return;
-        }
+            address - MEM_REGIONS[i].start < MEM_REGIONS[i].size)
+          break;
+      if (i < MEM_NREGIONS)
+        region_pages[i]++;
+      else
+        other_pages++;
     }
+  }
+
+  printf("\nMemory usage: %u pages touched (%u KB), %u page tables, "
+         "%u host chunks mapped (%u KB, %u huge)\n",
+         pages_allocated, pages_allocated * (PAGE_SIZE / 1024), tables_allocated,
+         chunks_mapped, chunks_mapped * (CHUNK_SIZE / 1024), huge_chunks);
+  if (pages_mapped)
+    printf("  (plus %u pages mapped from program images)\n", pages_mapped);
+  for (i = 0; i < MEM_NREGIONS; i++)
+    printf("  %-6s 0x%08x: %u pages\n", MEM_REGIONS[i].name, MEM_REGIONS[i].start,
+           region_pages[i]);
+  printf("  %-6s           : %u pages\n", "other", other_pages);
 }
 
 /***************************************************************/
@@ -122,8 +572,25 @@ void help() {
   printf("go                     -  run program to completion         \n");
   printf("run n                  -  execute program for n instructions\n");
   printf("rdump                  -  dump architectural registers      \n");
+  printf("reset                  -  reset the machine, reload program \n");
   printf("mdump low high         -  dump memory from low to high      \n");
+  printf("disasm low high        -  disassemble memory from low to high\n");
   printf("input reg_no reg_value - set GPR reg_no to reg_value  \n");
+  printf("sample                 -  run to completion, simulating sampled units\n");
+  printf("simpoint               -  estimate the program's statistics from its phases\n");
+  printf("parallel               -  run to completion, time-parallel on host threads\n");
+  printf("fastforward n          -  execute n instructions functionally, warming at the end\n");
+  printf("roi                    -  fast-forward to the region of interest, simulate it\n");
+  printf("trace file | off       -  trace retired instructions to file\n");
+  printf("replay file            -  run a trace through the caches and predictor\n");
+  printf("mrc                    -  miss-ratio curves of the program for all cache sizes\n");
+  printf("sweep key=v1,v2 ...    -  run the program once through many cache/predictor configs\n");
+  printf("set name value         -  set a model parameter             \n");
+  printf("config                 -  list model parameters             \n");
+  printf("membench n             -  time n accesses per memory accessor\n");
+  printf("loadbench n            -  time n loads of the program per loader\n");
+  printf("opbench n              -  time scans over n in-flight pipeline ops\n");
+  printf("isabench n             -  time n decode/execute passes over the program\n");
   printf("?                      -  display this help menu            \n");
   printf("quit                   -  exit the program                  \n\n");
 }
@@ -132,13 +599,18 @@ void help() {
 /*                                                             */
 /* Procedure : cycle                                           */
 /*                                                             */
-/* Purpose   : Execute a cycle                                 */
+/* Purpose   : Execute a cycle, or skip ahead over up to max  */
+/*             cycles in which the core is idle. Returns the   */
+/*             number of cycles that passed.                   */
 /*                                                             */
 /***************************************************************/
-void cycle() {                                                
+int cycle(int max) {                                                
+  int n = pipe_skip_idle(max - 1);
+
   pipe_cycle();
 
-  stat_cycles++;
+  stat_cycles += n + 1;
+  return n + 1;
 }
 
 /***************************************************************/
@@ -151,18 +623,23 @@ void cycle() {
 void run(int num_cycles) {                                      
   int i;
 
+  if (config.cores > 1) {
+    multicore_run(num_cycles);
+    return;
+  }
+
   if (RUN_BIT == FALSE) {
     printf("Can't simulate, Simulator is halted\n\n");
     return;
   }
 
   printf("Simulating for %d cycles...\n\n", num_cycles);
-  for (i = 0; i < num_cycles; i++) {
+  for (i = 0; i < num_cycles; ) {
     if (RUN_BIT == FALSE) {
 	    printf("Simulator halted\n\n");
 	    break;
     }
-    cycle();
+    i += cycle(num_cycles - i);
   }
 }
 
@@ -174,6 +651,11 @@ void run(int num_cycles) {
 /*                                                             */
 /***************************************************************/
 void go() {                                                     
+  if (config.cores > 1) {
+    multicore_go();
+    return;
+  }
+
   if (RUN_BIT == FALSE) {
     printf("Can't simulate, Simulator is halted\n\n");
     return;
@@ -181,10 +663,46 @@ void go() {
 
   printf("Simulating...\n\n");
   while (RUN_BIT)
-    cycle();
+    cycle(INT_MAX);
   printf("Simulator halted\n\n");
 }
 
+/***************************************************************/ 
+/*                                                             */
+/* Procedure : stats_dump                                      */
+/*                                                             */
+/* Purpose   : Dump the statistics (the end of rdump)          */
+/*                                                             */
+/***************************************************************/
+void stats_dump() {
+    printf("Cycles: %u\n", stat_cycles);
+    printf("FetchedInstr: %u\n", stat_inst_fetch);
+    printf("RetiredInstr: %u\n", stat_inst_retire);
+    printf("IPC: %0.3f\n", ((float) stat_inst_retire) / stat_cycles);
+    printf("Flushes: %u\n", stat_squash);
+    if (config.core == CORE_INORDER) {
+        printf("Bypasses: ex %u mem %u wb %u\n", pipe_stats.bypass_ex,
+               pipe_stats.bypass_mem, pipe_stats.bypass_wb);
+        printf("ExecStalls: load-use %u data %u no-bypass %u hilo %u unit %u mem %u\n",
+               pipe_stats.stall_load_use, pipe_stats.stall_data,
+               pipe_stats.stall_no_bypass, pipe_stats.stall_hilo,
+               pipe_stats.stall_unit, pipe_stats.stall_mem);
+        if (config.ftq > 0) {
+            printf("FrontEnd: bubbles icache %u ftq-empty %u resteers %u, occupancy ftq %0.2f ibuf %0.2f\n",
+                   pipe_stats.fe_bubble_icache, pipe_stats.fe_bubble_ftq, pipe_stats.fe_resteer,
+                   stat_cycles ? (double) pipe_stats.ftq_occupancy / stat_cycles : 0.0,
+                   stat_cycles ? (double) pipe_stats.ibuf_occupancy / stat_cycles : 0.0);
+        }
+        if (config.store_buffer > 0) {
+            uint32_t fwd = pipe_stats.sb_forward + pipe_stats.sb_forward_part;
+            printf("StoreBuffer: full-stalls %u loads %u forwarded %u (partial %u) rate %0.3f\n",
+                   pipe_stats.sb_full, pipe_stats.sb_loads, fwd, pipe_stats.sb_forward_part,
+                   pipe_stats.sb_loads ? (float) fwd / pipe_stats.sb_loads : 0.0);
+        }
+    }
+    multicore_dump();
+}
+
 /***************************************************************/ 
 /*                                                             */
 /* Procedure : rdump                                           */
@@ -195,7 +713,11 @@ void go() {
 void rdump() {
     int i;
 
-    printf("PC: 0x%08x\n", pipe.PC);
+    const Elf_Symbol *sym = elf_symbol_at(pipe.PC);
+    if (sym)
+        printf("PC: 0x%08x <%s+0x%x>\n", pipe.PC, sym->name, pipe.PC - sym->addr);
+    else
+        printf("PC: 0x%08x\n", pipe.PC);
 
     for (i = 0; i < 32; i++) {
         printf("R%d: 0x%08x\n", i, pipe.REGS[i]);
@@ -203,11 +725,7 @@ void rdump() {
 
     printf("HI: 0x%08x\n", pipe.HI);
     printf("LO: 0x%08x\n", pipe.LO);
-    printf("Cycles: %u\n", stat_cycles);
-    printf("FetchedInstr: %u\n", stat_inst_fetch);
-    printf("RetiredInstr: %u\n", stat_inst_retire);
-    printf("IPC: %0.3f\n", ((float) stat_inst_retire) / stat_cycles);
-    printf("Flushes: %u\n", stat_squash);
+    stats_dump();
 }
 
 /***************************************************************/ 
@@ -228,6 +746,35 @@ void mdump(int start, int stop) {
   printf("\n");
 }
 
+/***************************************************************/
+/*                                                             */
+/* Procedure : disasm                                          */
+/*                                                             */
+/* Purpose   : Disassemble a word-aligned region of memory,    */
+/*             labelling symbol starts.                        */
+/*                                                             */
+/***************************************************************/
+void disasm(int start, int stop) {
+  char text[64];
+  int address;
+
+  printf("\n");
+  for (address = start & ~3; address <= stop; address += 4) {
+    uint32_t word = mem_read_32(address);
+    const Elf_Symbol *sym = elf_symbol_at(address);
+
+    if (sym && sym->addr == (uint32_t)address)
+      printf("<%s>:\n", sym->name);
+    isa_disasm(address, word, text, sizeof(text));
+    printf("  0x%08x : %08x  %s\n", address, word, text);
+  }
+  printf("\n");
+}
+
+/* the first .x program loaded, and its length (for the benchmarks) */
+static char *text_program;
+static int text_words;
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : get_command                                     */
@@ -236,7 +783,7 @@ void mdump(int start, int stop) {
 /*                                                             */
 /***************************************************************/
 void get_command() {
-  char buffer[20];
+  char buffer[20], name[32], value[32], path[256], line[512];
   int start, stop, cycles;
   int register_no, register_value;
 
@@ -255,6 +802,15 @@ void get_command() {
 
   case 'M':
   case 'm':
+    if (strcmp(buffer, "mrc") == 0) {
+        mrc_go();
+        break;
+    }
+    if (strcmp(buffer, "membench") == 0) {
+        if (scanf("%i", &cycles) != 1) break;
+        bench_memory(cycles);
+        break;
+    }
     if (scanf("%i %i", &start, &stop) != 2)
         break;
 
@@ -264,6 +820,65 @@ void get_command() {
   case '?':
     help();
     break;
+
+  case 'S':
+  case 's':
+    if (strcmp(buffer, "sample") == 0) {
+        sample_go();
+        break;
+    }
+    if (strcmp(buffer, "simpoint") == 0) {
+        simpoint_go();
+        break;
+    }
+    if (strcmp(buffer, "sweep") == 0) {
+        if (fgets(line, sizeof(line), stdin))
+            sweep_go(line);
+        break;
+    }
+    if (scanf("%31s %31s", name, value) != 2)
+        break;
+
+    config_set(name, value);
+    break;
+
+  case 'P':
+  case 'p':
+    if (strcmp(buffer, "parallel") == 0)
+        parallel_go();
+    break;
+
+  case 'F':
+  case 'f':
+    if (strcmp(buffer, "fastforward") != 0 || scanf("%i", &cycles) != 1)
+        break;
+    fastforward(cycles);
+    break;
+
+  case 'T':
+  case 't':
+    if (strcmp(buffer, "trace") != 0 || scanf("%255s", path) != 1)
+        break;
+    if (strcmp(path, "off") == 0)
+        trace_close();
+    else
+        trace_open(path);
+    break;
+
+  case 'C':
+  case 'c':
+    config_dump();
+    break;
+  case 'O':
+  case 'o':
+    if (strcmp(buffer, "opbench") != 0) {
+        printf("Invalid Command\n");
+        break;
+    }
+    if (scanf("%i", &cycles) != 1) break;
+    bench_ops(cycles);
+    break;
+
   case 'Q':
   case 'q':
     printf("Bye.\n");
@@ -271,7 +886,15 @@ void get_command() {
 
   case 'R':
   case 'r':
-    if (buffer[1] == 'd' || buffer[1] == 'D')
+    if (strcmp(buffer, "reset") == 0)
+        reset();
+    else if (strcmp(buffer, "roi") == 0)
+        roi_go();
+    else if (strcmp(buffer, "replay") == 0) {
+        if (scanf("%255s", path) != 1) break;
+        replay(path);
+    }
+    else if (buffer[1] == 'd' || buffer[1] == 'D')
         rdump();
     else {
 	    if (scanf("%d", &cycles) != 1) break;
@@ -279,8 +902,21 @@ void get_command() {
     }
     break;
 
+  case 'D':
+  case 'd':
+    if (scanf("%i %i", &start, &stop) != 2)
+        break;
+
+    disasm(start, stop);
+    break;
+
   case 'I':
   case 'i':
+   if (strcmp(buffer, "isabench") == 0) {
+      if (scanf("%i", &cycles) != 1) break;
+      bench_isa(MEM_TEXT_START, text_program ? text_words : 0, cycles);
+      break;
+   }
    if (scanf("%i %i", &register_no, &register_value) != 2)
       break;
    
@@ -298,6 +934,11 @@ void get_command() {
   
   case 'L':
   case 'l':
+   if (strcmp(buffer, "loadbench") == 0) {
+      if (scanf("%i", &cycles) != 1) break;
+      bench_load(text_program, MEM_TEXT_START, cycles);
+      break;
+   }
    if (scanf("%i", &register_value) != 1)
       break;
 
@@ -314,15 +955,17 @@ void get_command() {
 /*                                                             */
 /* Procedure : init_memory                                     */
 /*                                                             */
-/* Purpose   : Allocate and zero memoryy                       */
+/* Purpose   : Set up memory. Pages are created lazily, so     */
+/*             this only arranges the usage report at exit.    */
 /*                                                             */
 /***************************************************************/
+static void report_at_exit() {
+  if (config.mem_report)
+    mem_usage_report();
+}
+
 void init_memory() {                                           
-    int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
-        MEM_REGIONS[i].mem = malloc(MEM_REGIONS[i].size);
-        memset(MEM_REGIONS[i].mem, 0, MEM_REGIONS[i].size);
-    }
+  atexit(report_at_exit);
 }
 
 /**************************************************************/
@@ -333,25 +976,24 @@ void init_memory() {
 /*                                                            */
 /**************************************************************/
 void load_program(char *program_filename) {                   
-  FILE * prog;
-  int ii, word;
+  int words;
+
+  /* ELF executables and program images are recognized by their header */
+  if (elf_load(program_filename) == 0 || image_load(program_filename) == 0)
+    return;
 
-  /* Open program file. */
-  prog = fopen(program_filename, "r");
-  if (prog == NULL) {
+  /* Otherwise a .x file, converted through the image cache */
+  words = text_load(program_filename, MEM_TEXT_START, TRUE);
+  if (words < 0) {
     printf("Error: Can't open program file %s\n", program_filename);
     exit(-1);
   }
-
-  /* Read in the program. */
-
-  ii = 0;
-  while (fscanf(prog, "%x\n", &word) != EOF) {
-    mem_write_32(MEM_TEXT_START + ii, word);
-    ii += 4;
+  if (!text_program) {
+    text_program = program_filename;
+    text_words = words;
   }
 
-  printf("Read %d words from program into memory.\n\n", ii/4);
+  printf("Read %d words from program into memory.\n\n", words);
 }
 
 /************************************************************/
@@ -362,19 +1004,53 @@ void load_program(char *program_filename) {
 /*             and set up initial state of the machine.     */
 /*                                                          */
 /************************************************************/
-void initialize(char *program_filename, int num_prog_files) { 
+static char *program_files; /* the program file names, one after another */
+static int num_program_files;
+
+static void load_program_files() {
+  char *program_filename = program_files;
   int i;
 
-  init_memory();
-  pipe_init();
-  for ( i = 0; i < num_prog_files; i++ ) {
+  for ( i = 0; i < num_program_files; i++ ) {
     load_program(program_filename);
     while(*program_filename++ != '\0');
   }
+}
+
+void initialize(char *program_filename, int num_prog_files) { 
+  init_memory();
+  pipe_init();
+  program_files = program_filename;
+  num_program_files = num_prog_files;
+  load_program_files();
     
   RUN_BIT = TRUE;
 }
 
+/************************************************************/
+/*                                                          */
+/* Procedure : reset                                        */
+/*                                                          */
+/* Purpose   : Return to the state right after startup:     */
+/*             clean the pages the last run wrote, clear    */
+/*             all core state and statistics, and reload    */
+/*             the program. The loaders replace or reuse    */
+/*             their mappings of the program files, so      */
+/*             repeated resets don't accumulate them.       */
+/*                                                          */
+/************************************************************/
+void reset() {
+  uint32_t pages = mem_reset();
+
+  pipe_reset();
+  stat_cycles = stat_inst_retire = stat_inst_fetch = stat_squash = 0;
+  load_program_files();
+  RUN_BIT = TRUE;
+  multicore_reset();
+
+  printf("Reset: cleaned %u dirty pages.\n\n", pages);
+}
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : main                                            */
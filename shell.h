@@ -20,13 +20,38 @@
 #define FALSE 0
 #define TRUE  1
 
-extern int RUN_BIT;	/* run bit */
+extern _Thread_local int RUN_BIT;	/* run bit (per core) */
 
 /* only the cache touches these functions */
 uint32_t mem_read_32(uint32_t address);
 void     mem_write_32(uint32_t address, uint32_t value);
+uint16_t mem_read_16(uint32_t address);
+void     mem_write_16(uint32_t address, uint16_t value);
+uint8_t  mem_read_8(uint32_t address);
+void     mem_write_8(uint32_t address, uint8_t value);
+
+/* simulated memory is made of 4 KB pages, created on first write */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  (1 << PAGE_SHIFT)
+uint8_t *mem_page(uint32_t address, int create);
+void     mem_map_pages(uint32_t address, uint8_t *host, uint32_t npages);
+void     mem_unmap_pages(uint32_t address, uint32_t npages);
+void     mem_tlb_flush(); /* call after dropping or replacing page frames */
+uint32_t mem_reset();     /* zero the pages written since the last reset */
+uint32_t mem_dirty_list(const uint32_t **pages); /* ... and list them */
+void     mem_usage_report();
+
+/* simulate one cycle of the current core, first skipping idle cycles
+ * (at most max - 1 of them); returns the number of cycles simulated */
+int cycle(int max);
+
+/* reset the machine and reload the program */
+void reset();
+
+/* print the statistics, as at the end of rdump */
+void stats_dump();
 
 /* statistics */
-extern uint32_t stat_cycles, stat_inst_retire, stat_inst_fetch, stat_squash;
+extern _Thread_local uint32_t stat_cycles, stat_inst_retire, stat_inst_fetch, stat_squash;
 
 #endif
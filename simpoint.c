@@ -0,0 +1,351 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * SimPoint phase analysis. See simpoint.h.
+ */
+
+#include "simpoint.h"
+#include "sample.h"
+#include "pipe.h"
+#include "shell.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SIMPOINT_MAX_K  64   /* limit of config.simpoint_max_k */
+#define SIMPOINT_SEEDS  5    /* k-means runs per k; the tightest is kept */
+#define SIMPOINT_ITERS  100  /* k-means iterations at most */
+#define SIMPOINT_LOG_2PI 1.8378770664093453
+
+typedef double Simpoint_Vector[SIMPOINT_DIMS];
+
+/* one projected basic-block vector per whole interval */
+static Simpoint_Vector *bbv;
+static int nintervals, intervals_max;
+
+/* a simulation point: the interval representing a phase */
+typedef struct Simpoint {
+    int interval;
+    double weight;  /* fraction of the intervals in its phase */
+    int measured;
+    Sample s;
+} Simpoint;
+
+/* entry d of the random projection of basic block 'pc': a hash of both,
+ * spread over [-1, 1) */
+static double simpoint_project(uint32_t pc, int d)
+{
+    uint32_t h = (pc >> 2) * 0x9e3779b1u ^ (uint32_t)(d + 1) * 0x85ebca6bu;
+
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    h *= 0x297a2d39u;
+    h ^= h >> 15;
+    return h / 2147483648.0 - 1.0;
+}
+
+static void simpoint_count(double *v, uint32_t block, uint32_t n)
+{
+    for (int d = 0; d < SIMPOINT_DIMS; d++)
+        v[d] += n * simpoint_project(block, d);
+}
+
+static void simpoint_add(const double *v)
+{
+    if (nintervals == intervals_max) {
+        intervals_max = intervals_max ? 2 * intervals_max : 256;
+        bbv = realloc(bbv, intervals_max * sizeof(Simpoint_Vector));
+        if (!bbv) {
+            printf("Error: out of memory for basic-block vectors\n");
+            exit(-1);
+        }
+    }
+    memcpy(bbv[nintervals++], v, sizeof(Simpoint_Vector));
+}
+
+/* functional pass: record the basic-block vector of every whole interval;
+ * returns the instructions executed */
+static uint64_t simpoint_profile(uint32_t interval)
+{
+    Simpoint_Vector v = { 0 };
+    uint64_t insts = 0;
+    uint32_t block = pipe.PC, block_len = 0, in_interval = 0;
+
+    nintervals = 0;
+    while (RUN_BIT) {
+        uint32_t pc = pipe.PC;
+        pipe_step(0);
+        insts++;
+        block_len++;
+        in_interval++;
+        if (pipe.PC != pc + 4 || in_interval == interval) {
+            simpoint_count(v, block, block_len);
+            block_len = 0;
+            if (pipe.PC != pc + 4)
+                block = pipe.PC;
+        }
+        if (in_interval == interval) {
+            for (int d = 0; d < SIMPOINT_DIMS; d++)
+                v[d] /= interval;
+            simpoint_add(v);
+            memset(v, 0, sizeof(v));
+            in_interval = 0;
+        }
+    }
+    return insts;
+}
+
+static double simpoint_dist(const double *a, const double *b)
+{
+    double sum = 0;
+
+    for (int d = 0; d < SIMPOINT_DIMS; d++)
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    return sum;
+}
+
+static uint32_t simpoint_rand(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+/* cluster the intervals into k, seeded by k-means++; fills assign and
+ * cent and returns the sum of squared distances to the centroids */
+static double simpoint_kmeans(int k, uint32_t seed, int *assign, Simpoint_Vector *cent)
+{
+    double *d2 = malloc(nintervals * sizeof(double));
+    int count[SIMPOINT_MAX_K];
+    uint32_t state = seed;
+    double distortion = 0;
+
+    /* each further centre is an interval picked with probability
+     * proportional to its squared distance from the nearest one so far */
+    memcpy(cent[0], bbv[simpoint_rand(&state) % nintervals], sizeof(Simpoint_Vector));
+    for (int i = 0; i < nintervals; i++)
+        d2[i] = simpoint_dist(bbv[i], cent[0]);
+    for (int c = 1; c < k; c++) {
+        double r = 0;
+        int pick = nintervals - 1;
+
+        for (int i = 0; i < nintervals; i++)
+            r += d2[i];
+        r *= simpoint_rand(&state) / 16777216.0;
+        for (int i = 0; i < nintervals; i++) {
+            r -= d2[i];
+            if (r < 0) {
+                pick = i;
+                break;
+            }
+        }
+        memcpy(cent[c], bbv[pick], sizeof(Simpoint_Vector));
+        for (int i = 0; i < nintervals; i++)
+            d2[i] = fmin(d2[i], simpoint_dist(bbv[i], cent[c]));
+    }
+    free(d2);
+
+    for (int iter = 0; iter < SIMPOINT_ITERS; iter++) {
+        int changed = 0;
+
+        for (int i = 0; i < nintervals; i++) {
+            int best = 0;
+            double best_dist = simpoint_dist(bbv[i], cent[0]);
+            for (int c = 1; c < k; c++) {
+                double dist = simpoint_dist(bbv[i], cent[c]);
+                if (dist < best_dist) {
+                    best = c;
+                    best_dist = dist;
+                }
+            }
+            if (iter == 0 || assign[i] != best)
+                changed = 1;
+            assign[i] = best;
+        }
+        if (!changed)
+            break;
+
+        /* an emptied cluster keeps its centre */
+        memset(count, 0, sizeof(count));
+        for (int i = 0; i < nintervals; i++)
+            if (count[assign[i]]++ == 0)
+                memset(cent[assign[i]], 0, sizeof(Simpoint_Vector));
+        for (int i = 0; i < nintervals; i++)
+            for (int d = 0; d < SIMPOINT_DIMS; d++)
+                cent[assign[i]][d] += bbv[i][d] / count[assign[i]];
+    }
+
+    for (int i = 0; i < nintervals; i++)
+        distortion += simpoint_dist(bbv[i], cent[assign[i]]);
+    return distortion;
+}
+
+/* BIC of a clustering, from the likelihood of the intervals under
+ * identical spherical Gaussians at the centroids (Pelleg and Moore) */
+static double simpoint_bic(int k, const int *assign, double distortion)
+{
+    int count[SIMPOINT_MAX_K] = { 0 };
+    double r = nintervals, m = SIMPOINT_DIMS;
+    double variance = nintervals > k ? distortion / (nintervals - k) : 0;
+    double likelihood = 0;
+
+    if (variance < 1e-12)
+        variance = 1e-12;
+    for (int i = 0; i < nintervals; i++)
+        count[assign[i]]++;
+    for (int c = 0; c < k; c++) {
+        double n = count[c];
+        if (n == 0)
+            continue;
+        likelihood += n * log(n) - n * log(r) - n / 2 * SIMPOINT_LOG_2PI
+                    - n * m / 2 * log(variance) - (n - k) / 2;
+    }
+    return likelihood - ((k - 1) + m * k + 1) / 2 * log(r);
+}
+
+/* cluster for every k, keep the smallest whose BIC reaches 90% of the
+ * range seen, and fill in its representatives; returns their number */
+static int simpoint_choose(Simpoint *points)
+{
+    int max_k = config.simpoint_max_k < nintervals ? config.simpoint_max_k : nintervals;
+    int *assign = malloc((size_t)max_k * nintervals * sizeof(int));
+    int *trial = malloc(nintervals * sizeof(int));
+    Simpoint_Vector *cent = malloc((size_t)max_k * SIMPOINT_MAX_K * sizeof(Simpoint_Vector));
+    Simpoint_Vector trial_cent[SIMPOINT_MAX_K];
+    double bic[SIMPOINT_MAX_K + 1], lo = INFINITY, hi = -INFINITY;
+    int k;
+
+    for (k = 1; k <= max_k; k++) {
+        double best = INFINITY;
+        for (int seed = 0; seed < SIMPOINT_SEEDS; seed++) {
+            double distortion = simpoint_kmeans(k, 0x5eed + 7919 * seed, trial, trial_cent);
+            if (distortion < best) {
+                best = distortion;
+                memcpy(&assign[(k - 1) * nintervals], trial, nintervals * sizeof(int));
+                memcpy(&cent[(k - 1) * SIMPOINT_MAX_K], trial_cent, k * sizeof(Simpoint_Vector));
+            }
+        }
+        bic[k] = simpoint_bic(k, &assign[(k - 1) * nintervals], best);
+        lo = fmin(lo, bic[k]);
+        hi = fmax(hi, bic[k]);
+    }
+    for (k = 1; k < max_k; k++)
+        if (bic[k] >= lo + 0.9 * (hi - lo))
+            break;
+
+    /* each phase is represented by its interval nearest the centroid */
+    int *chosen = &assign[(k - 1) * nintervals];
+    Simpoint_Vector *centre = &cent[(k - 1) * SIMPOINT_MAX_K];
+    int npoints = 0;
+    for (int c = 0; c < k; c++) {
+        int size = 0, nearest = -1;
+        double nearest_dist = INFINITY;
+        for (int i = 0; i < nintervals; i++) {
+            if (chosen[i] != c)
+                continue;
+            size++;
+            double dist = simpoint_dist(bbv[i], centre[c]);
+            if (dist < nearest_dist) {
+                nearest = i;
+                nearest_dist = dist;
+            }
+        }
+        if (size == 0)
+            continue;
+        points[npoints].interval = nearest;
+        points[npoints].weight = (double)size / nintervals;
+        points[npoints].measured = 0;
+        npoints++;
+    }
+
+    free(assign);
+    free(trial);
+    free(cent);
+    return npoints;
+}
+
+static int simpoint_compare(const void *a, const void *b)
+{
+    return ((const Simpoint *)a)->interval - ((const Simpoint *)b)->interval;
+}
+
+/* second pass: warm functionally up to each point, simulate it in detail,
+ * and finish the program functionally */
+static void simpoint_simulate(Simpoint *points, int npoints, uint32_t interval)
+{
+    uint64_t pos = 0;
+
+    qsort(points, npoints, sizeof(Simpoint), simpoint_compare);
+    for (int p = 0; p < npoints && RUN_BIT; p++) {
+        uint64_t start = (uint64_t)points[p].interval * interval;
+        uint64_t warm = start > (uint64_t)config.sample_warmup ? start - config.sample_warmup : 0;
+
+        for (; pos < warm && RUN_BIT; pos++)
+            pipe_step(1);
+        if (RUN_BIT)
+            points[p].measured = sample_measure(start > pos ? start - pos : 0, interval,
+                                                &points[p].s, &pos);
+    }
+    while (RUN_BIT)
+        pipe_step(0);
+    pipe_resume();
+}
+
+void simpoint_go()
+{
+    uint32_t interval = config.simpoint_interval;
+    Simpoint points[SIMPOINT_MAX_K];
+
+    if (config.cores > 1) {
+        printf("SimPoint simulates a single core\n\n");
+        return;
+    }
+
+    reset();
+    uint64_t insts = simpoint_profile(interval);
+    if (nintervals == 0) {
+        printf("The program (%llu instructions) is shorter than one interval: lower simpoint_interval\n\n",
+               (unsigned long long)insts);
+        return;
+    }
+    int npoints = simpoint_choose(points);
+
+    reset();
+    simpoint_simulate(points, npoints, interval);
+
+    printf("SimPoint: %d intervals of %u instructions in %d phases\n",
+           nintervals, interval, npoints);
+    printf("  interval  weight     CPI\n");
+
+    double weight = 0, cpi = 0, fetched = 0, icache = 0, dcache = 0, flushes = 0;
+    uint64_t detailed = 0;
+    for (int p = 0; p < npoints; p++) {
+        Sample *s = &points[p].s;
+        double w = points[p].weight;
+        if (!points[p].measured)
+            continue;
+        printf("  %8d  %6.3f  %6.3f\n", points[p].interval, w, (double)s->cycles / s->insts);
+        weight += w;
+        cpi += w * s->cycles / s->insts;
+        fetched += w * s->fetched / s->insts;
+        icache += w * s->icache_miss / s->insts;
+        dcache += w * s->dcache_miss / s->insts;
+        flushes += w * s->flushes / s->insts;
+        detailed += s->insts;
+    }
+    if (weight == 0)
+        return;
+
+    /* per-instruction rates, weighted by phase, scaled to the program */
+    printf("\nWhole program (estimated; %.2f%% of its instructions simulated in detail):\n",
+           100.0 * detailed / insts);
+    printf("Cycles: %.0f\n", cpi / weight * insts);
+    printf("FetchedInstr: %.0f\n", fetched / weight * insts);
+    printf("RetiredInstr: %llu\n", (unsigned long long)insts);
+    printf("IPC: %0.3f\n", weight / cpi);
+    printf("Flushes: %.0f\n", flushes / weight * insts);
+    printf("ICacheMisses: %.0f\n", icache / weight * insts);
+    printf("DCacheMisses: %.0f\n\n", dcache / weight * insts);
+}
@@ -0,0 +1,27 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * SimPoint phase analysis. A functional pass over the program splits it
+ * into intervals of simpoint_interval instructions and records each one's
+ * basic-block vector: how many of its instructions ran in each basic block
+ * (here, each straight-line run of code ending at a taken branch or jump),
+ * randomly projected down to SIMPOINT_DIMS dimensions. The vectors are
+ * clustered with k-means for every k up to simpoint_max_k, and the
+ * smallest k whose Bayesian information criterion (BIC) comes within 90%
+ * of the best is kept. The interval nearest each cluster's centroid
+ * represents it: the program is run again functionally, with the caches
+ * and branch predictor kept warm, and only those intervals are simulated
+ * in detail. Their statistics, weighted by the size of their clusters,
+ * estimate those of the whole program.
+ */
+
+#ifndef _SIMPOINT_H_
+#define _SIMPOINT_H_
+
+#define SIMPOINT_DIMS 15
+
+/* shell "simpoint": profile, cluster and simulate the simulation points,
+ * then print whole-program statistics as rdump would */
+void simpoint_go();
+
+#endif
@@ -0,0 +1,527 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Design-space sweeps: one functional front end, N timing back ends. See
+ * sweep.h.
+ */
+
+#include "sweep.h"
+#include "pipe.h"
+#include "shell.h"
+#include "config.h"
+#include "isa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define SWEEP_RING   (1 << 16) /* records */
+#define SWEEP_BATCH  1024      /* records published at a time */
+#define SWEEP_VALUES 16        /* values per key */
+
+/* a retired instruction, as the back ends see it */
+#define SWEEP_BRANCH 0x01
+#define SWEEP_COND   0x02
+#define SWEEP_TAKEN  0x04
+#define SWEEP_LOAD   0x08
+#define SWEEP_STORE  0x10
+
+typedef struct Sweep_Record {
+    uint32_t pc;
+    uint32_t dest;     /* branch target (taken or not) */
+    uint32_t mem_addr;
+    uint32_t flags;
+} Sweep_Record;
+
+typedef struct Sweep_Config {
+    int icache_sets, icache_ways, dcache_sets, dcache_ways, line;
+    int pht_bits, btb;
+    int miss_latency, branch_penalty;
+    int set_sample;
+    int lru;
+} Sweep_Config;
+
+static const struct {
+    const char *name;
+    size_t offset;
+    int min, max, pow2;
+} sweep_keys[] = {
+    { "icache_sets",    offsetof(Sweep_Config, icache_sets),    1, 65536, 1 },
+    { "icache_ways",    offsetof(Sweep_Config, icache_ways),    1, 64,    1 },
+    { "dcache_sets",    offsetof(Sweep_Config, dcache_sets),    1, 65536, 1 },
+    { "dcache_ways",    offsetof(Sweep_Config, dcache_ways),    1, 64,    1 },
+    { "line",           offsetof(Sweep_Config, line),           4, 4096,  1 },
+    { "pht_bits",       offsetof(Sweep_Config, pht_bits),       1, 24,    0 },
+    { "btb",            offsetof(Sweep_Config, btb),            1, 65536, 1 },
+    { "miss_latency",   offsetof(Sweep_Config, miss_latency),   0, 10000, 0 },
+    { "branch_penalty", offsetof(Sweep_Config, branch_penalty), 0, 100,   0 },
+    { "set_sample",     offsetof(Sweep_Config, set_sample),     1, 65536, 1 },
+    { "lru",            offsetof(Sweep_Config, lru),            0, 1,     0 },
+};
+#define SWEEP_KEYS (int)(sizeof(sweep_keys) / sizeof(sweep_keys[0]))
+
+/* cache: per set, 'ways' line numbers and their fill stamps - or, with
+ * 'lru', their last-use stamps. With set sampling only the kept sets have
+ * them: 'slot' maps each set to its place among the kept ones, or -1. */
+typedef struct Sweep_Cache {
+    int sets, ways, line_shift, kept, lru;
+    int32_t *slot;
+    uint32_t *tags;
+    uint64_t *stamps, clock;
+    uint64_t *set_accesses, *set_misses; /* per kept set */
+    uint64_t accesses;                   /* to all sets */
+    double miss_ratio, error;            /* estimated at the end */
+} Sweep_Cache;
+
+typedef struct Sweep_Btb {
+    uint32_t tag, target;
+    uint8_t valid, conditional;
+} Sweep_Btb;
+
+typedef struct Sweep_Backend {
+    /* how far this back end has read; alone on its cache line */
+    _Alignas(64) _Atomic uint64_t tail;
+    _Alignas(64) Sweep_Config c;
+    char name[96];
+    pthread_t thread;
+
+    Sweep_Cache icache, dcache;
+    uint8_t *pht;
+    uint32_t ghr;
+    Sweep_Btb *btb;
+
+    uint64_t insts, branches, mispredicts;
+    double seconds; /* thread CPU time */
+} Sweep_Backend;
+
+static Sweep_Record *ring;
+static _Atomic uint64_t ring_head;
+static _Atomic int ring_done;
+
+static void *sweep_alloc(size_t n, size_t size)
+{
+    void *p = calloc(n, size);
+    if (!p) {
+        printf("Error: out of memory for the sweep\n");
+        exit(-1);
+    }
+    return p;
+}
+
+static int sweep_log2(int n)
+{
+    int k = 0;
+    while ((1 << k) < n)
+        k++;
+    return k;
+}
+
+/* whether set sampling 1 in 'sample' keeps 'set': a hash of the index, so
+ * that the kept sets don't line up with strided accesses */
+static int sweep_set_kept(uint32_t set, int sample)
+{
+    return (((set * 0x9E3779B1u) >> 16) & (sample - 1)) == 0;
+}
+
+static void sweep_cache_init(Sweep_Cache *c, int sets, int ways, int line, int sample, int lru)
+{
+    c->sets = sets;
+    c->ways = ways;
+    c->lru = lru;
+    c->line_shift = sweep_log2(line);
+    c->slot = sweep_alloc(sets, sizeof(int32_t));
+    c->kept = 0;
+    for (int s = 0; s < sets; s++)
+        c->slot[s] = sweep_set_kept(s, sample) ? c->kept++ : -1;
+    if (c->kept == 0)
+        c->slot[0] = c->kept++;
+    c->tags = sweep_alloc((size_t)c->kept * ways, sizeof(uint32_t));
+    c->stamps = sweep_alloc((size_t)c->kept * ways, sizeof(uint64_t));
+    c->set_accesses = sweep_alloc(c->kept, sizeof(uint64_t));
+    c->set_misses = sweep_alloc(c->kept, sizeof(uint64_t));
+    c->clock = 0;
+}
+
+static void sweep_cache_free(Sweep_Cache *c)
+{
+    free(c->slot);
+    free(c->tags);
+    free(c->stamps);
+    free(c->set_accesses);
+    free(c->set_misses);
+}
+
+static inline void sweep_cache_access(Sweep_Cache *c, uint32_t addr)
+{
+    uint32_t line = addr >> c->line_shift;
+    int32_t slot = c->slot[line & (c->sets - 1)];
+
+    c->accesses++;
+    if (slot < 0)
+        return;
+
+    size_t base = (size_t)slot * c->ways;
+    uint32_t *tags = c->tags + base;
+    uint64_t *stamps = c->stamps + base;
+    int victim = 0;
+
+    c->set_accesses[slot]++;
+    c->clock++;
+    for (int w = 0; w < c->ways; w++) {
+        /* stamp 0: never filled */
+        if (tags[w] == line && stamps[w]) {
+            if (c->lru)
+                stamps[w] = c->clock;
+            return;
+        }
+        if (stamps[w] < stamps[victim])
+            victim = w;
+    }
+    c->set_misses[slot]++;
+    tags[victim] = line;
+    stamps[victim] = c->clock;
+}
+
+/* the kept sets' miss ratio, as the estimate for all, and the half-width
+ * of its 95% confidence interval: the kept sets are a sample of clusters of
+ * accesses, and this the ratio estimator's variance over them. With fewer
+ * than two of them accessed there is no telling (NAN). */
+static void sweep_cache_estimate(Sweep_Cache *c)
+{
+    uint64_t accesses = 0, misses = 0;
+    int used = 0;
+
+    for (int i = 0; i < c->kept; i++) {
+        accesses += c->set_accesses[i];
+        misses += c->set_misses[i];
+        used += c->set_accesses[i] != 0;
+    }
+    c->miss_ratio = accesses ? (double)misses / accesses : 0.0;
+    c->error = 0.0;
+    if (c->kept < c->sets && used < 2)
+        c->error = NAN;
+    else if (c->kept < c->sets) {
+        double mean = (double)accesses / c->kept, sum = 0.0;
+        for (int i = 0; i < c->kept; i++) {
+            double d = c->set_misses[i] - c->miss_ratio * c->set_accesses[i];
+            sum += d * d;
+        }
+        double var = (1.0 - (double)c->kept / c->sets) * sum / (c->kept - 1) /
+                     (c->kept * mean * mean);
+        c->error = 1.96 * sqrt(var);
+    }
+}
+
+/* the pipeline's predictor (pipe_predict, pipe_update_predictor and
+ * check_flush_pipe), sized by the configuration: returns whether the branch
+ * flushes */
+static inline _Bool sweep_branch(Sweep_Backend *b, const Sweep_Record *r)
+{
+    uint32_t mask = (1u << b->c.pht_bits) - 1;
+    uint32_t index = ((r->pc >> 2) ^ b->ghr) & mask;
+    Sweep_Btb *e = &b->btb[(r->pc >> 2) & (b->c.btb - 1)];
+    _Bool taken = (r->flags & SWEEP_TAKEN) != 0;
+
+    _Bool btb_miss = !(e->tag == r->pc || e->valid);
+    _Bool predict_taken = !btb_miss && b->pht[index] >= 2 &&
+                          ((e->valid && e->tag == r->pc) || !e->conditional);
+
+    if (r->flags & SWEEP_COND) {
+        if (taken && b->pht[index] < 3)
+            b->pht[index]++;
+        if (!taken && b->pht[index] > 0)
+            b->pht[index]--;
+        b->ghr = ((b->ghr << 1) | taken) & mask;
+    }
+    e->tag = r->pc;
+    e->target = r->dest;
+    e->valid = r->dest >= 0x00400000 && r->dest < 0x00500000;
+    e->conditional = (r->flags & SWEEP_COND) != 0;
+
+    return taken != predict_taken || btb_miss;
+}
+
+static void *sweep_backend(void *arg)
+{
+    Sweep_Backend *b = arg;
+    uint64_t tail = 0;
+    struct timespec t;
+
+    for (;;) {
+        /* done before head: every record published before done is seen */
+        int done = atomic_load_explicit(&ring_done, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+        if (tail == head) {
+            if (done)
+                break;
+            sched_yield();
+            continue;
+        }
+        for (; tail < head; tail++) {
+            const Sweep_Record *r = &ring[tail & (SWEEP_RING - 1)];
+
+            b->insts++;
+            sweep_cache_access(&b->icache, r->pc);
+            if (r->flags & (SWEEP_LOAD | SWEEP_STORE))
+                sweep_cache_access(&b->dcache, r->mem_addr);
+            if (r->flags & SWEEP_BRANCH) {
+                b->branches++;
+                b->mispredicts += sweep_branch(b, r);
+            }
+        }
+        atomic_store_explicit(&b->tail, tail, memory_order_release);
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    b->seconds = t.tv_sec + t.tv_nsec / 1e9;
+    return NULL;
+}
+
+/* the functional front end: run the program, publishing what retires */
+static uint64_t sweep_front_end(Sweep_Backend *backends, int n)
+{
+    uint64_t head = 0, limit = 0;
+
+    while (RUN_BIT) {
+        Pipe_Op op = { .pc = pipe.PC };
+
+        op.instruction = mem_read_32(op.pc);
+        isa_decode(&op);
+        uint32_t mem_addr = pipe.REGS[op.reg_src1 > 0 ? op.reg_src1 : 0] + op.se_imm16;
+        pipe_step(0);
+
+        /* room for the record: the slowest back end is less than a ring
+         * behind */
+        while (head == limit) {
+            limit = UINT64_MAX;
+            for (int i = 0; i < n; i++) {
+                uint64_t room = atomic_load_explicit(&backends[i].tail, memory_order_acquire) + SWEEP_RING;
+                if (room < limit)
+                    limit = room;
+            }
+            if (head == limit)
+                sched_yield();
+        }
+
+        Sweep_Record *r = &ring[head & (SWEEP_RING - 1)];
+        r->pc = op.pc;
+        r->flags = 0;
+        if (op.is_branch) {
+            _Bool taken = op.branch_taken || op.insn == INSN_JR || op.insn == INSN_JALR ||
+                          (op.branch_cond && pipe.PC != op.pc + 4);
+            r->flags = SWEEP_BRANCH | (op.branch_cond ? SWEEP_COND : 0) | (taken ? SWEEP_TAKEN : 0);
+            r->dest = taken ? pipe.PC : op.branch_dest;
+        }
+        if (op.is_mem) {
+            r->flags |= op.mem_write ? SWEEP_STORE : SWEEP_LOAD;
+            r->mem_addr = mem_addr;
+        }
+        if (++head % SWEEP_BATCH == 0)
+            atomic_store_explicit(&ring_head, head, memory_order_release);
+    }
+    atomic_store_explicit(&ring_head, head, memory_order_release);
+    atomic_store_explicit(&ring_done, 1, memory_order_release);
+    return head;
+}
+
+/* parse "key=v1,v2 ..." into the values of each key (none: the machine's) */
+static int sweep_parse(const char *args, int values[][SWEEP_VALUES], int *counts, int *given)
+{
+    char buf[512], *save, *tok;
+
+    snprintf(buf, sizeof(buf), "%s", args);
+    for (tok = strtok_r(buf, " \t\n", &save); tok; tok = strtok_r(NULL, " \t\n", &save)) {
+        char *eq = strchr(tok, '='), *v, *vsave;
+        int k;
+
+        if (eq)
+            *eq = '\0';
+        for (k = 0; k < SWEEP_KEYS && strcmp(sweep_keys[k].name, tok) != 0; k++)
+            ;
+        if (!eq || k == SWEEP_KEYS) {
+            printf("Usage: sweep key=value[,value...] ... with keys");
+            for (k = 0; k < SWEEP_KEYS; k++)
+                printf(" %s", sweep_keys[k].name);
+            printf("\n\n");
+            return 0;
+        }
+        counts[k] = 0;
+        given[k] = 1;
+        for (v = strtok_r(eq + 1, ",", &vsave); v; v = strtok_r(NULL, ",", &vsave)) {
+            char *end;
+            long x = strtol(v, &end, 0);
+            if (*end || x < sweep_keys[k].min || x > sweep_keys[k].max ||
+                (sweep_keys[k].pow2 && (x & (x - 1)))) {
+                printf("Bad value %s for %s: %d .. %d%s\n\n", v, sweep_keys[k].name,
+                       sweep_keys[k].min, sweep_keys[k].max,
+                       sweep_keys[k].pow2 ? ", a power of two" : "");
+                return 0;
+            }
+            if (counts[k] == SWEEP_VALUES) {
+                printf("At most %d values per key\n\n", SWEEP_VALUES);
+                return 0;
+            }
+            values[k][counts[k]++] = x;
+        }
+    }
+    return 1;
+}
+
+static void sweep_backend_init(Sweep_Backend *b, const Sweep_Config *c)
+{
+    b->c = *c;
+    atomic_init(&b->tail, 0);
+    sweep_cache_init(&b->icache, c->icache_sets, c->icache_ways, c->line, c->set_sample, c->lru);
+    sweep_cache_init(&b->dcache, c->dcache_sets, c->dcache_ways, c->line, c->set_sample, c->lru);
+    b->pht = sweep_alloc((size_t)1 << c->pht_bits, 1);
+    b->btb = sweep_alloc(c->btb, sizeof(Sweep_Btb));
+}
+
+static void sweep_backend_free(Sweep_Backend *b)
+{
+    sweep_cache_free(&b->icache);
+    sweep_cache_free(&b->dcache);
+    free(b->pht);
+    free(b->btb);
+}
+
+static double sweep_ratio(uint64_t n, uint64_t d, double scale)
+{
+    return d ? scale * n / d : 0.0;
+}
+
+void sweep_go(const char *args)
+{
+    int values[SWEEP_KEYS][SWEEP_VALUES], counts[SWEEP_KEYS], given[SWEEP_KEYS];
+    Sweep_Config machine = {
+        .icache_sets = 64, .icache_ways = 4, .dcache_sets = 256, .dcache_ways = 8,
+        .line = 32, .pht_bits = 8, .btb = 1024,
+        .miss_latency = ICACHE_MISS_LATENCY, .branch_penalty = pipe_branch_flush() - 1,
+        .set_sample = 1, .lru = 0,
+    };
+    struct timespec t0, t1, t;
+
+    if (config.cores > 1) {
+        printf("Sweeps simulate a single core\n\n");
+        return;
+    }
+    for (int k = 0; k < SWEEP_KEYS; k++) {
+        counts[k] = 1;
+        given[k] = 0;
+        values[k][0] = *(int *)((char *)&machine + sweep_keys[k].offset);
+    }
+    if (!sweep_parse(args, values, counts, given))
+        return;
+
+    int n = 1;
+    for (int k = 0; k < SWEEP_KEYS; k++) {
+        n *= counts[k];
+        if (n > SWEEP_MAX) {
+            printf("Too many configurations: at most %d\n\n", SWEEP_MAX);
+            return;
+        }
+    }
+
+    /* the cross product, the first key varying slowest */
+    Sweep_Backend *backends = aligned_alloc(64, n * sizeof(Sweep_Backend));
+    if (!backends) {
+        printf("Error: out of memory for the sweep\n");
+        exit(-1);
+    }
+    memset(backends, 0, n * sizeof(Sweep_Backend));
+    for (int i = 0; i < n; i++) {
+        Sweep_Config c;
+        int rest = i, len = 0;
+
+        for (int k = SWEEP_KEYS - 1; k >= 0; k--) {
+            *(int *)((char *)&c + sweep_keys[k].offset) = values[k][rest % counts[k]];
+            rest /= counts[k];
+        }
+        sweep_backend_init(&backends[i], &c);
+        snprintf(backends[i].name, sizeof(backends[i].name), "this machine");
+        for (int k = 0; k < SWEEP_KEYS; k++)
+            if ((counts[k] > 1 || (given[k] && n == 1)) && len < (int)sizeof(backends[i].name))
+                len += snprintf(backends[i].name + len, sizeof(backends[i].name) - len, "%s%s=%d",
+                                len ? " " : "", sweep_keys[k].name,
+                                *(int *)((char *)&c + sweep_keys[k].offset));
+    }
+
+    ring = sweep_alloc(SWEEP_RING, sizeof(Sweep_Record));
+    atomic_store(&ring_head, 0);
+    atomic_store(&ring_done, 0);
+
+    reset();
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&backends[i].thread, NULL, sweep_backend, &backends[i]) != 0) {
+            printf("Error: can't create thread for a sweep back end\n");
+            exit(-1);
+        }
+    }
+    uint64_t insts = sweep_front_end(backends, n);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    double front = t.tv_sec + t.tv_nsec / 1e9;
+    double slowest = 0, total = 0;
+    for (int i = 0; i < n; i++) {
+        pthread_join(backends[i].thread, NULL);
+        total += backends[i].seconds;
+        if (backends[i].seconds > slowest)
+            slowest = backends[i].seconds;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("Sweep: %llu instructions, %d configuration%s in %.3f s\n",
+           (unsigned long long)insts, n, n == 1 ? "" : "s", seconds);
+    printf("  (CPU: front end %.3f s, back ends %.3f s in all, the slowest %.3f s)\n\n",
+           front, total, slowest);
+    printf("  %-40s %7s %7s %7s %7s %7s %7s %7s\n", "configuration",
+           "I-miss%", "D-miss%", "mispr%", "I-MPKI", "D-MPKI", "B-MPKI", "CPI");
+    int sampled = 0;
+    for (int i = 0; i < n; i++) {
+        Sweep_Backend *b = &backends[i];
+        sweep_cache_estimate(&b->icache);
+        sweep_cache_estimate(&b->dcache);
+        double imisses = b->icache.miss_ratio * b->icache.accesses;
+        double dmisses = b->dcache.miss_ratio * b->dcache.accesses;
+        double cycles = b->insts + 4 + (imisses + dmisses) * b->c.miss_latency +
+                        (double)b->mispredicts * b->c.branch_penalty;
+        printf("  %-40s %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f\n", b->name,
+               100 * b->icache.miss_ratio, 100 * b->dcache.miss_ratio,
+               sweep_ratio(b->mispredicts, b->branches, 100),
+               b->insts ? 1000 * imisses / b->insts : 0.0,
+               b->insts ? 1000 * dmisses / b->insts : 0.0,
+               sweep_ratio(b->mispredicts, b->insts, 1000),
+               b->insts ? cycles / b->insts : 0.0);
+        sampled |= b->c.set_sample > 1;
+    }
+    printf("\n");
+
+    if (sampled) {
+        int unknown = 0;
+        printf("  Set sampling: sets simulated, miss ratios with 95%% confidence intervals\n");
+        printf("  %-40s %13s %18s %13s %18s\n", "configuration", "I-sets", "I-miss%", "D-sets", "D-miss%");
+        for (int i = 0; i < n; i++) {
+            Sweep_Backend *b = &backends[i];
+            printf("  %-40s %6d/%-6d %8.3f +- %6.3f %6d/%-6d %8.3f +- %6.3f\n", b->name,
+                   b->icache.kept, b->icache.sets, 100 * b->icache.miss_ratio, 100 * b->icache.error,
+                   b->dcache.kept, b->dcache.sets, 100 * b->dcache.miss_ratio, 100 * b->dcache.error);
+            unknown |= isnan(b->icache.error) || isnan(b->dcache.error);
+        }
+        if (unknown)
+            printf("  (nan: fewer than two of the sets simulated were accessed)\n");
+        printf("\n");
+    }
+    for (int i = 0; i < n; i++)
+        sweep_backend_free(&backends[i]);
+
+    free(ring);
+    free(backends);
+    reset();
+}
@@ -0,0 +1,52 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Design-space sweeps ("sweep key=v1,v2 ... "): many cache, predictor and
+ * pipeline configurations are evaluated in one run of the program. The
+ * program is executed once, functionally (pipe_step), on the shell's
+ * thread; each retired instruction is published to a broadcast ring, and
+ * one back end per configuration - the cross product of the values given,
+ * up to SWEEP_MAX - consumes the whole stream on a host thread of its own.
+ *
+ * A back end is a trace-driven timing model with its own state:
+ * instruction and data caches, and the pipeline's predictor (gshare pattern
+ * table, direct-mapped BTB, with its rules for predicting and flushing),
+ * all sized by its configuration:
+ *
+ *   icache_sets icache_ways dcache_sets dcache_ways   powers of two
+ *   line                 line bytes (both caches), a power of two
+ *   pht_bits             pattern table index and history bits
+ *   btb                  BTB entries, a power of two
+ *   miss_latency         cycles per cache miss
+ *   branch_penalty       cycles per flush
+ *   set_sample           simulate one in set_sample sets of each cache
+ *   lru                  1: replace the least recently used line; 0: the
+ *                        first filled, as the simulated machine's caches do
+ *
+ * Keys not given are those of the simulated machine (its caches are
+ * 64 x 4 and 256 x 8 lines of 32 bytes replaced in fill order, its
+ * predictor 8 bits and 1024 entries; the branch penalty follows
+ * branch_stage), so with none given the one back end reproduces trace
+ * replay's misses and mispredictions. Cycles are estimated as in trace
+ * replay (replay.h): one per instruction plus the stalls.
+ *
+ * Set sampling makes large caches cheap when only their miss ratios are
+ * wanted: only the sets a hash of the index picks are simulated - the
+ * others cost a table lookup and no state - and their miss ratio is the
+ * estimate for the whole cache, given with a 95% confidence interval (the
+ * kept sets are a sample of clusters of accesses).
+ *
+ * The ring has one head, advanced by the front end, and one tail per back
+ * end; the front end only waits when the slowest back end is a whole ring
+ * behind, so the sweep takes about as long as the slowest configuration.
+ */
+
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#define SWEEP_MAX 64
+
+/* shell "sweep": 'args' is the rest of the command line */
+void sweep_go(const char *args);
+
+#endif
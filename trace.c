@@ -0,0 +1,305 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Execution trace writer. See trace.h.
+ */
+
+#include "trace.h"
+#include "shell.h"
+#include "config.h"
+#include "isa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define TRACE_RING_SIZE  (1 << 20)
+#define TRACE_RECORD_MAX 64
+
+/* ChampSim's input_instr */
+typedef struct Champsim_Instr {
+    uint64_t ip;
+    uint8_t is_branch, branch_taken;
+    uint8_t destination_registers[2];
+    uint8_t source_registers[4];
+    uint64_t destination_memory[2];
+    uint64_t source_memory[4];
+} Champsim_Instr;
+
+_Static_assert(sizeof(Champsim_Instr) == 64, "ChampSim records are 64 bytes");
+
+/* ChampSim's special registers */
+#define CHAMPSIM_SP    6
+#define CHAMPSIM_FLAGS 25
+#define CHAMPSIM_IP    26
+#define CHAMPSIM_GPR(r) (32 + (r))
+
+static struct {
+    FILE *file;
+    int format;
+    pthread_t writer;
+
+    /* the ring: the simulation thread advances head, the writer tail */
+    uint8_t *ring;
+    _Atomic uint64_t head, tail;
+    _Atomic int done;
+
+    /* encoder state */
+    uint32_t next_pc, last_addr;
+    uint32_t regs[32], hi, lo;
+    uint32_t itable_pc[TRACE_ITABLE], itable[TRACE_ITABLE];
+
+    uint64_t records, waits;
+} trace;
+
+_Thread_local int trace_on;
+
+static void *trace_writer(void *arg)
+{
+    struct timespec nap = { 0, 200000 };
+
+    (void)arg;
+    for (;;) {
+        /* done before head: every record pushed before done is seen */
+        int done = atomic_load_explicit(&trace.done, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&trace.head, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&trace.tail, memory_order_relaxed);
+
+        if (head == tail) {
+            if (done)
+                break;
+            nanosleep(&nap, NULL);
+            continue;
+        }
+        uint32_t at = tail & (TRACE_RING_SIZE - 1);
+        uint64_t n = head - tail;
+        if (n > TRACE_RING_SIZE - at)
+            n = TRACE_RING_SIZE - at;
+        fwrite(trace.ring + at, 1, n, trace.file);
+        atomic_store_explicit(&trace.tail, tail + n, memory_order_release);
+    }
+    return NULL;
+}
+
+static void trace_push(const uint8_t *rec, uint32_t len)
+{
+    uint64_t head = atomic_load_explicit(&trace.head, memory_order_relaxed);
+
+    if (head + len - atomic_load_explicit(&trace.tail, memory_order_acquire) > TRACE_RING_SIZE) {
+        trace.waits++;
+        while (head + len - atomic_load_explicit(&trace.tail, memory_order_acquire) > TRACE_RING_SIZE)
+            sched_yield();
+    }
+
+    uint32_t at = head & (TRACE_RING_SIZE - 1);
+    uint32_t first = len < TRACE_RING_SIZE - at ? len : TRACE_RING_SIZE - at;
+    memcpy(trace.ring + at, rec, first);
+    memcpy(trace.ring, rec + first, len - first);
+    atomic_store_explicit(&trace.head, head + len, memory_order_release);
+    trace.records++;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static inline uint32_t zigzag(uint32_t v)
+{
+    return (v << 1) ^ (uint32_t)((int32_t)v >> 31);
+}
+
+/* whether op writes HI and LO, updating the trace's copy of them (MTHI and
+ * MTLO write one; the other is not meaningful in the op on every core) */
+static int trace_hilo(const Pipe_Op *op)
+{
+    switch (op->insn) {
+        case INSN_MULT: case INSN_MULTU: case INSN_DIV: case INSN_DIVU:
+            trace.hi = op->hi_value;
+            trace.lo = op->lo_value;
+            return 1;
+        case INSN_MTHI:
+            trace.hi = op->hi_value;
+            return 1;
+        case INSN_MTLO:
+            trace.lo = op->lo_value;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void trace_native(const Pipe_Op *op)
+{
+    uint8_t rec[TRACE_RECORD_MAX], *p = rec + 1, flags = 0;
+
+    if (op->pc != trace.next_pc) {
+        flags |= TRACE_PC;
+        p = put_varint(p, zigzag(op->pc - trace.next_pc));
+    }
+    trace.next_pc = op->pc + 4;
+
+    uint32_t slot = (op->pc >> 2) & (TRACE_ITABLE - 1);
+    if (trace.itable_pc[slot] != op->pc || trace.itable[slot] != op->instruction) {
+        flags |= TRACE_INSTR;
+        trace.itable_pc[slot] = op->pc;
+        trace.itable[slot] = op->instruction;
+        for (int i = 0; i < 4; i++)
+            *p++ = op->instruction >> (8 * i);
+    }
+
+    if (op->reg_dst > 0) {
+        flags |= TRACE_REG;
+        *p++ = op->reg_dst;
+        p = put_varint(p, zigzag(op->reg_dst_value - trace.regs[op->reg_dst]));
+        trace.regs[op->reg_dst] = op->reg_dst_value;
+    }
+
+    if (op->is_mem) {
+        flags |= TRACE_MEM | (op->mem_write ? TRACE_STORE : 0);
+        p = put_varint(p, zigzag(op->mem_addr - trace.last_addr));
+        p = put_varint(p, op->mem_write ? op->mem_value : op->reg_dst_value);
+        trace.last_addr = op->mem_addr;
+    }
+
+    if (trace_hilo(op)) {
+        flags |= TRACE_HILO;
+        p = put_varint(p, trace.hi);
+        p = put_varint(p, trace.lo);
+    }
+
+    rec[0] = flags;
+    trace_push(rec, p - rec);
+}
+
+static void trace_champsim(const Pipe_Op *op)
+{
+    Champsim_Instr r;
+    int nd = 0, ns = 0;
+
+    memset(&r, 0, sizeof(r));
+    r.ip = op->pc;
+
+    if (op->is_branch) {
+        uint8_t flags = isa_info[op->insn].flags;
+
+        r.is_branch = 1;
+        r.branch_taken = op->branch_taken;
+        r.destination_registers[nd++] = CHAMPSIM_IP;
+        if ((flags & ISA_LINK) || op->insn == INSN_JALR) {
+            /* call */
+            r.destination_registers[nd++] = CHAMPSIM_SP;
+            r.source_registers[ns++] = CHAMPSIM_SP;
+            r.source_registers[ns++] = CHAMPSIM_IP;
+            if (op->insn == INSN_JALR)
+                r.source_registers[ns++] = CHAMPSIM_GPR(op->reg_src1);
+        }
+        else if (op->insn == INSN_JR && op->reg_src1 == 31) {
+            /* return */
+            r.destination_registers[nd++] = CHAMPSIM_SP;
+            r.source_registers[ns++] = CHAMPSIM_SP;
+        }
+        else if (flags & ISA_COND) {
+            r.source_registers[ns++] = CHAMPSIM_IP;
+            r.source_registers[ns++] = CHAMPSIM_FLAGS;
+        }
+        else if (op->insn == INSN_JR) {
+            r.source_registers[ns++] = CHAMPSIM_GPR(op->reg_src1);
+        }
+    }
+    else {
+        if (op->reg_dst > 0)
+            r.destination_registers[nd++] = CHAMPSIM_GPR(op->reg_dst);
+        if (op->reg_src1 > 0)
+            r.source_registers[ns++] = CHAMPSIM_GPR(op->reg_src1);
+        if (op->reg_src2 > 0 && op->reg_src2 != op->reg_src1)
+            r.source_registers[ns++] = CHAMPSIM_GPR(op->reg_src2);
+        if (op->is_mem) {
+            if (op->mem_write)
+                r.destination_memory[0] = op->mem_addr;
+            else
+                r.source_memory[0] = op->mem_addr;
+        }
+    }
+
+    trace_push((const uint8_t *)&r, sizeof(r));
+}
+
+void trace_retire(const Pipe_Op *op)
+{
+    if (trace.format == TRACE_CHAMPSIM)
+        trace_champsim(op);
+    else
+        trace_native(op);
+}
+
+void trace_open(const char *path)
+{
+    static int registered;
+
+    if (config.cores > 1) {
+        printf("Tracing records a single core\n\n");
+        return;
+    }
+    trace_close();
+
+    trace.file = fopen(path, "wb");
+    if (!trace.file) {
+        printf("Can't open trace file %s\n\n", path);
+        return;
+    }
+    if (!trace.ring && !(trace.ring = malloc(TRACE_RING_SIZE))) {
+        printf("Error: out of memory for the trace buffer\n");
+        exit(-1);
+    }
+    trace.format = config.trace_format;
+    atomic_store(&trace.head, 0);
+    atomic_store(&trace.tail, 0);
+    atomic_store(&trace.done, 0);
+    trace.next_pc = trace.last_addr = 0;
+    memset(trace.regs, 0, sizeof(trace.regs));
+    trace.hi = trace.lo = 0;
+    memset(trace.itable_pc, 0xFF, sizeof(trace.itable_pc));
+    trace.records = trace.waits = 0;
+
+    if (trace.format == TRACE_NATIVE)
+        fwrite(TRACE_MAGIC, 1, 8, trace.file);
+    if (pthread_create(&trace.writer, NULL, trace_writer, NULL) != 0) {
+        printf("Error: can't create the trace writer thread\n");
+        exit(-1);
+    }
+    if (!registered) {
+        atexit(trace_close);
+        registered = 1;
+    }
+
+    trace_on = 1;
+    printf("Tracing retired instructions to %s (%s)\n\n", path,
+           trace.format == TRACE_CHAMPSIM ? "ChampSim" : "native");
+}
+
+void trace_close()
+{
+    if (!trace.file)
+        return;
+
+    trace_on = 0;
+    atomic_store_explicit(&trace.done, 1, memory_order_release);
+    pthread_join(trace.writer, NULL);
+    long bytes = ftell(trace.file);
+    fclose(trace.file);
+    trace.file = NULL;
+
+    printf("Trace: %llu instructions, %ld bytes (%.2f per instruction), the simulation waited %llu times\n\n",
+           (unsigned long long)trace.records, bytes,
+           trace.records ? (double)bytes / trace.records : 0.0,
+           (unsigned long long)trace.waits);
+}
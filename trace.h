@@ -0,0 +1,65 @@
+/*
+ * MIPS pipeline timing simulator
+ *
+ * Execution traces ("trace file"): every instruction that retires, in
+ * detailed or functional simulation, is recorded in the trace_format:
+ *
+ * native - the magic "MIPSTRC1", then a record per instruction:
+ *
+ *   flags   1 byte of TRACE_* bits
+ *   pc      varint, zigzag of pc - (previous pc + 4)        if TRACE_PC
+ *   instr   4 bytes, little-endian                          if TRACE_INSTR
+ *   reg     1 byte register, varint, zigzag of the value
+ *           minus the register's previous traced value      if TRACE_REG
+ *   mem     varint, zigzag of address - previous address;
+ *           varint value stored, or loaded as extended      if TRACE_MEM
+ *   hilo    varint HI, varint LO (multiply, divide, MTHI/LO)  if TRACE_HILO
+ *
+ *   Varints are LEB128: 7 bits per byte, low first, the top bit set on all
+ *   but the last. The instruction is left out when it is the one last
+ *   recorded for its pc in a direct-mapped table of TRACE_ITABLE entries
+ *   (indexed by pc >> 2), which a reader keeps as well. Straight-line code
+ *   that writes a register thus costs about 3 bytes per instruction.
+ *
+ * champsim - ChampSim's 64-byte input_instr records, uncompressed (xz them
+ *   for ChampSim). Registers are numbered 32 + r; branches use ChampSim's
+ *   stack pointer, flags and instruction pointer registers so that it
+ *   classifies them: conditional branches read the flags, calls (JAL,
+ *   JALR, BLTZAL, BGEZAL) and returns (JR $ra) use the stack pointer, and
+ *   other JRs are indirect.
+ *
+ * The simulation thread encodes records into a single-producer,
+ * single-consumer ring buffer without locks; a background thread writes
+ * them to the file, so the simulation only waits when the ring is full.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "pipe.h"
+
+#define TRACE_MAGIC "MIPSTRC1"
+
+#define TRACE_PC    0x01
+#define TRACE_INSTR 0x02
+#define TRACE_REG   0x04
+#define TRACE_MEM   0x08
+#define TRACE_STORE 0x10 /* with TRACE_MEM */
+#define TRACE_HILO  0x20
+
+#define TRACE_ITABLE 4096
+
+#define TRACE_NATIVE   0
+#define TRACE_CHAMPSIM 1
+
+/* set while this thread's retired instructions are traced */
+extern _Thread_local int trace_on;
+
+/* shell "trace file" and "trace off" (also done at exit) */
+void trace_open(const char *path);
+void trace_close();
+
+/* record an instruction that retired */
+void trace_retire(const Pipe_Op *op);
+
+#endif